@@ -0,0 +1,135 @@
+#include "DynamicBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Scene {
+
+DynamicBuffer::~DynamicBuffer()
+{
+	deleteFences();
+	// deleting a mapped buffer unmaps it
+	if(mBuffer)
+		glDeleteBuffers(1, &mBuffer);
+	if(!mRetired.empty())
+		glDeleteBuffers(mRetired.size(), &mRetired[0]);
+}
+
+void DynamicBuffer::init(size_t frameSize)
+{
+	// the fences are core since 3.2
+	mPersistent = (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) &&
+		(GLEW_VERSION_3_2 || GLEW_ARB_sync);
+	allocate(frameSize);
+}
+
+bool DynamicBuffer::isPersistent() const
+{
+	return mPersistent;
+}
+
+void DynamicBuffer::allocate(size_t frameSize)
+{
+	// the draws issued this frame may still use the old buffer, so it
+	// is only deleted at the end of the frame
+	if(mBuffer)
+		mRetired.push_back(mBuffer);
+	deleteFences();
+	// the regions start at multiples of any alignment asked for
+	mFrameSize = (frameSize + 255) & ~size_t(255);
+	mOffset = 0;
+	mMapping = nullptr;
+
+	glGenBuffers(1, &mBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+	if(mPersistent) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, mFrameSize * NumRegions, nullptr, flags);
+		mMapping = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, mFrameSize * NumRegions, flags));
+		if(!mMapping) {
+			// storage is immutable, so falling back needs a new buffer
+			glDeleteBuffers(1, &mBuffer);
+			glGenBuffers(1, &mBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+			mPersistent = false;
+		}
+	}
+	if(!mPersistent)
+		glBufferData(GL_ARRAY_BUFFER, mFrameSize, nullptr, GL_STREAM_DRAW);
+}
+
+void DynamicBuffer::deleteFences()
+{
+	for(auto& f : mFences) {
+		if(f) {
+			glDeleteSync(f);
+			f = 0;
+		}
+	}
+}
+
+void DynamicBuffer::beginFrame()
+{
+	mOffset = 0;
+	if(!mPersistent) {
+		// a new store so that the driver needn't wait for the draws of
+		// the last frame
+		glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+		glBufferData(GL_ARRAY_BUFFER, mFrameSize, nullptr, GL_STREAM_DRAW);
+		return;
+	}
+
+	mRegion = (mRegion + 1) % NumRegions;
+	GLsync& fence = mFences[mRegion];
+	if(!fence)
+		return;
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if(result == GL_TIMEOUT_EXPIRED) {
+		mStalls++;
+		do {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		} while(result == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+DynamicAllocation DynamicBuffer::upload(const void* data, size_t bytes, size_t alignment)
+{
+	size_t offset = (mOffset + alignment - 1) & ~(alignment - 1);
+	if(offset + bytes > mFrameSize) {
+		allocate(std::max(mFrameSize * 2, bytes));
+		offset = 0;
+	}
+	mOffset = offset + bytes;
+
+	DynamicAllocation a;
+	a.buffer = mBuffer;
+	if(mPersistent) {
+		a.offset = mRegion * mFrameSize + offset;
+		memcpy(mMapping + a.offset, data, bytes);
+	} else {
+		a.offset = offset;
+		glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+	}
+	return a;
+}
+
+void DynamicBuffer::endFrame()
+{
+	if(mPersistent)
+		mFences[mRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	if(!mRetired.empty()) {
+		glDeleteBuffers(mRetired.size(), &mRetired[0]);
+		mRetired.clear();
+	}
+}
+
+unsigned int DynamicBuffer::getStalls() const
+{
+	return mStalls;
+}
+
+}
+
@@ -0,0 +1,72 @@
+#ifndef SCENE_DYNAMICBUFFER_H
+#define SCENE_DYNAMICBUFFER_H
+
+#include <vector>
+#include <cstddef>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+namespace Scene {
+
+// Where DynamicBuffer::upload() put the data. Valid for the draws of
+// the current frame.
+struct DynamicAllocation {
+	GLuint buffer = 0;
+	size_t offset = 0;
+};
+
+// Data written once a frame for the GPU, e.g. instance attributes and
+// debug lines, sub-allocated from one buffer.
+//
+// With ARB_buffer_storage the buffer is mapped persistently and split
+// into a region per frame in flight. The uploads are plain copies into
+// the mapping; a fence set at the end of the frame keeps the region
+// from being written again before the GPU is done with it, which only
+// waits if the CPU is that many frames ahead. Without it, the buffer is
+// orphaned at the start of the frame and written with glBufferSubData().
+class DynamicBuffer {
+	public:
+		static const unsigned int NumRegions = 3;
+
+		DynamicBuffer() = default;
+		~DynamicBuffer();
+		DynamicBuffer(const DynamicBuffer&) = delete;
+		DynamicBuffer& operator=(const DynamicBuffer&) = delete;
+
+		// must be called with a current GL context. The buffer grows
+		// when a frame needs more than frameSize bytes.
+		void init(size_t frameSize);
+		bool isPersistent() const;
+
+		void beginFrame();
+		// copies the data to the current frame's region. The offset is a
+		// multiple of alignment, which must be a power of two up to 256.
+		DynamicAllocation upload(const void* data, size_t bytes, size_t alignment = 16);
+		// after the draws using this frame's data have been issued
+		void endFrame();
+
+		// times beginFrame() had to wait for the GPU
+		unsigned int getStalls() const;
+
+	private:
+		// replaces the buffer with one whose regions hold frameSize
+		void allocate(size_t frameSize);
+		void deleteFences();
+
+		bool mPersistent = false;
+		GLuint mBuffer = 0;
+		char* mMapping = nullptr;
+		size_t mFrameSize = 0;
+		unsigned int mRegion = 0;
+		size_t mOffset = 0;
+		GLsync mFences[NumRegions] = { 0 };
+		// replaced during the frame; the draws may still use them
+		std::vector<GLuint> mRetired;
+		unsigned int mStalls = 0;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,83 @@
+#include "FileWatcher.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace Scene {
+
+FileWatcher::~FileWatcher()
+{
+	close();
+}
+
+void FileWatcher::close()
+{
+#ifdef __linux__
+	if(mFd >= 0)
+		::close(mFd);
+#endif
+	mFd = -1;
+	mDirectory.clear();
+}
+
+void FileWatcher::watch(const std::string& directory)
+{
+	close();
+#ifdef __linux__
+	mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(mFd < 0)
+		throw std::runtime_error("Unable to initialise inotify\n");
+	// editors either write the file in place or move a new one over it
+	if(inotify_add_watch(mFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close();
+		throw std::runtime_error("Unable to watch directory " + directory + "\n");
+	}
+	mDirectory = directory;
+#else
+	throw std::runtime_error("Watching files is only supported on Linux\n");
+#endif
+}
+
+bool FileWatcher::isWatching() const
+{
+	return mFd >= 0;
+}
+
+const std::string& FileWatcher::getDirectory() const
+{
+	return mDirectory;
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+	std::vector<std::string> changed;
+#ifdef __linux__
+	if(mFd < 0)
+		return changed;
+
+	alignas(inotify_event) char buf[4096];
+	while(1) {
+		ssize_t len = read(mFd, buf, sizeof(buf));
+		if(len <= 0)
+			break;
+		for(ssize_t i = 0; i < len; ) {
+			const inotify_event* ev = reinterpret_cast<const inotify_event*>(buf + i);
+			if(ev->len) {
+				std::string name(ev->name);
+				if(std::find(changed.begin(), changed.end(), name) == changed.end())
+					changed.push_back(name);
+			}
+			i += sizeof(inotify_event) + ev->len;
+		}
+	}
+#endif
+	return changed;
+}
+
+}
+
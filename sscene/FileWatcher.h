@@ -0,0 +1,36 @@
+#ifndef SCENE_FILEWATCHER_H
+#define SCENE_FILEWATCHER_H
+
+#include <string>
+#include <vector>
+
+namespace Scene {
+
+// Reports files that were written to or moved into a directory, using
+// inotify. Only supported on Linux; elsewhere watch() throws.
+class FileWatcher {
+	public:
+		FileWatcher() = default;
+		~FileWatcher();
+		FileWatcher(const FileWatcher&) = delete;
+		FileWatcher& operator=(const FileWatcher&) = delete;
+
+		// replaces the directory watched before, if any
+		void watch(const std::string& directory);
+		bool isWatching() const;
+		const std::string& getDirectory() const;
+		// names of the files changed since the last call, without the
+		// directory and each once. Never blocks.
+		std::vector<std::string> poll();
+
+	private:
+		void close();
+
+		int mFd = -1;
+		std::string mDirectory;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,255 @@
+#include "FrameStats.h"
+
+#include <sstream>
+#include <iomanip>
+
+namespace Scene {
+
+double FrameStats::gpuMs() const
+{
+	double sum = 0.0;
+	for(auto d : passGpuMs)
+		sum += d;
+	return sum;
+}
+
+void FrameStats::add(const FrameStats& f)
+{
+	drawCalls += f.drawCalls;
+	triangles += f.triangles;
+	instancesDrawn += f.instancesDrawn;
+	instancesCulled += f.instancesCulled;
+	instancesOccluded += f.instancesOccluded;
+	occlusionQueries += f.occlusionQueries;
+	textureBinds += f.textureBinds;
+	bufferBinds += f.bufferBinds;
+	uniformUploads += f.uniformUploads;
+	bytesUploaded += f.bytesUploaded;
+	stateChanges += f.stateChanges;
+	shadowDrawCalls += f.shadowDrawCalls;
+	shadowTriangles += f.shadowTriangles;
+	shadowCastersCulled += f.shadowCastersCulled;
+	textureBytesResident += f.textureBytesResident;
+	textureLevelsStreamed += f.textureLevelsStreamed;
+	textureLevelsEvicted += f.textureLevelsEvicted;
+	uploadStalls += f.uploadStalls;
+	indirectDraws += f.indirectDraws;
+	samplesShaded += f.samplesShaded;
+	shadedPerPixel += f.shadedPerPixel;
+	cpuMs += f.cpuMs;
+	for(int i = 0; i < static_cast<int>(RenderPass::NumPasses); i++)
+		passGpuMs[i] += f.passGpuMs[i];
+}
+
+void FrameStats::divide(unsigned int n)
+{
+	if(n == 0)
+		return;
+
+	// round to nearest for the integer counters
+	auto div = [n] (unsigned int v) { return (v + n / 2) / n; };
+	drawCalls = div(drawCalls);
+	triangles = div(triangles);
+	instancesDrawn = div(instancesDrawn);
+	instancesCulled = div(instancesCulled);
+	instancesOccluded = div(instancesOccluded);
+	occlusionQueries = div(occlusionQueries);
+	textureBinds = div(textureBinds);
+	bufferBinds = div(bufferBinds);
+	uniformUploads = div(uniformUploads);
+	bytesUploaded = div(bytesUploaded);
+	stateChanges = div(stateChanges);
+	shadowDrawCalls = div(shadowDrawCalls);
+	shadowTriangles = div(shadowTriangles);
+	shadowCastersCulled = div(shadowCastersCulled);
+	textureBytesResident = (textureBytesResident + n / 2) / n;
+	textureLevelsStreamed = div(textureLevelsStreamed);
+	textureLevelsEvicted = div(textureLevelsEvicted);
+	uploadStalls = div(uploadStalls);
+	indirectDraws = div(indirectDraws);
+	samplesShaded = div(samplesShaded);
+	shadedPerPixel /= n;
+	cpuMs /= n;
+	for(int i = 0; i < static_cast<int>(RenderPass::NumPasses); i++)
+		passGpuMs[i] /= n;
+}
+
+std::string FrameStats::toString() const
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(2);
+	ss << "cpu " << cpuMs << " ms, gpu " << gpuMs() << " ms ("
+		<< passGpuMs[static_cast<int>(RenderPass::Shadows)] << "/"
+		<< passGpuMs[static_cast<int>(RenderPass::Scene)] << "/"
+		<< passGpuMs[static_cast<int>(RenderPass::Lines)] << "/"
+		<< passGpuMs[static_cast<int>(RenderPass::Overlays)] << "), "
+		<< drawCalls << " draws, " << triangles << " tris, "
+		<< instancesDrawn << "/" << instancesCulled << "/" << instancesOccluded
+		<< " drawn/culled/occluded, " << shadedPerPixel << " shaded/px, "
+		<< textureBinds << " tex binds, " << bufferBinds << " buf binds, "
+		<< uniformUploads << " uniforms, " << bytesUploaded << " bytes";
+	if(shadowDrawCalls)
+		ss << ", shadows " << shadowDrawCalls << " draws, " << shadowTriangles << " tris, "
+			<< shadowCastersCulled << " culled";
+	if(textureBytesResident)
+		ss << ", textures " << textureBytesResident / (1024.0 * 1024.0) << " MB, "
+			<< textureLevelsStreamed << "/" << textureLevelsEvicted << " levels in/out";
+	if(uploadStalls)
+		ss << ", " << uploadStalls << " upload stalls";
+	if(indirectDraws)
+		ss << ", " << indirectDraws << " indirect draws";
+	return ss.str();
+}
+
+FrameProfiler::FrameProfiler()
+{
+	for(unsigned int i = 0; i < NumQuerySets; i++) {
+		for(unsigned int j = 0; j < NumPasses; j++) {
+			mQueries[i][j] = 0;
+			mQueryIssued[i][j] = false;
+		}
+		mSampleQueries[i] = 0;
+		mSampleQueryIssued[i] = false;
+	}
+}
+
+FrameProfiler::~FrameProfiler()
+{
+	if(mTimersSupported) {
+		glDeleteQueries(NumQuerySets * NumPasses, &mQueries[0][0]);
+	}
+	if(mSampleQueries[0])
+		glDeleteQueries(NumQuerySets, mSampleQueries);
+}
+
+void FrameProfiler::init()
+{
+	mTimersSupported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if(mTimersSupported) {
+		glGenQueries(NumQuerySets * NumPasses, &mQueries[0][0]);
+	}
+	// occlusion queries are core since GL 1.5
+	glGenQueries(NumQuerySets, mSampleQueries);
+}
+
+void FrameProfiler::beginFrame()
+{
+	mFrameStart = std::chrono::steady_clock::now();
+	mQuerySet = (mQuerySet + 1) % NumQuerySets;
+	collectQueries(mQuerySet);
+}
+
+void FrameProfiler::collectQueries(unsigned int set)
+{
+	// the queries of this set were issued NumQuerySets frames ago. If the
+	// result still isn't there, keep the previous value rather than stall.
+	for(unsigned int i = 0; i < NumPasses; i++) {
+		if(!mQueryIssued[set][i])
+			continue;
+
+		GLint available = 0;
+		glGetQueryObjectiv(mQueries[set][i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available) {
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(mQueries[set][i], GL_QUERY_RESULT, &ns);
+			mLastGpuMs[i] = ns / 1000000.0;
+		}
+		mQueryIssued[set][i] = false;
+	}
+
+	if(mSampleQueryIssued[set]) {
+		GLint available = 0;
+		glGetQueryObjectiv(mSampleQueries[set], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available)
+			glGetQueryObjectuiv(mSampleQueries[set], GL_QUERY_RESULT, &mLastSamples);
+		mSampleQueryIssued[set] = false;
+	}
+}
+
+void FrameProfiler::beginPass(RenderPass p)
+{
+	endPass();
+	mActivePass = static_cast<int>(p);
+	if(mTimersSupported) {
+		glBeginQuery(GL_TIME_ELAPSED, mQueries[mQuerySet][mActivePass]);
+		mQueryIssued[mQuerySet][mActivePass] = true;
+	}
+}
+
+void FrameProfiler::endPass()
+{
+	if(mActivePass < 0)
+		return;
+
+	if(mTimersSupported)
+		glEndQuery(GL_TIME_ELAPSED);
+	mActivePass = -1;
+}
+
+void FrameProfiler::beginSampleCount()
+{
+	if(!mSampleQueries[0] || mSampleQueryIssued[mQuerySet])
+		return;
+	glBeginQuery(GL_SAMPLES_PASSED, mSampleQueries[mQuerySet]);
+	mSampleQueryIssued[mQuerySet] = true;
+	mSampleCountActive = true;
+}
+
+void FrameProfiler::endSampleCount()
+{
+	if(!mSampleCountActive)
+		return;
+	glEndQuery(GL_SAMPLES_PASSED);
+	mSampleCountActive = false;
+}
+
+void FrameProfiler::setPixelCount(unsigned int pixels)
+{
+	mPixels = pixels ? pixels : 1;
+}
+
+void FrameProfiler::endFrame()
+{
+	endPass();
+	mCurrent.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mFrameStart).count();
+	for(unsigned int i = 0; i < NumPasses; i++)
+		mCurrent.passGpuMs[i] = mLastGpuMs[i];
+	mCurrent.samplesShaded = mLastSamples;
+	mCurrent.shadedPerPixel = double(mLastSamples) / mPixels;
+
+	mLast = mCurrent;
+	mCurrent = FrameStats();
+
+	mHistory.push_back(mLast);
+	while(mHistory.size() > mAverageWindow)
+		mHistory.pop_front();
+}
+
+FrameStats& FrameProfiler::current()
+{
+	return mCurrent;
+}
+
+const FrameStats& FrameProfiler::getLastFrame() const
+{
+	return mLast;
+}
+
+FrameStats FrameProfiler::getAverage() const
+{
+	FrameStats avg;
+	for(const auto& f : mHistory)
+		avg.add(f);
+	avg.divide(mHistory.size());
+	return avg;
+}
+
+void FrameProfiler::setAverageWindow(unsigned int frames)
+{
+	mAverageWindow = frames ? frames : 1;
+	while(mHistory.size() > mAverageWindow)
+		mHistory.pop_front();
+}
+
+}
+
@@ -0,0 +1,128 @@
+#ifndef SCENE_FRAMESTATS_H
+#define SCENE_FRAMESTATS_H
+
+#include <deque>
+#include <string>
+#include <chrono>
+#include <cstddef>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+namespace Scene {
+
+enum class RenderPass {
+	Shadows,
+	Scene,
+	Lines,
+	Overlays,
+	NumPasses
+};
+
+// counters collected during Scene::render(). Uploads done between two
+// frames (e.g. Scene::addLine()) are accounted to the following frame.
+struct FrameStats {
+	unsigned int drawCalls = 0;
+	unsigned int triangles = 0;
+	unsigned int instancesDrawn = 0;
+	unsigned int instancesCulled = 0;
+	// skipped because their last occlusion query found them hidden
+	unsigned int instancesOccluded = 0;
+	unsigned int occlusionQueries = 0;
+	unsigned int textureBinds = 0;
+	unsigned int bufferBinds = 0;
+	unsigned int uniformUploads = 0;
+	unsigned int bytesUploaded = 0;
+	// program, texture, buffer and fixed function state switches
+	unsigned int stateChanges = 0;
+	// the shadow map depth passes, not included in the counters above
+	unsigned int shadowDrawCalls = 0;
+	unsigned int shadowTriangles = 0;
+	// summed over all cascades
+	unsigned int shadowCastersCulled = 0;
+
+	// texture streaming: the bytes of the streamed textures after the
+	// frame, and the mip levels uploaded and evicted during it
+	size_t textureBytesResident = 0;
+	unsigned int textureLevelsStreamed = 0;
+	unsigned int textureLevelsEvicted = 0;
+
+	// times the per frame vertex data had to wait for the GPU to finish
+	// with an earlier frame before it could be written
+	unsigned int uploadStalls = 0;
+
+	// draws submitted through multi draw indirect calls, each of which
+	// counts once in drawCalls or shadowDrawCalls
+	unsigned int indirectDraws = 0;
+
+	// fragments of opaque instances that were shaded and their number
+	// per screen pixel. Lag behind like the GPU times.
+	unsigned int samplesShaded = 0;
+	double shadedPerPixel = 0.0;
+
+	// CPU time spent in Scene::render()
+	double cpuMs = 0.0;
+	// GPU time per pass. Timer queries are double buffered, so these lag
+	// two frames behind the counters and are zero if timer queries are
+	// not supported.
+	double passGpuMs[static_cast<int>(RenderPass::NumPasses)] = { 0.0 };
+
+	double gpuMs() const;
+	void add(const FrameStats& f);
+	void divide(unsigned int n);
+	std::string toString() const;
+};
+
+class FrameProfiler {
+	public:
+		FrameProfiler();
+		~FrameProfiler();
+		FrameProfiler(const FrameProfiler&) = delete;
+		FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+		// must be called with a current GL context
+		void init();
+		void beginFrame();
+		void endFrame();
+		void beginPass(RenderPass p);
+		void endPass();
+		// counts the samples passed between these, at most once a frame
+		void beginSampleCount();
+		void endSampleCount();
+		// screen size for FrameStats::shadedPerPixel
+		void setPixelCount(unsigned int pixels);
+
+		FrameStats& current();
+		const FrameStats& getLastFrame() const;
+		FrameStats getAverage() const;
+		void setAverageWindow(unsigned int frames);
+
+	private:
+		static const unsigned int NumQuerySets = 2;
+		static const unsigned int NumPasses = static_cast<unsigned int>(RenderPass::NumPasses);
+
+		void collectQueries(unsigned int set);
+
+		bool mTimersSupported = false;
+		GLuint mQueries[NumQuerySets][NumPasses];
+		bool mQueryIssued[NumQuerySets][NumPasses];
+		GLuint mSampleQueries[NumQuerySets];
+		bool mSampleQueryIssued[NumQuerySets];
+		unsigned int mLastSamples = 0;
+		unsigned int mPixels = 1;
+		bool mSampleCountActive = false;
+		unsigned int mQuerySet = 0;
+		int mActivePass = -1;
+		std::chrono::steady_clock::time_point mFrameStart;
+
+		FrameStats mCurrent;
+		FrameStats mLast;
+		double mLastGpuMs[NumPasses] = { 0.0 };
+		std::deque<FrameStats> mHistory;
+		unsigned int mAverageWindow = 60;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,52 @@
+#include "Frustum.h"
+
+#include <cmath>
+
+namespace Scene {
+
+Frustum::Frustum()
+{
+	set(Common::Matrix44::Identity);
+}
+
+Frustum::Frustum(const Common::Matrix44& viewProjection)
+{
+	set(viewProjection);
+}
+
+void Frustum::set(const Common::Matrix44& viewProjection)
+{
+	// points are row vectors, so the clip coordinates are the dot products
+	// with the columns: left is w + x >= 0, right w - x >= 0 etc.
+	const float* m = viewProjection.m;
+	for(int p = 0; p < 6; p++) {
+		int axis = p / 2;
+		float sign = p % 2 == 0 ? 1.0f : -1.0f;
+		for(int i = 0; i < 4; i++)
+			mPlanes[p][i] = m[i * 4 + 3] + sign * m[i * 4 + axis];
+
+		float len = std::sqrt(mPlanes[p][0] * mPlanes[p][0] +
+				mPlanes[p][1] * mPlanes[p][1] +
+				mPlanes[p][2] * mPlanes[p][2]);
+		if(len > 0.0f) {
+			for(int i = 0; i < 4; i++)
+				mPlanes[p][i] /= len;
+		}
+	}
+}
+
+bool Frustum::intersectsSphere(const float* center, float radius) const
+{
+	for(int p = 0; p < 6; p++) {
+		float dist = mPlanes[p][0] * center[0] +
+			mPlanes[p][1] * center[1] +
+			mPlanes[p][2] * center[2] +
+			mPlanes[p][3];
+		if(dist < -radius)
+			return false;
+	}
+	return true;
+}
+
+}
+
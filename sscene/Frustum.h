@@ -0,0 +1,26 @@
+#ifndef SCENE_FRUSTUM_H
+#define SCENE_FRUSTUM_H
+
+#include "common/Matrix44.h"
+
+namespace Scene {
+
+// The six clip planes of a view-projection matrix, pointing inwards.
+class Frustum {
+	public:
+		Frustum();
+		Frustum(const Common::Matrix44& viewProjection);
+		void set(const Common::Matrix44& viewProjection);
+
+		// conservative: may return true for spheres just outside corners
+		bool intersectsSphere(const float* center, float radius) const;
+
+	private:
+		// a, b, c, d with a * x + b * y + c * z + d >= 0 inside
+		float mPlanes[6][4];
+};
+
+}
+
+#endif
+
@@ -0,0 +1,87 @@
+#include "GLValidation.h"
+
+#include <stdio.h>
+
+namespace Scene {
+
+void GLValidation::init()
+{
+	mDebugOutputSupported = GLEW_VERSION_4_3 || GLEW_KHR_debug;
+#ifdef SSCENE_GL_DEBUG
+	setMode(GLValidationMode::PerDraw);
+#else
+	setMode(mMode);
+#endif
+}
+
+void GLValidation::setMode(GLValidationMode m)
+{
+#ifndef SSCENE_GL_DEBUG
+	if(m == GLValidationMode::PerDraw) {
+		fprintf(stderr, "Per draw GL error checking requires building with SSCENE_GL_DEBUG, using the debug callback instead.\n");
+		m = GLValidationMode::DebugCallback;
+	}
+#endif
+
+	if(m == GLValidationMode::DebugCallback && !mDebugOutputSupported) {
+		fprintf(stderr, "KHR_debug not supported, disabling GL validation.\n");
+		m = GLValidationMode::Off;
+	}
+
+	if(mDebugOutputSupported) {
+		if(m == GLValidationMode::DebugCallback) {
+			// synchronous so that the callback runs while the
+			// current object name is still valid
+			glEnable(GL_DEBUG_OUTPUT);
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDebugMessageCallback(debugCallback, this);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, NULL, GL_TRUE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_HIGH, 0, NULL, GL_TRUE);
+		} else if(mMode == GLValidationMode::DebugCallback) {
+			glDebugMessageCallback(NULL, NULL);
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDisable(GL_DEBUG_OUTPUT);
+		}
+	}
+
+	mMode = m;
+}
+
+GLValidationMode GLValidation::getMode() const
+{
+	return mMode;
+}
+
+const char* GLValidation::currentObjectName() const
+{
+	return mCurrentObject ? mCurrentObject->c_str() : "<none>";
+}
+
+void GLValidation::checkErrors(const char* file, int line)
+{
+	if(mMode != GLValidationMode::PerDraw)
+		return;
+
+	while(1) {
+		GLenum err = glGetError();
+		if(err == GL_NO_ERROR) {
+			break;
+		}
+		fprintf(stderr, "%s:%d: GL error 0x%04x while drawing '%s'\n", file, line, err,
+				currentObjectName());
+	}
+}
+
+void GLAPIENTRY GLValidation::debugCallback(GLenum source, GLenum type, GLuint id,
+		GLenum severity, GLsizei length, const GLchar* message,
+		const void* userParam)
+{
+	const GLValidation* v = static_cast<const GLValidation*>(userParam);
+	fprintf(stderr, "GL %s 0x%04x while drawing '%s': %s\n",
+			type == GL_DEBUG_TYPE_ERROR ? "error" : "message", id,
+			v->currentObjectName(), message);
+}
+
+}
+
@@ -0,0 +1,54 @@
+#ifndef SCENE_GLVALIDATION_H
+#define SCENE_GLVALIDATION_H
+
+#include <string>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+namespace Scene {
+
+enum class GLValidationMode {
+	// no error checking at all
+	Off,
+	// errors are reported by the driver through KHR_debug. Needs a debug
+	// context on some drivers; falls back to Off if not supported.
+	DebugCallback,
+	// glGetError() after every draw. Only available when built with
+	// SSCENE_GL_DEBUG, falls back to DebugCallback otherwise.
+	PerDraw
+};
+
+class GLValidation {
+	public:
+		// must be called with a current GL context
+		void init();
+		void setMode(GLValidationMode m);
+		GLValidationMode getMode() const;
+
+		// name of the object being drawn, used when reporting errors.
+		// Kept as a pointer so that setting it costs nothing in release.
+		void setCurrentObject(const std::string* name) { mCurrentObject = name; }
+		void checkErrors(const char* file, int line);
+
+	private:
+		static void GLAPIENTRY debugCallback(GLenum source, GLenum type, GLuint id,
+				GLenum severity, GLsizei length, const GLchar* message,
+				const void* userParam);
+		const char* currentObjectName() const;
+
+		bool mDebugOutputSupported = false;
+		GLValidationMode mMode = GLValidationMode::Off;
+		const std::string* mCurrentObject = nullptr;
+};
+
+}
+
+#ifdef SSCENE_GL_DEBUG
+#define CHECK_GL_ERROR(validation) { do { (validation).checkErrors(__FILE__, __LINE__); } while(0); }
+#else
+#define CHECK_GL_ERROR(validation)
+#endif
+
+#endif
+
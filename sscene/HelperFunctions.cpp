@@ -1,6 +1,7 @@
 #include "HelperFunctions.h"
 
 #include <fstream>
+#include <cstdlib>
 
 #include "common/Math.h"
 #include "common/Texture.h"
@@ -62,17 +63,61 @@ Matrix44 HelperFunctions::cameraRotationMatrix(const Vector3& tgt, const Vector3
 	return m;
 }
 
-GLuint HelperFunctions::loadShaderFromFile(GLenum type, const char* filename)
+bool HelperFunctions::readFile(const std::string& filename, std::string& contents)
 {
 	std::ifstream ifs(filename);
-	if(ifs.bad()) {
-		return 0;
+	if(!ifs) {
+		return false;
 	}
-	std::string content((std::istreambuf_iterator<char>(ifs)),
+	contents.assign((std::istreambuf_iterator<char>(ifs)),
 			(std::istreambuf_iterator<char>()));
+	return !ifs.bad();
+}
+
+std::string HelperFunctions::canonicalPath(const std::string& filename)
+{
+	char* path = realpath(filename.c_str(), NULL);
+	if(!path)
+		return filename;
+	std::string ret(path);
+	free(path);
+	return ret;
+}
+
+GLuint HelperFunctions::loadShaderFromFile(GLenum type, const char* filename)
+{
+	std::string content;
+	if(!readFile(filename, content)) {
+		return 0;
+	}
 	return loadShader(type, content.c_str());
 }
 
+GLuint HelperFunctions::compileShader(GLenum type, const char* src)
+{
+	GLuint shader = glCreateShader(type);
+	if(shader == 0)
+		return 0;
+
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	return shader;
+}
+
+void HelperFunctions::printShaderLog(GLuint shader)
+{
+	GLint type = 0;
+	GLint infoLen = 0;
+	glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
+	if(infoLen > 1) {
+		char* infoLog = new char[infoLen];
+		glGetShaderInfoLog(shader, infoLen, NULL, infoLog);
+		std::cerr << "Error compiling " << (type == GL_VERTEX_SHADER ? "vertex" : "fragment") << " shader: " << infoLog << "\n";
+		delete[] infoLog;
+	}
+}
+
 GLuint HelperFunctions::loadShader(GLenum type, const char* src)
 {
 	GLuint shader;
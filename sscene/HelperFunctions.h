@@ -28,6 +28,16 @@ class HelperFunctions {
 
 		static GLuint loadShader(GLenum type, const char* src);
 		static GLuint loadShaderFromFile(GLenum type, const char* filename);
+		// starts compiling without waiting for the result, which the
+		// driver may then produce in the background
+		static GLuint compileShader(GLenum type, const char* src);
+		// prints the compile log of a shader that failed to compile
+		static void printShaderLog(GLuint shader);
+		// returns false if the file can't be read
+		static bool readFile(const std::string& filename, std::string& contents);
+		// absolute, without symbolic links or . and .. components. The
+		// path as given if it doesn't exist.
+		static std::string canonicalPath(const std::string& filename);
 
 		static boost::shared_ptr<Common::Texture> loadTexture(const std::string& filename);
 
@@ -0,0 +1,71 @@
+#include "InstanceBuffer.h"
+
+#include <cstdint>
+
+#include "RenderCommands.h"
+
+namespace Scene {
+
+const unsigned int InstanceBuffer::WORLD_INDEX = 4;
+const unsigned int InstanceBuffer::NORMAL_MATRIX_INDEX = 8;
+
+void InstanceBuffer::init(DynamicBuffer* buffer)
+{
+	// glVertexAttribDivisor() and glDrawElementsInstanced() are core in 3.3
+	mSupported = GLEW_VERSION_3_3;
+	mDynamicBuffer = buffer;
+}
+
+bool InstanceBuffer::isSupported() const
+{
+	return mSupported;
+}
+
+size_t InstanceBuffer::upload(const std::vector<float>& data)
+{
+	if(data.empty())
+		return 0;
+
+	size_t bytes = data.size() * sizeof(GLfloat);
+	mData = mDynamicBuffer->upload(&data[0], bytes);
+	return bytes;
+}
+
+void InstanceBuffer::enable()
+{
+	for(unsigned int i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(WORLD_INDEX + i);
+		glVertexAttribDivisor(WORLD_INDEX + i, 1);
+	}
+	for(unsigned int i = 0; i < 3; i++) {
+		glEnableVertexAttribArray(NORMAL_MATRIX_INDEX + i);
+		glVertexAttribDivisor(NORMAL_MATRIX_INDEX + i, 1);
+	}
+}
+
+void InstanceBuffer::disable()
+{
+	for(unsigned int i = 0; i < 4; i++)
+		glDisableVertexAttribArray(WORLD_INDEX + i);
+	for(unsigned int i = 0; i < 3; i++)
+		glDisableVertexAttribArray(NORMAL_MATRIX_INDEX + i);
+}
+
+void InstanceBuffer::bind(unsigned int firstInstance)
+{
+	// one column of the matrix per location
+	const GLsizei stride = InstanceDataSize * sizeof(GLfloat);
+	const uintptr_t base = mData.offset + uintptr_t(firstInstance) * stride;
+	glBindBuffer(GL_ARRAY_BUFFER, mData.buffer);
+	for(unsigned int i = 0; i < 4; i++) {
+		glVertexAttribPointer(WORLD_INDEX + i, 4, GL_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid*>(base + i * 4 * sizeof(GLfloat)));
+	}
+	for(unsigned int i = 0; i < 3; i++) {
+		glVertexAttribPointer(NORMAL_MATRIX_INDEX + i, 3, GL_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid*>(base + (16 + i * 3) * sizeof(GLfloat)));
+	}
+}
+
+}
+
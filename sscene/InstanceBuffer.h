@@ -0,0 +1,53 @@
+#ifndef SCENE_INSTANCEBUFFER_H
+#define SCENE_INSTANCEBUFFER_H
+
+#include <vector>
+#include <cstddef>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "DynamicBuffer.h"
+
+namespace Scene {
+
+// Vertex buffer of per instance attributes for instanced draws: the
+// world matrix as a mat4 and the normal matrix as a mat3, laid out as
+// RenderCommandList::getInstanceData() writes them. Refilled every
+// frame from the frame's part of a DynamicBuffer.
+class InstanceBuffer {
+	public:
+		InstanceBuffer() = default;
+		InstanceBuffer(const InstanceBuffer&) = delete;
+		InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+		// must be called with a current GL context. Needs instanced
+		// arrays; isSupported() returns false without them.
+		void init(DynamicBuffer* buffer);
+		bool isSupported() const;
+
+		// between DynamicBuffer::beginFrame() and endFrame(). Returns the
+		// number of bytes uploaded.
+		size_t upload(const std::vector<float>& data);
+		// enables the attribute arrays, disable() turns them off again
+		void enable();
+		void disable();
+		// points the attributes at the data of the given instance, which
+		// becomes instance 0 of the next draw
+		void bind(unsigned int firstInstance);
+
+		// a_World uses four locations from this one, a_NormalMatrix three
+		static const unsigned int WORLD_INDEX;
+		static const unsigned int NORMAL_MATRIX_INDEX;
+
+	private:
+		bool mSupported = false;
+		DynamicBuffer* mDynamicBuffer = nullptr;
+		// this frame's data
+		DynamicAllocation mData;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,273 @@
+#include "InstanceStore.h"
+#include "JobSystem.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+using namespace Common;
+
+namespace Scene {
+
+const uint32_t InstanceStore::InvalidIndex;
+
+void InstanceTransformTable::set(InstanceHandle h, const InstanceTransform& t)
+{
+	if(h.slot >= transforms.size()) {
+		transforms.resize(h.slot + 1);
+		generations.resize(h.slot + 1, 0);
+		versions.resize(h.slot + 1, 0);
+	}
+	transforms[h.slot] = t;
+	generations[h.slot] = h.generation;
+	versions[h.slot]++;
+}
+
+void InstanceTransformTable::remove(InstanceHandle h)
+{
+	if(h.slot < generations.size() && generations[h.slot] == h.generation)
+		generations[h.slot] = 0;
+}
+
+void InstanceTransformTable::clear()
+{
+	transforms.clear();
+	generations.clear();
+	versions.clear();
+}
+
+uint32_t InstanceStore::allocateSlot(uint32_t dense)
+{
+	uint32_t slot;
+	if(mFreeSlots.empty()) {
+		slot = mSlotToDense.size();
+		mSlotToDense.push_back(InvalidIndex);
+		mSlotGeneration.push_back(1);
+	} else {
+		slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	}
+	mSlotToDense[slot] = dense;
+	return slot;
+}
+
+void InstanceStore::freeSlot(uint32_t slot)
+{
+	mSlotToDense[slot] = InvalidIndex;
+	mSlotGeneration[slot]++;
+	if(mSlotGeneration[slot] == 0)
+		mSlotGeneration[slot] = 1;
+	mFreeSlots.push_back(slot);
+}
+
+void InstanceStore::resizeDense(size_t n)
+{
+	mTransforms.resize(n);
+	mDrawables.resize(n);
+	mTextures.resize(n);
+	mFlags.resize(n);
+	mWorld.resize(n * 16);
+	mInverseWorld.resize(n * 16);
+	mNames.resize(n);
+	mDenseToSlot.resize(n);
+}
+
+void InstanceStore::moveDense(uint32_t dst, uint32_t src)
+{
+	uint32_t slot = mDenseToSlot[src];
+	mTransforms.move(dst, src);
+	mDrawables[dst] = mDrawables[src];
+	mTextures[dst] = mTextures[src];
+	mFlags[dst] = mFlags[src];
+	std::copy(&mWorld[src * 16], &mWorld[src * 16 + 16], &mWorld[dst * 16]);
+	std::copy(&mInverseWorld[src * 16], &mInverseWorld[src * 16 + 16], &mInverseWorld[dst * 16]);
+	mNames[dst] = mNames[src];
+	mDenseToSlot[dst] = slot;
+	mSlotToDense[slot] = dst;
+}
+
+InstanceHandle InstanceStore::add(const Drawable* drawable, GLuint texture, uint32_t flags,
+		const Common::Vector3& pos, const Common::Matrix44& rotation,
+		const Common::Vector3& scale)
+{
+	auto t = InstanceTransform::make(pos, rotation, scale);
+	InstanceHandle h;
+	add(drawable, texture, flags, &t, 1, &h);
+	return h;
+}
+
+void InstanceStore::add(const Drawable* drawable, GLuint texture, uint32_t flags,
+		const InstanceTransform* transforms, size_t count,
+		InstanceHandle* handles)
+{
+	size_t first = size();
+	resizeDense(first + count);
+
+	for(size_t j = 0; j < count; j++) {
+		uint32_t dense = first + j;
+		uint32_t slot = allocateSlot(dense);
+		mDenseToSlot[dense] = slot;
+		mTransforms.set(dense, transforms[j]);
+		mDrawables[dense] = drawable;
+		mTextures[dense] = texture;
+		mFlags[dense] = flags & ~(InstanceTransformDirty | InstanceWorldOverride);
+		mNames[dense] = nullptr;
+		markDirty(dense);
+
+		handles[j].slot = slot;
+		handles[j].generation = mSlotGeneration[slot];
+	}
+}
+
+void InstanceStore::remove(InstanceHandle h)
+{
+	remove(&h, 1);
+}
+
+void InstanceStore::remove(const InstanceHandle* handles, size_t count)
+{
+	for(size_t j = 0; j < count; j++) {
+		if(!isValid(handles[j]))
+			throw std::runtime_error("Tried removing a non-existing instance");
+	}
+
+	// fill each hole with the current last instance and shrink the
+	// arrays once at the end
+	size_t end = size();
+	for(size_t j = 0; j < count; j++) {
+		const auto& h = handles[j];
+		// the same handle twice in the batch
+		if(!isValid(h))
+			continue;
+
+		uint32_t dense = mSlotToDense[h.slot];
+		uint32_t last = --end;
+		if(dense != last)
+			moveDense(dense, last);
+		freeSlot(h.slot);
+	}
+	resizeDense(end);
+}
+
+bool InstanceStore::isValid(InstanceHandle h) const
+{
+	return h.slot < mSlotToDense.size() &&
+		mSlotGeneration[h.slot] == h.generation &&
+		mSlotToDense[h.slot] != InvalidIndex;
+}
+
+size_t InstanceStore::size() const
+{
+	return mDenseToSlot.size();
+}
+
+InstanceHandle InstanceStore::getHandle(size_t i) const
+{
+	InstanceHandle h;
+	h.slot = mDenseToSlot[i];
+	h.generation = mSlotGeneration[h.slot];
+	return h;
+}
+
+size_t InstanceStore::getDenseIndex(InstanceHandle h) const
+{
+	if(!isValid(h))
+		throw std::runtime_error("Invalid instance handle");
+	return mSlotToDense[h.slot];
+}
+
+void InstanceStore::markDirty(size_t i)
+{
+	if(!(mFlags[i] & InstanceTransformDirty)) {
+		mFlags[i] |= InstanceTransformDirty;
+		mDirtySlots.push_back(mDenseToSlot[i]);
+	}
+}
+
+void InstanceStore::setTransform(InstanceHandle h, const Common::Vector3& pos,
+		const Common::Matrix44& rotation, const Common::Vector3& scale)
+{
+	auto i = getDenseIndex(h);
+	mTransforms.set(i, pos, rotation, scale);
+	mFlags[i] &= ~InstanceWorldOverride;
+	markDirty(i);
+}
+
+void InstanceStore::setTransforms(const InstanceHandle* handles, const InstanceTransform* transforms,
+		size_t count)
+{
+	for(size_t j = 0; j < count; j++) {
+		auto i = getDenseIndex(handles[j]);
+		mTransforms.set(i, transforms[j]);
+		mFlags[i] &= ~InstanceWorldOverride;
+		markDirty(i);
+	}
+}
+
+void InstanceStore::setWorldMatrix(InstanceHandle h, const float* world)
+{
+	auto i = getDenseIndex(h);
+	std::copy(world, world + 16, &mWorld[i * 16]);
+	TransformKernels::invertAffine(world, &mInverseWorld[i * 16]);
+	mFlags[i] |= InstanceWorldOverride;
+	markDirty(i);
+}
+
+void InstanceStore::setName(InstanceHandle h, const std::string* name)
+{
+	mNames[getDenseIndex(h)] = name;
+}
+
+void InstanceStore::computeWorldMatrices(size_t begin, size_t end)
+{
+	for(size_t i = begin; i < end; i++)
+		mFlags[i] &= ~InstanceTransformDirty;
+
+	// runs of instances between the ones with an overridden world matrix
+	while(begin < end) {
+		size_t runEnd = begin;
+		while(runEnd < end && !(mFlags[runEnd] & InstanceWorldOverride))
+			runEnd++;
+		if(runEnd > begin) {
+			TransformKernels::computeWorldMatrices(mTransforms, begin, runEnd, &mWorld[begin * 16]);
+			TransformKernels::computeInverseWorldMatrices(mTransforms, begin, runEnd, &mInverseWorld[begin * 16]);
+		}
+		begin = runEnd + 1;
+	}
+}
+
+void InstanceStore::updateWorldMatrices(JobSystem* jobs)
+{
+	size_t n = size();
+	if(n == 0) {
+		mDirtySlots.clear();
+		return;
+	}
+
+	// with many changed instances one linear pass over everything beats
+	// hopping between the changed ones
+	bool all = mDirtySlots.size() * 4 > n;
+	if(all) {
+		if(jobs) {
+			jobs->parallelFor(0, n, 1024, [&] (size_t b, size_t e) {
+					computeWorldMatrices(b, e); });
+		} else {
+			computeWorldMatrices(0, n);
+		}
+	} else {
+		for(auto slot : mDirtySlots) {
+			auto i = mSlotToDense[slot];
+			if(i == InvalidIndex || !(mFlags[i] & InstanceTransformDirty))
+				continue;
+
+			if(!(mFlags[i] & InstanceWorldOverride)) {
+				TransformKernels::computeWorldMatrices(mTransforms, i, i + 1, &mWorld[i * 16]);
+				TransformKernels::computeInverseWorldMatrices(mTransforms, i, i + 1, &mInverseWorld[i * 16]);
+			}
+			mFlags[i] &= ~InstanceTransformDirty;
+		}
+	}
+	mDirtySlots.clear();
+}
+
+}
+
@@ -0,0 +1,140 @@
+#ifndef SCENE_INSTANCESTORE_H
+#define SCENE_INSTANCESTORE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "common/Vector3.h"
+#include "common/Matrix44.h"
+
+#include "TransformKernels.h"
+
+namespace Scene {
+
+class Drawable;
+class JobSystem;
+
+// Refers to an instance in an InstanceStore. Stays valid until the
+// instance is removed; a stale handle never aliases a newer instance.
+struct InstanceHandle {
+	uint32_t slot = 0;
+	// zero is never a valid generation
+	uint32_t generation = 0;
+
+	bool operator==(const InstanceHandle& h) const { return slot == h.slot && generation == h.generation; }
+	bool operator!=(const InstanceHandle& h) const { return !(*this == h); }
+};
+
+// Transforms of instances by slot, for handing transforms written on
+// one thread to another as a whole.
+struct InstanceTransformTable {
+	std::vector<InstanceTransform> transforms;
+	// generation of the instance in the slot, 0 if there is none
+	std::vector<uint32_t> generations;
+	// incremented on every change of the transform in the slot
+	std::vector<uint32_t> versions;
+
+	void set(InstanceHandle h, const InstanceTransform& t);
+	void remove(InstanceHandle h);
+	void clear();
+};
+
+enum InstanceFlag : uint32_t {
+	InstanceBackfaceCulling = 1 << 0,
+	InstanceBlending        = 1 << 1,
+	// the texture has an alpha channel, so fragments below 0.5 alpha
+	// are discarded
+	InstanceAlphaTest       = 1 << 2,
+	// world matrix was set with setWorldMatrix() instead of being
+	// calculated from the transform
+	InstanceWorldOverride   = 1u << 30,
+	// world matrix needs to be recalculated
+	InstanceTransformDirty  = 1u << 31
+};
+
+// Packed storage of the mesh instances. Per instance data is kept in
+// dense, parallel arrays so that rendering walks memory linearly; the
+// handles map to dense indices through a slot table so that adding and
+// removing (by swapping with the last instance) are O(1).
+class InstanceStore {
+	public:
+		InstanceHandle add(const Drawable* drawable, GLuint texture, uint32_t flags,
+				const Common::Vector3& pos, const Common::Matrix44& rotation,
+				const Common::Vector3& scale);
+		void remove(InstanceHandle h);
+		// batch versions: the arrays are grown once per batch and the
+		// handles are written to handles[0..count)
+		void add(const Drawable* drawable, GLuint texture, uint32_t flags,
+				const InstanceTransform* transforms, size_t count,
+				InstanceHandle* handles);
+		void remove(const InstanceHandle* handles, size_t count);
+		bool isValid(InstanceHandle h) const;
+		size_t size() const;
+
+		void setTransform(InstanceHandle h, const Common::Vector3& pos,
+				const Common::Matrix44& rotation, const Common::Vector3& scale);
+		void setTransforms(const InstanceHandle* handles, const InstanceTransform* transforms,
+				size_t count);
+		// sets the world matrix directly, e.g. from a TransformHierarchy.
+		// Stays in effect until the next setTransform().
+		void setWorldMatrix(InstanceHandle h, const float* world);
+		// name used for diagnostics; the string must outlive the instance
+		void setName(InstanceHandle h, const std::string* name);
+
+		// recalculates the world matrices of changed instances. A pass
+		// over all instances is split over the jobs if given.
+		void updateWorldMatrices(JobSystem* jobs = nullptr);
+
+		// dense access, 0 <= i < size(). Indices are invalidated by
+		// add() and remove().
+		size_t getDenseIndex(InstanceHandle h) const;
+		InstanceHandle getHandle(size_t i) const;
+		// all handle slots are below this
+		size_t getSlotCount() const { return mSlotToDense.size(); }
+		const TransformSoA& getTransforms() const { return mTransforms; }
+		const Drawable* getDrawable(size_t i) const { return mDrawables[i]; }
+		GLuint getTexture(size_t i) const { return mTextures[i]; }
+		uint32_t getFlags(size_t i) const { return mFlags[i]; }
+		const float* getWorldMatrix(size_t i) const { return &mWorld[i * 16]; }
+		const float* getInverseWorldMatrix(size_t i) const { return &mInverseWorld[i * 16]; }
+		const std::string* getName(size_t i) const { return mNames[i]; }
+		const std::string* getName(InstanceHandle h) const { return mNames[getDenseIndex(h)]; }
+
+	private:
+		static const uint32_t InvalidIndex = 0xffffffff;
+
+		uint32_t allocateSlot(uint32_t dense);
+		void resizeDense(size_t n);
+		// moves the instance at dense index src to dst
+		void moveDense(uint32_t dst, uint32_t src);
+		void freeSlot(uint32_t slot);
+		void markDirty(size_t i);
+		void computeWorldMatrices(size_t begin, size_t end);
+
+		// dense arrays
+		TransformSoA mTransforms;
+		std::vector<const Drawable*> mDrawables;
+		std::vector<GLuint> mTextures;
+		std::vector<uint32_t> mFlags;
+		std::vector<float> mWorld;
+		std::vector<float> mInverseWorld;
+		std::vector<const std::string*> mNames;
+		std::vector<uint32_t> mDenseToSlot;
+
+		// slot table
+		std::vector<uint32_t> mSlotToDense;
+		std::vector<uint32_t> mSlotGeneration;
+		std::vector<uint32_t> mFreeSlots;
+
+		// slots of the instances with InstanceTransformDirty set
+		std::vector<uint32_t> mDirtySlots;
+};
+
+}
+
+#endif
+
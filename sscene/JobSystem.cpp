@@ -0,0 +1,363 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace Scene {
+
+struct Job {
+	std::function<void()> function;
+	bool mainThread = false;
+
+	// dependencies not yet finished, plus one while being set up
+	std::atomic<unsigned int> pendingDependencies;
+	std::atomic<bool> finished;
+	std::exception_ptr exception;
+
+	// jobs waiting for this one
+	std::mutex mutex;
+	std::vector<std::shared_ptr<Job>> continuations;
+
+	Job() : pendingDependencies(1), finished(false) { }
+};
+
+const unsigned int JobSystem::DefaultWorkers;
+
+// index of the worker running on this thread in the given system
+static thread_local const JobSystem* tlsJobSystem = nullptr;
+static thread_local unsigned int tlsWorkerIndex = 0;
+
+bool JobHandle::isFinished() const
+{
+	return !mJob || mJob->finished;
+}
+
+JobSystem::JobSystem(unsigned int numWorkers)
+	: mMainThread(std::this_thread::get_id()),
+	mQueuedJobs(0),
+	mWaiters(0),
+	mQuit(false)
+{
+	if(numWorkers == DefaultWorkers) {
+		unsigned int cores = getAvailableCores();
+		numWorkers = cores > 1 ? cores - 1 : 0;
+	}
+
+	for(unsigned int i = 0; i < numWorkers; i++)
+		mQueues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+	for(unsigned int i = 0; i < numWorkers; i++)
+		mThreads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mQuit = true;
+	}
+	mWakeUp.notify_all();
+	for(auto& t : mThreads)
+		t.join();
+}
+
+unsigned int JobSystem::getAvailableCores()
+{
+#ifdef __linux__
+	// respects taskset and cgroup cpusets unlike hardware_concurrency()
+	cpu_set_t set;
+	if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+		int n = CPU_COUNT(&set);
+		if(n > 0)
+			return n;
+	}
+#endif
+	unsigned int n = std::thread::hardware_concurrency();
+	return n ? n : 1;
+}
+
+unsigned int JobSystem::getNumWorkers() const
+{
+	return mThreads.size();
+}
+
+bool JobSystem::isMainThread() const
+{
+	return std::this_thread::get_id() == mMainThread;
+}
+
+JobHandle JobSystem::schedule(const std::function<void()>& fn,
+		const std::vector<JobHandle>& dependencies)
+{
+	return makeJob(fn, dependencies, false);
+}
+
+JobHandle JobSystem::scheduleOnMainThread(const std::function<void()>& fn,
+		const std::vector<JobHandle>& dependencies)
+{
+	return makeJob(fn, dependencies, true);
+}
+
+JobHandle JobSystem::makeJob(const std::function<void()>& fn,
+		const std::vector<JobHandle>& dependencies, bool mainThread)
+{
+	auto job = std::make_shared<Job>();
+	job->function = fn;
+	job->mainThread = mainThread;
+
+	for(const auto& dep : dependencies) {
+		if(!dep.mJob)
+			continue;
+		std::lock_guard<std::mutex> lock(dep.mJob->mutex);
+		if(!dep.mJob->finished) {
+			job->pendingDependencies++;
+			dep.mJob->continuations.push_back(job);
+		}
+	}
+
+	JobHandle h;
+	h.mJob = job;
+	if(--job->pendingDependencies == 0)
+		enqueue(job);
+	return h;
+}
+
+void JobSystem::enqueue(std::shared_ptr<Job> job)
+{
+	if(job->mainThread) {
+		{
+			std::lock_guard<std::mutex> lock(mMainThreadQueue.mutex);
+			mMainThreadQueue.jobs.push_back(job);
+		}
+		notifyWaiters();
+		return;
+	}
+
+	// workers push to their own queue, everybody else to the shared one
+	WorkerQueue& q = tlsJobSystem == this ? *mQueues[tlsWorkerIndex] : mSharedQueue;
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.jobs.push_back(job);
+	}
+	mQueuedJobs++;
+	{
+		// pairs with the check in workerLoop() so the wakeup is not lost
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWakeUp.notify_one();
+	notifyWaiters();
+}
+
+void JobSystem::notifyWaiters()
+{
+	// the waiters count themselves before checking, so one that misses
+	// this has not checked yet
+	if(mWaiters == 0)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mProgress.notify_all();
+}
+
+void JobSystem::execute(const std::shared_ptr<Job>& job)
+{
+	try {
+		job->function();
+	} catch(...) {
+		job->exception = std::current_exception();
+	}
+	job->function = nullptr;
+
+	std::vector<std::shared_ptr<Job>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->finished = true;
+		continuations.swap(job->continuations);
+	}
+	for(auto& c : continuations) {
+		if(--c->pendingDependencies == 0)
+			enqueue(c);
+	}
+	notifyWaiters();
+}
+
+std::shared_ptr<Job> JobSystem::popJob()
+{
+	std::shared_ptr<Job> job;
+	size_t n = mQueues.size();
+	bool isWorker = tlsJobSystem == this;
+
+	// own queue from the back
+	if(isWorker) {
+		auto& q = *mQueues[tlsWorkerIndex];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if(!q.jobs.empty()) {
+			job = q.jobs.back();
+			q.jobs.pop_back();
+		}
+	}
+
+	if(!job) {
+		std::lock_guard<std::mutex> lock(mSharedQueue.mutex);
+		if(!mSharedQueue.jobs.empty()) {
+			job = mSharedQueue.jobs.front();
+			mSharedQueue.jobs.pop_front();
+		}
+	}
+
+	// steal the oldest job of another worker
+	unsigned int start = isWorker ? tlsWorkerIndex + 1 : 0;
+	for(size_t i = 0; !job && i < n; i++) {
+		auto& q = *mQueues[(start + i) % n];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if(!q.jobs.empty()) {
+			job = q.jobs.front();
+			q.jobs.pop_front();
+		}
+	}
+
+	if(job)
+		mQueuedJobs--;
+	return job;
+}
+
+bool JobSystem::hasMainThreadJobs()
+{
+	std::lock_guard<std::mutex> lock(mMainThreadQueue.mutex);
+	return !mMainThreadQueue.jobs.empty();
+}
+
+bool JobSystem::tryRunJob(bool mainThreadJobs)
+{
+	auto job = popJob();
+	if(job) {
+		execute(job);
+		return true;
+	}
+	if(mainThreadJobs) {
+		std::shared_ptr<Job> mj;
+		{
+			std::lock_guard<std::mutex> lock(mMainThreadQueue.mutex);
+			if(!mMainThreadQueue.jobs.empty()) {
+				mj = mMainThreadQueue.jobs.front();
+				mMainThreadQueue.jobs.pop_front();
+			}
+		}
+		if(mj) {
+			execute(mj);
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::workerLoop(unsigned int index)
+{
+	tlsJobSystem = this;
+	tlsWorkerIndex = index;
+	while(1) {
+		if(tryRunJob(false))
+			continue;
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWakeUp.wait(lock, [&] { return mQuit || mQueuedJobs > 0; });
+		if(mQuit)
+			return;
+	}
+}
+
+void JobSystem::wait(const JobHandle& job)
+{
+	if(!job.mJob)
+		return;
+
+	// the main thread jobs may change what the workers read, so they
+	// only run here when one of them is waited for
+	waitFor(*job.mJob, job.mJob->mainThread && isMainThread());
+
+	if(job.mJob->exception)
+		std::rethrow_exception(job.mJob->exception);
+}
+
+void JobSystem::waitFor(const Job& job, bool mainThreadJobs)
+{
+	while(!job.finished) {
+		if(tryRunJob(mainThreadJobs))
+			continue;
+
+		mWaiters++;
+		{
+			std::unique_lock<std::mutex> lock(mSleepMutex);
+			mProgress.wait(lock, [&] {
+					return job.finished || mQueuedJobs > 0 ||
+						(mainThreadJobs && hasMainThreadJobs());
+					});
+		}
+		mWaiters--;
+	}
+}
+
+void JobSystem::runMainThreadJobs()
+{
+	std::deque<std::shared_ptr<Job>> jobs;
+	{
+		std::lock_guard<std::mutex> lock(mMainThreadQueue.mutex);
+		jobs.swap(mMainThreadQueue.jobs);
+	}
+	// jobs made ready by these run next time
+	for(auto& j : jobs)
+		execute(j);
+}
+
+void JobSystem::parallelFor(size_t begin, size_t end, size_t grain,
+		const std::function<void(size_t, size_t)>& fn)
+{
+	if(begin >= end)
+		return;
+	grain = std::max<size_t>(grain, 1);
+	size_t numChunks = (end - begin + grain - 1) / grain;
+
+	if(numChunks == 1 || mThreads.empty()) {
+		for(size_t b = begin; b < end; b += grain)
+			fn(b, std::min(end, b + grain));
+		return;
+	}
+
+	// the jobs take chunks until none are left, so a job that only
+	// starts late finishes immediately
+	std::atomic<size_t> nextChunk(0);
+	std::mutex exceptionMutex;
+	std::exception_ptr exception;
+	auto body = [&] {
+		size_t c;
+		while((c = nextChunk++) < numChunks) {
+			size_t b = begin + c * grain;
+			try {
+				fn(b, std::min(end, b + grain));
+			} catch(...) {
+				std::lock_guard<std::mutex> lock(exceptionMutex);
+				if(!exception)
+					exception = std::current_exception();
+			}
+		}
+	};
+
+	size_t numJobs = std::min<size_t>(numChunks - 1, mThreads.size());
+	std::vector<JobHandle> jobs;
+	jobs.reserve(numJobs);
+	for(size_t i = 0; i < numJobs; i++)
+		jobs.push_back(schedule(body));
+
+	body();
+	for(auto& j : jobs)
+		wait(j);
+
+	if(exception)
+		std::rethrow_exception(exception);
+}
+
+}
+
@@ -0,0 +1,115 @@
+#ifndef SCENE_JOBSYSTEM_H
+#define SCENE_JOBSYSTEM_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+
+namespace Scene {
+
+struct Job;
+
+// Refers to a scheduled job. A default constructed handle counts as
+// finished.
+class JobHandle {
+	public:
+		bool isFinished() const;
+
+	private:
+		friend class JobSystem;
+		std::shared_ptr<Job> mJob;
+};
+
+// Work-stealing job scheduler. Every worker thread has its own queue
+// that it takes work from in LIFO order while idle workers steal from
+// the other end. Jobs can depend on other jobs and can be queued to run
+// on the main thread, i.e. the thread owning the GL context, which runs
+// them in runMainThreadJobs().
+//
+// Jobs must not block on anything but wait() and parallelFor(), which
+// run other jobs while waiting. Main thread jobs only run there when the
+// main thread waits for a main thread job, never e.g. in the waits of a
+// parallelFor() over the scene.
+class JobSystem {
+	public:
+		static const unsigned int DefaultWorkers = 0xffffffff;
+
+		// DefaultWorkers uses one worker less than there are cores
+		// available to the process. The constructing thread is taken to
+		// be the main thread.
+		JobSystem(unsigned int numWorkers = DefaultWorkers);
+		~JobSystem();
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+
+		// runs fn on a worker once all the dependencies have finished
+		JobHandle schedule(const std::function<void()>& fn,
+				const std::vector<JobHandle>& dependencies = std::vector<JobHandle>());
+		// as above but fn runs in runMainThreadJobs()
+		JobHandle scheduleOnMainThread(const std::function<void()>& fn,
+				const std::vector<JobHandle>& dependencies = std::vector<JobHandle>());
+		// waits for the job, running other jobs meanwhile, and sleeps if
+		// there are none. Rethrows an exception thrown by the job.
+		void wait(const JobHandle& job);
+
+		// calls fn(b, e) for subranges [b, e) of [begin, end) of at most
+		// grain elements, spread over the workers and the calling thread.
+		// Returns when all are done; the first exception is rethrown.
+		void parallelFor(size_t begin, size_t end, size_t grain,
+				const std::function<void(size_t, size_t)>& fn);
+
+		// runs the main thread jobs that are ready. Must be called from
+		// the main thread.
+		void runMainThreadJobs();
+
+		unsigned int getNumWorkers() const;
+		// number of cores this process may run on
+		static unsigned int getAvailableCores();
+
+	private:
+		struct WorkerQueue {
+			std::mutex mutex;
+			std::deque<std::shared_ptr<Job>> jobs;
+		};
+
+		JobHandle makeJob(const std::function<void()>& fn,
+				const std::vector<JobHandle>& dependencies, bool mainThread);
+		void enqueue(std::shared_ptr<Job> job);
+		void execute(const std::shared_ptr<Job>& job);
+		// runs a queued job, or a main thread job if mainThreadJobs
+		bool tryRunJob(bool mainThreadJobs);
+		std::shared_ptr<Job> popJob();
+		bool hasMainThreadJobs();
+		void waitFor(const Job& job, bool mainThreadJobs);
+		void notifyWaiters();
+		bool isMainThread() const;
+		void workerLoop(unsigned int index);
+
+		std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+		std::vector<std::thread> mThreads;
+		std::thread::id mMainThread;
+
+		// jobs queued from threads other than the workers
+		WorkerQueue mSharedQueue;
+		WorkerQueue mMainThreadQueue;
+
+		// incremented after pushing, so it may briefly go negative
+		std::atomic<int> mQueuedJobs;
+		std::mutex mSleepMutex;
+		std::condition_variable mWakeUp;
+		// wakes the threads in wait() when a job is queued or finishes
+		std::condition_variable mProgress;
+		std::atomic<unsigned int> mWaiters;
+		std::atomic<bool> mQuit;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,352 @@
+#include "MeshBuffer.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "Model.h"
+
+namespace Scene {
+
+const unsigned int MeshBuffer::POSITION_INDEX;
+const unsigned int MeshBuffer::TEXCOORD_INDEX;
+const unsigned int MeshBuffer::NORMAL_INDEX;
+const unsigned int MeshBuffer::COLOR_INDEX;
+
+RangeAllocator::RangeAllocator(size_t capacity)
+{
+	reset(capacity, 0);
+}
+
+bool RangeAllocator::allocate(size_t size, size_t& offset)
+{
+	if(size == 0) {
+		offset = 0;
+		return true;
+	}
+
+	auto best = mFreeRanges.end();
+	for(auto it = mFreeRanges.begin(); it != mFreeRanges.end(); ++it) {
+		if(it->second >= size && (best == mFreeRanges.end() || it->second < best->second))
+			best = it;
+	}
+	if(best == mFreeRanges.end())
+		return false;
+
+	offset = best->first;
+	size_t remaining = best->second - size;
+	mFreeRanges.erase(best);
+	if(remaining)
+		mFreeRanges[offset + size] = remaining;
+	mFree -= size;
+	return true;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+	if(size == 0)
+		return;
+
+	mFree += size;
+	auto next = mFreeRanges.lower_bound(offset);
+	if(next != mFreeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		next = mFreeRanges.erase(next);
+	}
+	if(next != mFreeRanges.begin()) {
+		auto prev = std::prev(next);
+		if(prev->first + prev->second == offset) {
+			prev->second += size;
+			return;
+		}
+	}
+	mFreeRanges[offset] = size;
+}
+
+void RangeAllocator::reset(size_t capacity, size_t used)
+{
+	mFreeRanges.clear();
+	mCapacity = capacity;
+	mFree = capacity - used;
+	if(mFree)
+		mFreeRanges[used] = mFree;
+}
+
+size_t RangeAllocator::getCapacity() const
+{
+	return mCapacity;
+}
+
+size_t RangeAllocator::getFree() const
+{
+	return mFree;
+}
+
+MeshBuffer::~MeshBuffer()
+{
+	for(auto& a : mArenas) {
+		if(a.vertexBuffer) {
+			GLuint buffers[2] = { a.vertexBuffer, a.indexBuffer };
+			glDeleteBuffers(2, buffers);
+		}
+	}
+}
+
+void MeshBuffer::init()
+{
+	mBaseVertex = GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+	mCopyBuffer = GLEW_VERSION_3_1 || GLEW_ARB_copy_buffer;
+	mArenas[0].stride = (3 + 2 + 3) * sizeof(GLfloat);
+	mArenas[1].stride = (3 + 2 + 3 + 4) * sizeof(GLfloat);
+}
+
+uint32_t MeshBuffer::add(const Model& model)
+{
+	const auto& positions = model.getVertexCoords();
+	const auto& texCoords = model.getTexCoords();
+	const auto& normals = model.getNormals();
+	const auto& colors = model.getColors();
+	const auto& indices = model.getIndices();
+
+	Mesh m;
+	m.arena = colors.empty() ? 0 : 1;
+	m.numVertices = positions.size() / 3;
+	m.numIndices = indices.size();
+	Arena& a = mArenas[m.arena];
+
+	// position, texture coordinates, normal and color of each vertex
+	const size_t floats = a.stride / sizeof(GLfloat);
+	std::vector<GLfloat> vertices(m.numVertices * floats, 0.0f);
+	auto copy = [&] (const std::vector<GLfloat>& from, size_t size, size_t offset) {
+		for(size_t i = 0; i < m.numVertices && (i + 1) * size <= from.size(); i++)
+			std::copy(&from[i * size], &from[i * size] + size, &vertices[i * floats + offset]);
+	};
+	copy(positions, 3, 0);
+	copy(texCoords, 2, 3);
+	copy(normals, 3, 5);
+	if(!colors.empty())
+		copy(colors, 4, 8);
+
+	bool fits = a.vertices.allocate(m.numVertices, m.firstVertex);
+	if(fits && !a.indices.allocate(m.numIndices, m.firstIndex)) {
+		a.vertices.free(m.firstVertex, m.numVertices);
+		fits = false;
+	}
+	if(!fits) {
+		repack(m.arena, m.numVertices, m.numIndices);
+		a.vertices.allocate(m.numVertices, m.firstVertex);
+		a.indices.allocate(m.numIndices, m.firstIndex);
+	}
+
+	if(!vertices.empty()) {
+		glBindBuffer(GL_ARRAY_BUFFER, a.vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, m.firstVertex * a.stride, vertices.size() * sizeof(GLfloat), &vertices[0]);
+	}
+	if(!indices.empty()) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, a.indexBuffer);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, m.firstIndex * sizeof(GLushort),
+				indices.size() * sizeof(GLushort), &indices[0]);
+	}
+
+	uint32_t id;
+	if(!mFreeIds.empty()) {
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+		mMeshes[id] = m;
+		mUsed[id] = true;
+	} else {
+		id = mMeshes.size();
+		mMeshes.push_back(m);
+		mUsed.push_back(true);
+	}
+	return id;
+}
+
+void MeshBuffer::remove(uint32_t mesh)
+{
+	const Mesh& m = mMeshes[mesh];
+	Arena& a = mArenas[m.arena];
+	a.vertices.free(m.firstVertex, m.numVertices);
+	a.indices.free(m.firstIndex, m.numIndices);
+	mUsed[mesh] = false;
+	mFreeIds.push_back(mesh);
+}
+
+const Mesh& MeshBuffer::getMesh(uint32_t mesh) const
+{
+	return mMeshes[mesh];
+}
+
+static void copyRange(bool copyBuffer, GLuint from, GLuint to, size_t src, size_t dst, size_t bytes)
+{
+	if(bytes == 0)
+		return;
+
+	if(copyBuffer) {
+		glBindBuffer(GL_COPY_READ_BUFFER, from);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, to);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src, dst, bytes);
+		return;
+	}
+
+	// through memory before GL 3.1
+	std::vector<char> data(bytes);
+	glBindBuffer(GL_ARRAY_BUFFER, from);
+	glGetBufferSubData(GL_ARRAY_BUFFER, src, bytes, &data[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, to);
+	glBufferSubData(GL_ARRAY_BUFFER, dst, bytes, &data[0]);
+}
+
+void MeshBuffer::repack(unsigned int arena, size_t vertices, size_t indices)
+{
+	Arena& a = mArenas[arena];
+	size_t usedVertices = a.vertices.getCapacity() - a.vertices.getFree();
+	size_t usedIndices = a.indices.getCapacity() - a.indices.getFree();
+
+	// the same size if the free space is enough once in one piece,
+	// otherwise half as large again at least
+	auto capacity = [] (const RangeAllocator& r, size_t used, size_t extra, size_t minimum) {
+		size_t c = r.getCapacity();
+		if(used + extra > c)
+			c = std::max(c + c / 2, used + extra);
+		return std::max(c, minimum);
+	};
+	size_t vertexCapacity = capacity(a.vertices, usedVertices, vertices, 1 << 16);
+	size_t indexCapacity = capacity(a.indices, usedIndices, indices, 3 << 16);
+
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, vertexCapacity * a.stride, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * sizeof(GLushort), nullptr, GL_STATIC_DRAW);
+
+	// the meshes back to back, keeping their order
+	std::vector<uint32_t> ids;
+	for(uint32_t i = 0; i < mMeshes.size(); i++) {
+		if(mUsed[i] && mMeshes[i].arena == arena)
+			ids.push_back(i);
+	}
+	std::sort(ids.begin(), ids.end(), [&] (uint32_t x, uint32_t y) {
+			return mMeshes[x].firstVertex < mMeshes[y].firstVertex;
+			});
+
+	size_t vertex = 0;
+	size_t index = 0;
+	for(uint32_t id : ids) {
+		Mesh& m = mMeshes[id];
+		copyRange(mCopyBuffer, a.vertexBuffer, buffers[0], m.firstVertex * a.stride,
+				vertex * a.stride, m.numVertices * a.stride);
+		copyRange(mCopyBuffer, a.indexBuffer, buffers[1], m.firstIndex * sizeof(GLushort),
+				index * sizeof(GLushort), m.numIndices * sizeof(GLushort));
+		m.firstVertex = vertex;
+		m.firstIndex = index;
+		vertex += m.numVertices;
+		index += m.numIndices;
+	}
+
+	if(a.vertexBuffer) {
+		GLuint old[2] = { a.vertexBuffer, a.indexBuffer };
+		glDeleteBuffers(2, old);
+		mRepacks++;
+	}
+	a.vertexBuffer = buffers[0];
+	a.indexBuffer = buffers[1];
+	a.vertices.reset(vertexCapacity, vertex);
+	a.indices.reset(indexCapacity, index);
+}
+
+bool MeshBuffer::bind(uint32_t mesh, uint32_t attributes, MeshBinding& bound) const
+{
+	if(isBound(mesh, attributes, bound))
+		return false;
+
+	const Mesh& m = mMeshes[mesh];
+	const Arena& a = mArenas[m.arena];
+	const size_t first = mBaseVertex ? 0 : m.firstVertex;
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, a.indexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, a.vertexBuffer);
+	const uintptr_t base = first * a.stride;
+	auto pointer = [&] (unsigned int index, GLint size, size_t offset) {
+		glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, a.stride,
+				reinterpret_cast<const GLvoid*>(base + offset * sizeof(GLfloat)));
+	};
+	if(attributes & MeshPosition)
+		pointer(POSITION_INDEX, 3, 0);
+	if(attributes & MeshTexCoord)
+		pointer(TEXCOORD_INDEX, 2, 3);
+	if(attributes & MeshNormal)
+		pointer(NORMAL_INDEX, 3, 5);
+	if((attributes & MeshColor) && m.arena == 1)
+		pointer(COLOR_INDEX, 4, 8);
+
+	bound.arena = m.arena;
+	bound.firstVertex = first;
+	bound.attributes = attributes;
+	return true;
+}
+
+bool MeshBuffer::isBound(uint32_t mesh, uint32_t attributes, const MeshBinding& bound) const
+{
+	const Mesh& m = mMeshes[mesh];
+	// with base vertex draws the meshes of an arena share the offsets
+	size_t first = mBaseVertex ? 0 : m.firstVertex;
+	return bound.arena == int(m.arena) && bound.firstVertex == first && bound.attributes == attributes;
+}
+
+void MeshBuffer::draw(uint32_t mesh) const
+{
+	const Mesh& m = mMeshes[mesh];
+	if(m.numIndices == 0) {
+		glDrawArrays(GL_TRIANGLES, mBaseVertex ? m.firstVertex : 0, m.numVertices);
+		return;
+	}
+
+	const GLvoid* indices = reinterpret_cast<const GLvoid*>(m.firstIndex * sizeof(GLushort));
+	if(mBaseVertex)
+		glDrawElementsBaseVertex(GL_TRIANGLES, m.numIndices, GL_UNSIGNED_SHORT, indices, m.firstVertex);
+	else
+		glDrawElements(GL_TRIANGLES, m.numIndices, GL_UNSIGNED_SHORT, indices);
+}
+
+void MeshBuffer::drawInstanced(uint32_t mesh, unsigned int count) const
+{
+	const Mesh& m = mMeshes[mesh];
+	if(m.numIndices == 0) {
+		glDrawArraysInstanced(GL_TRIANGLES, mBaseVertex ? m.firstVertex : 0, m.numVertices, count);
+		return;
+	}
+
+	const GLvoid* indices = reinterpret_cast<const GLvoid*>(m.firstIndex * sizeof(GLushort));
+	if(mBaseVertex)
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, m.numIndices, GL_UNSIGNED_SHORT, indices,
+				count, m.firstVertex);
+	else
+		glDrawElementsInstanced(GL_TRIANGLES, m.numIndices, GL_UNSIGNED_SHORT, indices, count);
+}
+
+size_t MeshBuffer::getMemorySize() const
+{
+	size_t bytes = 0;
+	for(const auto& a : mArenas)
+		bytes += a.vertices.getCapacity() * a.stride + a.indices.getCapacity() * sizeof(GLushort);
+	return bytes;
+}
+
+unsigned int MeshBuffer::getNumBuffers() const
+{
+	unsigned int n = 0;
+	for(const auto& a : mArenas) {
+		if(a.vertexBuffer)
+			n += 2;
+	}
+	return n;
+}
+
+unsigned int MeshBuffer::getRepacks() const
+{
+	return mRepacks;
+}
+
+}
+
@@ -0,0 +1,136 @@
+#ifndef SCENE_MESHBUFFER_H
+#define SCENE_MESHBUFFER_H
+
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+namespace Scene {
+
+class Model;
+
+// Hands out ranges of a buffer. The free ranges are kept by offset so
+// that a freed range merges with its free neighbours; allocations take
+// the smallest free range that fits.
+class RangeAllocator {
+	public:
+		RangeAllocator(size_t capacity = 0);
+		// returns false if no free range is large enough, even if the
+		// free ranges together are
+		bool allocate(size_t size, size_t& offset);
+		void free(size_t offset, size_t size);
+		// everything but [0, used) free
+		void reset(size_t capacity, size_t used);
+		size_t getCapacity() const;
+		size_t getFree() const;
+
+	private:
+		std::map<size_t, size_t> mFreeRanges;
+		size_t mCapacity;
+		size_t mFree;
+};
+
+enum MeshAttribute : uint32_t {
+	MeshPosition = 1 << 0,
+	MeshTexCoord = 1 << 1,
+	MeshNormal   = 1 << 2,
+	// ignored for meshes without vertex colors
+	MeshColor    = 1 << 3
+};
+
+// Where a mesh is in its MeshBuffer. Changes when the buffer is
+// defragmented.
+struct Mesh {
+	unsigned int arena = 0;
+	size_t firstVertex = 0;
+	size_t numVertices = 0;
+	size_t firstIndex = 0;
+	size_t numIndices = 0;
+};
+
+// the buffers and attributes last bound by MeshBuffer::bind()
+struct MeshBinding {
+	int arena = -1;
+	size_t firstVertex = 0;
+	uint32_t attributes = 0;
+};
+
+// The static vertex and index data of all meshes, packed into a large
+// vertex and index buffer per vertex format (with or without vertex
+// colors) instead of buffers per mesh. The vertices are interleaved.
+//
+// With base vertex draws (GL 3.2) the attributes stay pointed at the
+// start of the buffer and drawing another mesh of the same format
+// needs no binds at all; without, only the attribute offsets change.
+//
+// When an arena has no free range large enough for a mesh, the live
+// meshes are copied to new buffers back to back, which are larger if
+// the free space wasn't enough in total either.
+class MeshBuffer {
+	public:
+		// attribute locations
+		static const unsigned int POSITION_INDEX = 0;
+		static const unsigned int TEXCOORD_INDEX = 1;
+		static const unsigned int NORMAL_INDEX = 2;
+		static const unsigned int COLOR_INDEX = 3;
+
+		MeshBuffer() = default;
+		~MeshBuffer();
+		MeshBuffer(const MeshBuffer&) = delete;
+		MeshBuffer& operator=(const MeshBuffer&) = delete;
+
+		// must be called with a current GL context
+		void init();
+
+		// uploads the model and returns its id
+		uint32_t add(const Model& model);
+		void remove(uint32_t mesh);
+		const Mesh& getMesh(uint32_t mesh) const;
+
+		// binds the buffers of the mesh's arena and points the attributes
+		// at them, unless bound already says they are. Returns whether
+		// anything was bound.
+		bool bind(uint32_t mesh, uint32_t attributes, MeshBinding& bound) const;
+		bool isBound(uint32_t mesh, uint32_t attributes, const MeshBinding& bound) const;
+		// draws the bound mesh, count instances if instanced
+		void draw(uint32_t mesh) const;
+		void drawInstanced(uint32_t mesh, unsigned int count) const;
+
+		// bytes of the buffers, including the free ranges
+		size_t getMemorySize() const;
+		unsigned int getNumBuffers() const;
+		// times an arena was repacked
+		unsigned int getRepacks() const;
+
+	private:
+		struct Arena {
+			GLuint vertexBuffer = 0;
+			GLuint indexBuffer = 0;
+			// bytes per vertex
+			unsigned int stride = 0;
+			RangeAllocator vertices;
+			RangeAllocator indices;
+		};
+
+		// copies the meshes of the arena to new buffers with room for at
+		// least the given number of vertices and indices more
+		void repack(unsigned int arena, size_t vertices, size_t indices);
+
+		bool mBaseVertex = false;
+		bool mCopyBuffer = false;
+		// without and with vertex colors
+		Arena mArenas[2];
+		std::vector<Mesh> mMeshes;
+		std::vector<bool> mUsed;
+		std::vector<uint32_t> mFreeIds;
+		unsigned int mRepacks = 0;
+};
+
+}
+
+#endif
+
@@ -4,6 +4,7 @@
 #include <iostream>
 
 #include "HelperFunctions.h"
+#include "TransformKernels.h"
 
 using namespace Common;
 using namespace Scene;
@@ -51,6 +52,14 @@ Model::Model(const std::string& filename)
 			mNormals.push_back(normal.y);
 			mNormals.push_back(normal.z);
 		}
+
+		if(mesh->HasVertexColors(0)) {
+			const aiColor4D& color = mesh->mColors[0][i];
+			mColors.push_back(color.r);
+			mColors.push_back(color.g);
+			mColors.push_back(color.b);
+			mColors.push_back(color.a);
+		}
 	}
 
 	for(unsigned int i = 0; i < mesh->mNumFaces; i++) {
@@ -70,40 +79,63 @@ Model::Model()
 {
 }
 
-Model::Model(const Heightmap& heightmap, float uscale, float vscale)
+Model::Model(const Heightmap& heightmap, float uscale, float vscale, JobSystem* jobs)
 {
 	unsigned int w = heightmap.getWidth() + 1;
 	float xzscale = heightmap.getXZScale();
 
-	for(int j = 0; j < w; j++) {
-		for(int i = 0; i < w; i++) {
-			float xp = xzscale * i;
-			float yp = xzscale * j;
-			addVertex(Vector3(xp, heightmap.getHeightAt(xp, yp), yp));
-			addTexCoord(uscale * i / (float)w, vscale * j / (float)w);
-			Vector3 p1(xp,
-					heightmap.getHeightAt(xp, yp),
-					yp);
-			Vector3 p2(xp + xzscale,
-					heightmap.getHeightAt(xp + xzscale, yp),
-					yp);
-			Vector3 p3(xp,
-					heightmap.getHeightAt(xp, yp + xzscale),
-					yp + xzscale);
-			Vector3 u(p2 - p1);
-			Vector3 v(p3 - p1);
-			addNormal(v.cross(u).normalized());
+	// the arrays are sized up front so that rows can be filled in parallel
+	mVertexCoords.resize(w * w * 3);
+	mTexCoords.resize(w * w * 2);
+	mNormals.resize(w * w * 3);
+	mIndices.resize((w - 1) * (w - 1) * 6);
+
+	auto rows = [&] (size_t jbegin, size_t jend) {
+		for(unsigned int j = jbegin; j < jend; j++) {
+			for(unsigned int i = 0; i < w; i++) {
+				unsigned int k = j * w + i;
+				float xp = xzscale * i;
+				float yp = xzscale * j;
+				Vector3 p1(xp,
+						heightmap.getHeightAt(xp, yp),
+						yp);
+				Vector3 p2(xp + xzscale,
+						heightmap.getHeightAt(xp + xzscale, yp),
+						yp);
+				Vector3 p3(xp,
+						heightmap.getHeightAt(xp, yp + xzscale),
+						yp + xzscale);
+				Vector3 u(p2 - p1);
+				Vector3 v(p3 - p1);
+				Vector3 n(v.cross(u).normalized());
+
+				mVertexCoords[k * 3 + 0] = p1.x;
+				mVertexCoords[k * 3 + 1] = p1.y;
+				mVertexCoords[k * 3 + 2] = p1.z;
+				mTexCoords[k * 2 + 0] = uscale * i / (float)w;
+				mTexCoords[k * 2 + 1] = vscale * j / (float)w;
+				mNormals[k * 3 + 0] = n.x;
+				mNormals[k * 3 + 1] = n.y;
+				mNormals[k * 3 + 2] = n.z;
+
+				if(i < w - 1 && j < w - 1) {
+					// same order as addQuadIndices()
+					GLushort* idx = &mIndices[(j * (w - 1) + i) * 6];
+					GLushort i1 = j * w + i;
+					GLushort i2 = j * w + i + 1;
+					GLushort i3 = (j + 1) * w + i + 1;
+					GLushort i4 = (j + 1) * w + i;
+					idx[0] = i3; idx[1] = i2; idx[2] = i1;
+					idx[3] = i4; idx[4] = i3; idx[5] = i1;
+				}
+			}
 		}
-	}
+	};
 
-	for(int j = 0; j < w - 1; j++) {
-		for(int i = 0; i < w - 1; i++) {
-			addQuadIndices(j * w + i,
-					j * w + i + 1,
-					(j + 1) * w + i + 1,
-					(j + 1) * w + i);
-		}
-	}
+	if(jobs && heightmap.isThreadSafe())
+		jobs->parallelFor(0, w, 16, rows);
+	else
+		rows(0, w);
 }
 
 Model::Model(const std::vector<Common::Vector3>& vertexcoords,
@@ -184,6 +216,11 @@ const std::vector<GLfloat>& Model::getNormals() const
 	return mNormals;
 }
 
+const std::vector<GLfloat>& Model::getColors() const
+{
+	return mColors;
+}
+
 Movable::Movable()
 	: mScale(1.0f, 1.0f, 1.0f)
 {
@@ -198,6 +235,7 @@ Movable::Movable(const Common::Vector3& pos)
 void Movable::setPosition(const Common::Vector3& p)
 {
 	mPosition = p;
+	setTransformDirty();
 }
 
 const Common::Vector3& Movable::getPosition() const
@@ -208,6 +246,7 @@ const Common::Vector3& Movable::getPosition() const
 void Movable::move(const Common::Vector3& v)
 {
 	mPosition += v;
+	setTransformDirty();
 }
 
 const Matrix44& Movable::getRotation() const
@@ -218,11 +257,13 @@ const Matrix44& Movable::getRotation() const
 void Movable::setRotationFromEuler(const Vector3& v)
 {
 	mRotation = HelperFunctions::rotationMatrixFromEuler(v);
+	setTransformDirty();
 }
 
 void Movable::setRotation(const Matrix44& m)
 {
 	mRotation = m;
+	setTransformDirty();
 }
 
 void Movable::setRotation(const Common::Quaternion& q)
@@ -235,6 +276,7 @@ void Movable::setRotation(const Common::Quaternion& q)
 void Movable::setRotation(const Common::Vector3& axis, float angle)
 {
 	mRotation = HelperFunctions::rotationMatrixFromAxisAngle(axis, angle);
+	setTransformDirty();
 }
 
 void Movable::setRotation(const Common::Vector3& forward, const Common::Vector3& up)
@@ -255,6 +297,7 @@ void Movable::setRotation(const Common::Vector3& forward, const Common::Vector3&
 	mRotation.m[9] = fw.y;
 	mRotation.m[10] = fw.z;
 
+	setTransformDirty();
 }
 
 void Movable::setScale(float x, float y, float z)
@@ -262,6 +305,7 @@ void Movable::setScale(float x, float y, float z)
 	mScale.x = x;
 	mScale.y = y;
 	mScale.z = z;
+	setTransformDirty();
 }
 
 const Common::Vector3& Movable::getScale() const
@@ -275,6 +319,7 @@ void Movable::addRotation(const Common::Matrix44& m, bool local)
 		mRotation = m * mRotation;
 	else
 		mRotation = mRotation * m;
+	setTransformDirty();
 }
 
 void Movable::addRotation(const Common::Vector3& axis, float angle, bool local)
@@ -284,6 +329,39 @@ void Movable::addRotation(const Common::Vector3& axis, float angle, bool local)
 }
 
 
+void Movable::setTransformDirty()
+{
+	mTransformDirty = true;
+	mTransformVersion++;
+	onTransformChanged();
+}
+
+unsigned int Movable::getTransformVersion() const
+{
+	return mTransformVersion;
+}
+
+const Common::Matrix44& Movable::getWorldMatrix() const
+{
+	if(mTransformDirty)
+		updateWorldMatrices();
+	return mWorldMatrix;
+}
+
+const Common::Matrix44& Movable::getInverseWorldMatrix() const
+{
+	if(mTransformDirty)
+		updateWorldMatrices();
+	return mInverseWorldMatrix;
+}
+
+void Movable::updateWorldMatrices() const
+{
+	TransformKernels::computeWorldMatrix(mPosition, mRotation, mScale, mWorldMatrix.m);
+	TransformKernels::computeInverseWorldMatrix(mPosition, mRotation, mScale, mInverseWorldMatrix.m);
+	mTransformDirty = false;
+}
+
 Common::Vector3 Movable::getTargetVector() const
 {
 	Vector3 v;
@@ -325,6 +403,58 @@ bool MeshInstance::useBlending() const
 	return mBlending;
 }
 
+void MeshInstance::attach(InstanceStore* store, InstanceHandle h)
+{
+	mStore = store;
+	mHandle = h;
+}
+
+void MeshInstance::detach()
+{
+	mStore = nullptr;
+	mHandle = InstanceHandle();
+	mHierarchy = nullptr;
+	mNode = NodeHandle();
+	mSimulationTable = nullptr;
+}
+
+InstanceHandle MeshInstance::getHandle() const
+{
+	return mHandle;
+}
+
+void MeshInstance::setNode(TransformHierarchy* hierarchy, NodeHandle n)
+{
+	mHierarchy = hierarchy;
+	mNode = n;
+	if(mHierarchy)
+		mHierarchy->setLocalTransform(mNode, mPosition, mRotation, mScale);
+	else if(mStore)
+		mStore->setTransform(mHandle, mPosition, mRotation, mScale);
+}
+
+NodeHandle MeshInstance::getNode() const
+{
+	return mNode;
+}
+
+void MeshInstance::setSimulationTable(InstanceTransformTable* table)
+{
+	mSimulationTable = table;
+	if(mSimulationTable)
+		mSimulationTable->set(mHandle, InstanceTransform::make(mPosition, mRotation, mScale));
+}
+
+void MeshInstance::onTransformChanged()
+{
+	if(mSimulationTable)
+		mSimulationTable->set(mHandle, InstanceTransform::make(mPosition, mRotation, mScale));
+	else if(mHierarchy)
+		mHierarchy->setLocalTransform(mNode, mPosition, mRotation, mScale);
+	else if(mStore)
+		mStore->setTransform(mHandle, mPosition, mRotation, mScale);
+}
+
 }
 
 
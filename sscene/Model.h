@@ -15,6 +15,10 @@
 #include "common/Matrix44.h"
 #include "common/Quaternion.h"
 
+#include "InstanceStore.h"
+#include "TransformHierarchy.h"
+#include "JobSystem.h"
+
 namespace Scene {
 
 class Heightmap {
@@ -26,13 +30,17 @@ class Heightmap {
 		virtual unsigned int getWidth() const = 0;
 		// size per tile
 		virtual float getXZScale() const = 0;
+		// return true if getHeightAt() may be called from several
+		// threads at once, so that the model is generated in parallel
+		virtual bool isThreadSafe() const { return false; }
 };
 
 class Model {
 	public:
 		Model();
 		Model(const std::string& filename);
-		Model(const Heightmap& heightmap, float uscale, float vscale);
+		Model(const Heightmap& heightmap, float uscale, float vscale,
+				JobSystem* jobs = nullptr);
 		Model(const std::vector<Common::Vector3>& vertexcoords,
 				const std::vector<Common::Vector2>& texcoords,
 				const std::vector<unsigned int>& indices,
@@ -40,10 +48,13 @@ class Model {
 
 	private:
 		friend class Drawable;
+		friend class MeshBuffer;
 		const std::vector<GLfloat>& getVertexCoords() const;
 		const std::vector<GLfloat>& getTexCoords() const;
 		const std::vector<GLushort>& getIndices() const;
 		const std::vector<GLfloat>& getNormals() const;
+		// RGBA per vertex, empty if the model has no vertex colors
+		const std::vector<GLfloat>& getColors() const;
 
 		void addVertex(const Common::Vector3& v);
 		void addNormal(const Common::Vector3& v);
@@ -62,6 +73,7 @@ class Model {
 		std::vector<GLfloat> mTexCoords;
 		std::vector<GLushort> mIndices;
 		std::vector<GLfloat> mNormals;
+		std::vector<GLfloat> mColors;
 
 		Assimp::Importer mImporter;
 		const aiScene* mScene;
@@ -71,6 +83,7 @@ class Movable {
 	public:
 		Movable();
 		Movable(const Common::Vector3& pos);
+		virtual ~Movable() { }
 		void setPosition(const Common::Vector3& p);
 		const Common::Vector3& getPosition() const;
 		void move(const Common::Vector3& v);
@@ -89,10 +102,29 @@ class Movable {
 		void setScale(float x, float y, float z);
 		const Common::Vector3& getScale() const;
 
+		// world (model) matrix and its inverse, recalculated lazily
+		// when the transform has changed
+		const Common::Matrix44& getWorldMatrix() const;
+		const Common::Matrix44& getInverseWorldMatrix() const;
+		// incremented on every change of position, rotation or scale
+		unsigned int getTransformVersion() const;
+
 	protected:
+		// must be called whenever mPosition, mRotation or mScale is modified
+		void setTransformDirty();
+		virtual void onTransformChanged() { }
+
 		Common::Vector3 mPosition;
 		Common::Matrix44 mRotation;
 		Common::Vector3 mScale;
+
+	private:
+		void updateWorldMatrices() const;
+
+		mutable Common::Matrix44 mWorldMatrix;
+		mutable Common::Matrix44 mInverseWorldMatrix;
+		mutable bool mTransformDirty = true;
+		unsigned int mTransformVersion = 0;
 };
 
 class Drawable;
@@ -104,7 +136,31 @@ class MeshInstance : public Movable {
 		bool useBlending() const;
 		bool useBackfaceCulling() const;
 
+		// called by Scene when the instance is added to or removed from
+		// it. While attached, transform changes are forwarded to the
+		// store the scene renders from.
+		void attach(InstanceStore* store, InstanceHandle h);
+		void detach();
+		InstanceHandle getHandle() const;
+		// while set, the position, rotation and scale are relative to the
+		// parent node in the hierarchy and getWorldMatrix() returns the
+		// local matrix
+		void setNode(TransformHierarchy* hierarchy, NodeHandle n);
+		NodeHandle getNode() const;
+		// while set, transform changes only go to the table, which the
+		// scene publishes to the render thread
+		void setSimulationTable(InstanceTransformTable* table);
+
+	protected:
+		virtual void onTransformChanged() override;
+
 	private:
+		InstanceStore* mStore = nullptr;
+		InstanceHandle mHandle;
+		TransformHierarchy* mHierarchy = nullptr;
+		NodeHandle mNode;
+		InstanceTransformTable* mSimulationTable = nullptr;
+
 		const Drawable& mDrawable;
 		bool mBackfaceCulling;
 		bool mBlending;
@@ -0,0 +1,57 @@
+#include "MultiDraw.h"
+
+#include <cstdint>
+
+namespace Scene {
+
+void MultiDraw::init(DynamicBuffer* buffer)
+{
+	mSupported = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+	mDynamicBuffer = buffer;
+}
+
+bool MultiDraw::isSupported() const
+{
+	return mSupported;
+}
+
+void MultiDraw::add(const Mesh& mesh, unsigned int count, unsigned int firstInstance)
+{
+	if(mesh.numIndices != 0) {
+		mElements.push_back({ GLuint(mesh.numIndices), count, GLuint(mesh.firstIndex),
+				GLint(mesh.firstVertex), firstInstance });
+	} else {
+		mArrays.push_back({ GLuint(mesh.numVertices), count, GLuint(mesh.firstVertex), firstInstance });
+	}
+}
+
+void MultiDraw::flush(FrameStats& stats, unsigned int FrameStats::* drawCalls)
+{
+	if(!mElements.empty()) {
+		size_t bytes = mElements.size() * sizeof(DrawElementsIndirectCommand);
+		auto a = mDynamicBuffer->upload(&mElements[0], bytes, 4);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, a.buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+				reinterpret_cast<const GLvoid*>(uintptr_t(a.offset)), mElements.size(), 0);
+		(stats.*drawCalls)++;
+		stats.indirectDraws += mElements.size();
+		stats.bufferBinds++;
+		stats.bytesUploaded += bytes;
+		mElements.clear();
+	}
+	if(!mArrays.empty()) {
+		size_t bytes = mArrays.size() * sizeof(DrawArraysIndirectCommand);
+		auto a = mDynamicBuffer->upload(&mArrays[0], bytes, 4);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, a.buffer);
+		glMultiDrawArraysIndirect(GL_TRIANGLES,
+				reinterpret_cast<const GLvoid*>(uintptr_t(a.offset)), mArrays.size(), 0);
+		(stats.*drawCalls)++;
+		stats.indirectDraws += mArrays.size();
+		stats.bufferBinds++;
+		stats.bytesUploaded += bytes;
+		mArrays.clear();
+	}
+}
+
+}
+
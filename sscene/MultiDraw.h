@@ -0,0 +1,65 @@
+#ifndef SCENE_MULTIDRAW_H
+#define SCENE_MULTIDRAW_H
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "DynamicBuffer.h"
+#include "MeshBuffer.h"
+#include "FrameStats.h"
+
+namespace Scene {
+
+// the layouts glMultiDraw*Indirect() reads
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+struct DrawArraysIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint first;
+	GLuint baseInstance;
+};
+
+// Instanced draws of MeshBuffer meshes collected into one
+// glMultiDrawElementsIndirect() call (GL 4.3). The base instance of each
+// command offsets the instanced attributes, so the instance data of the
+// whole pass is bound once and the draws between two state changes go
+// out together. The commands are written to the frame's DynamicBuffer.
+class MultiDraw {
+	public:
+		MultiDraw() = default;
+		MultiDraw(const MultiDraw&) = delete;
+		MultiDraw& operator=(const MultiDraw&) = delete;
+
+		// must be called with a current GL context. Needs multi draw
+		// indirect and base instance; isSupported() returns false without.
+		void init(DynamicBuffer* buffer);
+		bool isSupported() const;
+
+		// queues count instances of the mesh, starting at the given one of
+		// the instance data. The mesh's arena must be bound when flushed.
+		void add(const Mesh& mesh, unsigned int count, unsigned int firstInstance);
+		// issues the queued draws in at most two calls, the indexed meshes
+		// first, counting them in drawCalls. Must be called before any
+		// state the draws use changes.
+		void flush(FrameStats& stats, unsigned int FrameStats::* drawCalls = &FrameStats::drawCalls);
+
+	private:
+		bool mSupported = false;
+		DynamicBuffer* mDynamicBuffer = nullptr;
+		std::vector<DrawElementsIndirectCommand> mElements;
+		std::vector<DrawArraysIndirectCommand> mArrays;
+};
+
+}
+
+#endif
+
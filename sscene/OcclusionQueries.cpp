@@ -0,0 +1,116 @@
+#include "OcclusionQueries.h"
+
+namespace Scene {
+
+OcclusionQueries::~OcclusionQueries()
+{
+	for(auto& s : mSlots) {
+		if(s.query)
+			glDeleteQueries(1, &s.query);
+	}
+	if(mBoxBuffer)
+		glDeleteBuffers(1, &mBoxBuffer);
+}
+
+void OcclusionQueries::init()
+{
+	// a yes/no answer lets the driver stop counting at the first sample
+	mTarget = (GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2) ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+
+	// two triangles for each face of the unit cube
+	static const GLfloat corners[8][3] = {
+		{ 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+		{ 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }
+	};
+	static const unsigned int faces[6][4] = {
+		{ 0, 1, 2, 3 }, { 5, 4, 7, 6 }, { 4, 0, 3, 7 },
+		{ 1, 5, 6, 2 }, { 3, 2, 6, 7 }, { 4, 5, 1, 0 }
+	};
+	std::vector<GLfloat> vertices;
+	for(const auto& f : faces) {
+		for(unsigned int i : { 0, 1, 2, 0, 2, 3 }) {
+			for(int c = 0; c < 3; c++)
+				vertices.push_back(corners[f[i]][c]);
+		}
+	}
+
+	glGenBuffers(1, &mBoxBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, mBoxBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+}
+
+void OcclusionQueries::beginFrame(size_t numSlots)
+{
+	if(mSlots.size() < numSlots)
+		mSlots.resize(numSlots);
+
+	for(size_t i = 0; i < mPending.size(); ) {
+		auto& s = mSlots[mPending[i]];
+		GLint available = 0;
+		glGetQueryObjectiv(s.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available) {
+			i++;
+			continue;
+		}
+
+		GLuint samples = 0;
+		glGetQueryObjectuiv(s.query, GL_QUERY_RESULT, &samples);
+		s.visible = samples > 0;
+		s.pending = false;
+		mPending[i] = mPending.back();
+		mPending.pop_back();
+	}
+}
+
+bool OcclusionQueries::isVisible(InstanceHandle h) const
+{
+	if(h.slot >= mSlots.size())
+		return true;
+	const auto& s = mSlots[h.slot];
+	// a result of a removed instance says nothing about the new one
+	return s.generation != h.generation || s.visible;
+}
+
+bool OcclusionQueries::canQuery(InstanceHandle h) const
+{
+	return h.slot < mSlots.size() && !mSlots[h.slot].pending;
+}
+
+void OcclusionQueries::reset()
+{
+	// results still in flight are then recorded for no instance
+	for(auto& s : mSlots) {
+		s.generation = 0;
+		s.visible = true;
+	}
+}
+
+void OcclusionQueries::bindBox(GLuint positionAttrib)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, mBoxBuffer);
+	glVertexAttribPointer(positionAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+}
+
+void OcclusionQueries::drawBox()
+{
+	glDrawArrays(GL_TRIANGLES, 0, 36);
+}
+
+void OcclusionQueries::beginQuery(InstanceHandle h)
+{
+	auto& s = mSlots[h.slot];
+	if(!s.query)
+		glGenQueries(1, &s.query);
+	s.generation = h.generation;
+	s.pending = true;
+	mPending.push_back(h.slot);
+	glBeginQuery(mTarget, s.query);
+}
+
+void OcclusionQueries::endQuery()
+{
+	glEndQuery(mTarget);
+}
+
+}
+
@@ -0,0 +1,64 @@
+#ifndef SCENE_OCCLUSIONQUERIES_H
+#define SCENE_OCCLUSIONQUERIES_H
+
+#include <vector>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "InstanceStore.h"
+
+namespace Scene {
+
+// Hardware occlusion queries of the instances' bounding boxes. The
+// results are read back a frame or more late, so waiting for them never
+// stalls; until a result arrives an instance keeps its last visibility.
+// Instances that come into view therefore appear a frame late.
+class OcclusionQueries {
+	public:
+		OcclusionQueries() = default;
+		~OcclusionQueries();
+		OcclusionQueries(const OcclusionQueries&) = delete;
+		OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+		// must be called with a current GL context
+		void init();
+
+		// collects the results that have arrived and makes room for
+		// numSlots instance slots. isVisible() and canQuery() may be
+		// called from any thread until the next beginQuery().
+		void beginFrame(size_t numSlots);
+		// false if the last result found the instance hidden
+		bool isVisible(InstanceHandle h) const;
+		// false while the instance's previous query is still in flight
+		bool canQuery(InstanceHandle h) const;
+		// forgets all results, making every instance visible again
+		void reset();
+
+		// the box is the unit cube, from (0, 0, 0) to (1, 1, 1), drawn
+		// as triangles from the bound buffer at the given attribute
+		void bindBox(GLuint positionAttrib);
+		void drawBox();
+		void beginQuery(InstanceHandle h);
+		void endQuery();
+
+	private:
+		struct Slot {
+			GLuint query = 0;
+			uint32_t generation = 0;
+			bool pending = false;
+			bool visible = true;
+		};
+
+		// GL_ANY_SAMPLES_PASSED if supported, GL_SAMPLES_PASSED otherwise
+		GLenum mTarget = GL_SAMPLES_PASSED;
+		GLuint mBoxBuffer = 0;
+		std::vector<Slot> mSlots;
+		std::vector<uint32_t> mPending;
+};
+
+}
+
+#endif
+
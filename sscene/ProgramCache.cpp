@@ -0,0 +1,178 @@
+#include "ProgramCache.h"
+
+#include <fstream>
+#include <cstdio>
+
+namespace Scene {
+
+// "SSPB" and the version of the file layout
+static const uint32_t CacheMagic = 0x42505353;
+static const uint32_t CacheVersion = 1;
+
+void ProgramCache::setDirectory(const std::string& directory)
+{
+	mDirectory = directory;
+}
+
+void ProgramCache::init()
+{
+	mEnabled = false;
+	if(mDirectory.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+		return;
+
+	// some drivers have the extension but no binary formats
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if(formats <= 0)
+		return;
+
+	mDriver = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "\n" +
+		reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "\n" +
+		reinterpret_cast<const char*>(glGetString(GL_VERSION));
+	mEnabled = true;
+}
+
+bool ProgramCache::isEnabled() const
+{
+	return mEnabled;
+}
+
+uint64_t ProgramCache::hash(const char* vertexShader, const char* fragmentShader,
+		const std::vector<std::pair<GLuint, const char*>>& attribs)
+{
+	// FNV-1a, including the terminating zeros so that moving text from
+	// one string to the next changes the hash
+	uint64_t h = 14695981039346656037ull;
+	auto add = [&] (const char* s) {
+		do {
+			h ^= uint8_t(*s);
+			h *= 1099511628211ull;
+		} while(*s++);
+	};
+	add(vertexShader);
+	add(fragmentShader);
+	for(const auto& a : attribs) {
+		h ^= a.first;
+		h *= 1099511628211ull;
+		add(a.second);
+	}
+	return h;
+}
+
+std::string ProgramCache::getPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+	return mDirectory + "/" + name;
+}
+
+GLuint ProgramCache::load(uint64_t key)
+{
+	if(!mEnabled)
+		return 0;
+
+	std::ifstream ifs(getPath(key), std::ios::binary);
+	uint32_t header[3] = { 0 };
+	if(!ifs.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+			header[0] != CacheMagic || header[1] != CacheVersion ||
+			header[2] != mDriver.size()) {
+		mMisses++;
+		return 0;
+	}
+
+	std::string driver(header[2], '\0');
+	uint32_t binaryHeader[2] = { 0 };
+	if(!ifs.read(&driver[0], driver.size()) || driver != mDriver ||
+			!ifs.read(reinterpret_cast<char*>(binaryHeader), sizeof(binaryHeader))) {
+		mMisses++;
+		return 0;
+	}
+
+	// the binary is the rest of the file; its length is checked before
+	// allocating so that a corrupt entry is only a miss
+	std::streampos binaryStart = ifs.tellg();
+	ifs.seekg(0, std::ios::end);
+	std::streampos fileEnd = ifs.tellg();
+	ifs.seekg(binaryStart);
+	if(!ifs || binaryHeader[1] == 0 || fileEnd - binaryStart != std::streamoff(binaryHeader[1])) {
+		mMisses++;
+		return 0;
+	}
+
+	std::vector<char> binary(binaryHeader[1]);
+	if(!ifs.read(&binary[0], binary.size())) {
+		mMisses++;
+		return 0;
+	}
+
+	// the driver may still refuse the binary, e.g. after an update that
+	// kept the version string
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, binaryHeader[0], &binary[0], binary.size());
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if(!linked) {
+		glDeleteProgram(program);
+		mMisses++;
+		return 0;
+	}
+	mHits++;
+	return program;
+}
+
+void ProgramCache::prepare(GLuint program)
+{
+	if(mEnabled)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ProgramCache::store(uint64_t key, GLuint program)
+{
+	if(!mEnabled)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+	if(length <= 0)
+		return;
+
+	// written under another name first so that a concurrent load never
+	// sees half a file. Failures only mean the program is compiled again
+	// next time.
+	std::string path = getPath(key);
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+		uint32_t header[3] = { CacheMagic, CacheVersion, uint32_t(mDriver.size()) };
+		uint32_t binaryHeader[2] = { format, uint32_t(length) };
+		ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+		ofs.write(mDriver.data(), mDriver.size());
+		ofs.write(reinterpret_cast<const char*>(binaryHeader), sizeof(binaryHeader));
+		ofs.write(&binary[0], length);
+		if(!ofs) {
+			ofs.close();
+			std::remove(tmpPath.c_str());
+			return;
+		}
+	}
+	if(std::rename(tmpPath.c_str(), path.c_str()) != 0)
+		std::remove(tmpPath.c_str());
+}
+
+unsigned int ProgramCache::getHits() const
+{
+	return mHits;
+}
+
+unsigned int ProgramCache::getMisses() const
+{
+	return mMisses;
+}
+
+}
+
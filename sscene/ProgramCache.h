@@ -0,0 +1,54 @@
+#ifndef SCENE_PROGRAMCACHE_H
+#define SCENE_PROGRAMCACHE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+namespace Scene {
+
+// On-disk cache of linked program binaries, so that programs are only
+// compiled from source the first time. Entries are keyed by a hash of
+// the shader sources and attribute bindings and remember the GL
+// vendor, renderer and version that made them. An entry of another
+// driver, or one the driver rejects, counts as a miss and is replaced
+// once the program has been compiled again.
+class ProgramCache {
+	public:
+		// the directory must exist; empty disables the cache
+		void setDirectory(const std::string& directory);
+		// must be called with a current GL context. Needs
+		// ARB_get_program_binary; the cache stays off without it.
+		void init();
+		bool isEnabled() const;
+
+		static uint64_t hash(const char* vertexShader, const char* fragmentShader,
+				const std::vector<std::pair<GLuint, const char*>>& attribs);
+
+		// creates a linked program from the cache, 0 on a miss
+		GLuint load(uint64_t key);
+		// call before linking a program that is to be stored
+		void prepare(GLuint program);
+		void store(uint64_t key, GLuint program);
+
+		unsigned int getHits() const;
+		unsigned int getMisses() const;
+
+	private:
+		std::string getPath(uint64_t key) const;
+
+		std::string mDirectory;
+		bool mEnabled = false;
+		std::string mDriver;
+		unsigned int mHits = 0;
+		unsigned int mMisses = 0;
+};
+
+}
+
+#endif
+
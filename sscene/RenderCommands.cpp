@@ -0,0 +1,141 @@
+#include "RenderCommands.h"
+
+#include <algorithm>
+#include <queue>
+
+namespace Scene {
+
+void CommandChunk::clear()
+{
+	opaque.clear();
+	blended.clear();
+	occlusionTests.clear();
+	culled = 0;
+	occluded = 0;
+}
+
+static bool backToFront(const DrawCommand& a, const DrawCommand& b)
+{
+	return a.depth > b.depth;
+}
+
+void CommandChunk::sort()
+{
+	std::sort(opaque.begin(), opaque.end(), [] (const DrawCommand& a, const DrawCommand& b) {
+			return a.sortKey < b.sortKey; });
+	std::sort(blended.begin(), blended.end(), backToFront);
+}
+
+void RenderCommandList::reset(unsigned int numChunks)
+{
+	if(mChunks.size() < numChunks)
+		mChunks.resize(numChunks);
+	for(unsigned int i = 0; i < numChunks; i++)
+		mChunks[i].clear();
+	mNumChunks = numChunks;
+	mOpaque.clear();
+	mBlended.clear();
+	mOpaqueBatches.clear();
+	mBlendedBatches.clear();
+	mInstanceData.clear();
+}
+
+// merges the sorted commands of the chunks with a heap of the next
+// command of each. Equal commands keep the chunk order.
+template<typename Less>
+static void mergeChunks(const std::vector<CommandChunk>& chunks, unsigned int numChunks,
+		std::vector<DrawCommand> CommandChunk::* commands, Less less,
+		std::vector<const DrawCommand*>& out)
+{
+	typedef std::pair<unsigned int, size_t> Head;
+	auto later = [&] (const Head& a, const Head& b) {
+		const DrawCommand& ca = (chunks[a.first].*commands)[a.second];
+		const DrawCommand& cb = (chunks[b.first].*commands)[b.second];
+		if(less(cb, ca))
+			return true;
+		return !less(ca, cb) && a.first > b.first;
+	};
+	std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+
+	out.clear();
+	size_t total = 0;
+	for(unsigned int i = 0; i < numChunks; i++) {
+		total += (chunks[i].*commands).size();
+		if(!(chunks[i].*commands).empty())
+			heads.push({ i, 0 });
+	}
+	out.reserve(total);
+	while(!heads.empty()) {
+		Head h = heads.top();
+		heads.pop();
+		const auto& v = chunks[h.first].*commands;
+		out.push_back(&v[h.second]);
+		if(++h.second < v.size())
+			heads.push(h);
+	}
+}
+
+const std::vector<const DrawCommand*>& RenderCommandList::getOpaque()
+{
+	mergeChunks(mChunks, mNumChunks, &CommandChunk::opaque, [] (const DrawCommand& a, const DrawCommand& b) {
+			return a.sortKey < b.sortKey; }, mOpaque);
+	return mOpaque;
+}
+
+const std::vector<const DrawCommand*>& RenderCommandList::getBlended()
+{
+	mergeChunks(mChunks, mNumChunks, &CommandChunk::blended, backToFront, mBlended);
+	return mBlended;
+}
+
+void RenderCommandList::buildBatches(bool instancing)
+{
+	mOpaqueBatches.clear();
+	mBlendedBatches.clear();
+	mInstanceData.clear();
+
+	unsigned int numInstances = 0;
+	auto add = [&] (std::vector<DrawBatch>& batches, const DrawCommand& cmd) {
+		if(!instancing) {
+			batches.push_back({ &cmd, 1, 0 });
+			return;
+		}
+
+		// blended commands are only joined when next to each other in
+		// the back to front order, which instancing keeps
+		const DrawCommand* prev = batches.empty() ? nullptr : batches.back().command;
+		if(prev && prev->drawable == cmd.drawable && prev->texture == cmd.texture &&
+				prev->flags == cmd.flags)
+			batches.back().count++;
+		else
+			batches.push_back({ &cmd, 1, numInstances });
+		mInstanceData.insert(mInstanceData.end(), cmd.world, cmd.world + 16);
+		mInstanceData.insert(mInstanceData.end(), cmd.normalMatrix, cmd.normalMatrix + 9);
+		numInstances++;
+	};
+
+	// the same state in different chunks forms one batch
+	for(auto cmd : getOpaque())
+		add(mOpaqueBatches, *cmd);
+	for(auto cmd : getBlended())
+		add(mBlendedBatches, *cmd);
+}
+
+unsigned int RenderCommandList::getNumCulled() const
+{
+	unsigned int n = 0;
+	for(unsigned int i = 0; i < mNumChunks; i++)
+		n += mChunks[i].culled;
+	return n;
+}
+
+unsigned int RenderCommandList::getNumOccluded() const
+{
+	unsigned int n = 0;
+	for(unsigned int i = 0; i < mNumChunks; i++)
+		n += mChunks[i].occluded;
+	return n;
+}
+
+}
+
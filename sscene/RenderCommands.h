@@ -0,0 +1,110 @@
+#ifndef SCENE_RENDERCOMMANDS_H
+#define SCENE_RENDERCOMMANDS_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "InstanceStore.h"
+
+namespace Scene {
+
+class Drawable;
+
+// One draw of a mesh instance as decided by the prepare phase of
+// Scene::render(). Holds no API state; the submit phase translates it
+// to GL calls.
+struct DrawCommand {
+	// groups draws with the same state together
+	uint64_t sortKey;
+	// distance along the view direction, for sorting blended draws
+	float depth;
+	// diameter of the bounding sphere on screen in pixels, for texture
+	// streaming
+	float screenSize;
+	const Drawable* drawable;
+	uint32_t texture;
+	// InstanceFlag
+	uint32_t flags;
+	float world[16];
+	// inverse transpose of the upper 3x3 of world, for the normals
+	float normalMatrix[9];
+	const std::string* name;
+};
+
+// Bounding box draw of an instance for an occlusion query.
+struct OcclusionTest {
+	InstanceHandle instance;
+	// maps the unit cube to the box in world space
+	float world[16];
+};
+
+// floats of per instance data written for a command: the world matrix
+// followed by the normal matrix
+static const unsigned int InstanceDataSize = 16 + 9;
+
+// Consecutive commands of the same drawable, texture and flags, which
+// are drawn with one instanced draw call. Without instancing each
+// command is a batch of its own.
+struct DrawBatch {
+	// the first command, which has the state of all of them
+	const DrawCommand* command;
+	unsigned int count;
+	// index of the first instance in the instance data
+	unsigned int firstInstance;
+};
+
+// Commands written by one prepare task, with its counters.
+struct CommandChunk {
+	std::vector<DrawCommand> opaque;
+	// sorted back to front
+	std::vector<DrawCommand> blended;
+	std::vector<OcclusionTest> occlusionTests;
+	unsigned int culled = 0;
+	unsigned int occluded = 0;
+
+	void clear();
+	// sorts opaque by state and blended back to front
+	void sort();
+};
+
+// The per frame command list. Each chunk is written by exactly one
+// task, so filling needs no locking; the sorted chunks are then merged
+// into one order for the submit phase.
+class RenderCommandList {
+	public:
+		// clears the commands, keeping the allocations
+		void reset(unsigned int numChunks);
+		CommandChunk& getChunk(unsigned int i) { return mChunks[i]; }
+		const CommandChunk& getChunk(unsigned int i) const { return mChunks[i]; }
+		unsigned int getNumChunks() const { return mNumChunks; }
+
+		// opaque commands of all chunks in sortKey order
+		const std::vector<const DrawCommand*>& getOpaque();
+		// blended commands of all chunks in back to front order
+		const std::vector<const DrawCommand*>& getBlended();
+		unsigned int getNumCulled() const;
+		unsigned int getNumOccluded() const;
+
+		// groups the commands into batches, writing their instance data
+		// if instancing is used. Call after the chunks are filled and
+		// sorted.
+		void buildBatches(bool instancing);
+		const std::vector<DrawBatch>& getOpaqueBatches() const { return mOpaqueBatches; }
+		const std::vector<DrawBatch>& getBlendedBatches() const { return mBlendedBatches; }
+		const std::vector<float>& getInstanceData() const { return mInstanceData; }
+
+	private:
+		std::vector<CommandChunk> mChunks;
+		unsigned int mNumChunks = 0;
+		std::vector<const DrawCommand*> mOpaque;
+		std::vector<const DrawCommand*> mBlended;
+		std::vector<DrawBatch> mOpaqueBatches;
+		std::vector<DrawBatch> mBlendedBatches;
+		std::vector<float> mInstanceData;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,123 @@
+#ifndef SCENE_RESOURCECACHE_H
+#define SCENE_RESOURCECACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include <boost/shared_ptr.hpp>
+
+namespace Scene {
+
+struct ResourceInfo {
+	enum class Type {
+		Model,
+		Texture
+	};
+
+	Type type;
+	// the canonical path and import options, or the name of a model
+	// that wasn't loaded from a file
+	std::string key;
+	// GPU memory used
+	size_t bytes;
+	// the names and instances using it
+	unsigned int references;
+};
+
+// Resources shared by the names they were added under and the instances
+// using them. Loaded resources are found by their key, so that a file is
+// only loaded once however many names refer to it. A resource is
+// dropped from the cache with its last reference.
+//
+// The instances refer to resources by an id, e.g. the pointer or the GL
+// object name, which is what the references are counted by.
+template<typename T>
+class ResourceCache {
+	public:
+		// null if there is none with the key
+		boost::shared_ptr<T> find(const std::string& key) const
+		{
+			auto it = mKeys.find(key);
+			if(it == mKeys.end())
+				return boost::shared_ptr<T>();
+			return mEntries.find(it->second)->second.resource;
+		}
+
+		// adds a resource without references. Resources that aren't
+		// shared are never found by their key.
+		void insert(const std::string& key, uintptr_t id, const boost::shared_ptr<T>& resource,
+				bool shared = true)
+		{
+			Entry& e = mEntries[id];
+			e.key = key;
+			e.resource = resource;
+			e.refs = 0;
+			e.shared = shared;
+			if(shared)
+				mKeys[key] = id;
+		}
+
+		void addRef(uintptr_t id, unsigned int n = 1)
+		{
+			mEntries.at(id).refs += n;
+		}
+
+		// returns the resource when this was the last reference, which
+		// drops it from the cache
+		boost::shared_ptr<T> release(uintptr_t id, unsigned int n = 1)
+		{
+			auto it = mEntries.find(id);
+			if(it == mEntries.end())
+				return boost::shared_ptr<T>();
+			Entry& e = it->second;
+			e.refs -= std::min(n, e.refs);
+			if(e.refs)
+				return boost::shared_ptr<T>();
+
+			boost::shared_ptr<T> resource = e.resource;
+			if(e.shared)
+				mKeys.erase(e.key);
+			mEntries.erase(it);
+			return resource;
+		}
+
+		size_t size() const
+		{
+			return mEntries.size();
+		}
+
+		// bytes of all the resources, from T::getMemorySize()
+		size_t getMemorySize() const
+		{
+			size_t bytes = 0;
+			for(const auto& kv : mEntries)
+				bytes += kv.second.resource->getMemorySize();
+			return bytes;
+		}
+
+		template<typename Fn>
+		void forEach(Fn fn) const
+		{
+			for(const auto& kv : mEntries)
+				fn(kv.second.key, *kv.second.resource, kv.second.refs);
+		}
+
+	private:
+		struct Entry {
+			std::string key;
+			boost::shared_ptr<T> resource;
+			unsigned int refs;
+			bool shared;
+		};
+
+		std::unordered_map<uintptr_t, Entry> mEntries;
+		std::unordered_map<std::string, uintptr_t> mKeys;
+};
+
+}
+
+#endif
+
@@ -1,8 +1,14 @@
 #include "Scene.h"
 
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
 
 #include "HelperFunctions.h"
+#include "TransformKernels.h"
+#include "Frustum.h"
+#include "SceneFile.h"
 
 #include "common/Texture.h"
 #include "common/Math.h"
@@ -18,20 +24,10 @@ namespace Scene {
 #include "shaders/line.frag.h"
 #include "shaders/overlay.vert.h"
 #include "shaders/overlay.frag.h"
-
-#define CHECK_GL_ERROR_IMPL(file, line) { \
-	do { \
-		while(1) { \
-			GLenum err = glGetError(); \
-			if(err == GL_NO_ERROR) { \
-				break; \
-			} \
-			fprintf(stderr, "%s:%d: GL error 0x%04x\n", file, line, err); \
-		} \
-	} while(0); \
-	}
-
-#define CHECK_GL_ERROR() { do { CHECK_GL_ERROR_IMPL(__FILE__, __LINE__); } while(0); }
+#include "shaders/shadow.vert.h"
+#include "shaders/shadow.frag.h"
+#include "shaders/depth.vert.h"
+#include "shaders/depth.frag.h"
 
 const Vector3 WorldForward = Vector3(1, 0, 0);
 const Vector3 WorldUp      = Vector3(0, 1, 0);
@@ -57,69 +53,37 @@ void loadBufferData(const std::vector<attrib>& attribs, GLuint* vboids)
 const unsigned int Line::VERTEX_POS_INDEX = 0;
 const unsigned int Line::COLOR_INDEX = 1;
 
-Line::Line()
-{
-	glGenBuffers(2, mVBOIDs);
-}
-
-Line::~Line()
-{
-	if(mVBOIDs[0]) {
-		glDeleteBuffers(2, mVBOIDs);
-	}
-}
-
 void Line::addSegment(const Common::Vector3& start, const Common::Vector3& end, const Common::Color& color)
 {
-	mSegments.push_back(std::make_tuple(start, end, color));
-
-	std::vector<GLfloat> vertices;
-	std::vector<GLfloat> colors;
-
-	for(const auto& t : mSegments) {
-		vertices.push_back(std::get<0>(t).x);
-		vertices.push_back(std::get<0>(t).y);
-		vertices.push_back(std::get<0>(t).z);
-		vertices.push_back(std::get<1>(t).x);
-		vertices.push_back(std::get<1>(t).y);
-		vertices.push_back(std::get<1>(t).z);
-		colors.push_back(std::get<2>(t).r / 255.0f);
-		colors.push_back(std::get<2>(t).g / 255.0f);
-		colors.push_back(std::get<2>(t).b / 255.0f);
-		colors.push_back(std::get<2>(t).r / 255.0f);
-		colors.push_back(std::get<2>(t).g / 255.0f);
-		colors.push_back(std::get<2>(t).b / 255.0f);
-	}
-
-	std::vector<attrib> attribs = { { "a_Position", 3, vertices },
-		{ "a_Color", 3, colors } };
-
-	loadBufferData(attribs, mVBOIDs);
+	mVertices.insert(mVertices.end(), { start.x, start.y, start.z, end.x, end.y, end.z });
+	for(int i = 0; i < 2; i++)
+		mColors.insert(mColors.end(), { color.r / 255.0f, color.g / 255.0f, color.b / 255.0f });
 }
 
 void Line::clear()
 {
-	mSegments.clear();
+	mVertices.clear();
+	mColors.clear();
 }
 
 bool Line::isEmpty() const
 {
-	return mSegments.empty();
+	return mVertices.empty();
 }
 
-GLuint Line::getVertexBuffer() const
+const std::vector<GLfloat>& Line::getVertices() const
 {
-	return mVBOIDs[0];
+	return mVertices;
 }
 
-GLuint Line::getColorBuffer() const
+const std::vector<GLfloat>& Line::getColors() const
 {
-	return mVBOIDs[1];
+	return mColors;
 }
 
 unsigned int Line::getNumVertices() const
 {
-	return mSegments.size() * 2;
+	return mVertices.size() / 3;
 }
 
 const unsigned int Overlay::VERTEX_POS_INDEX = 0;
@@ -276,6 +240,7 @@ void Camera::applyMovementKeys(float coeff)
 		auto m = calculateMovement(p.second);
 		mPosition += m;
 	}
+	setTransformDirty();
 }
 
 void Camera::setForwardMovement(float speed)
@@ -392,64 +357,111 @@ void DirectionalLight::setDirection(const Common::Vector3& dir)
 
 class Drawable {
 	public:
-		Drawable(GLuint programObject, const Model& model);
+		Drawable(const Model& model, MeshBuffer& meshBuffer);
 		~Drawable();
 		Drawable& operator=(const Drawable&) = delete;
 		Drawable(const Drawable&) = delete;
 
-		GLuint getVertexBuffer() const;
-		GLuint getTexCoordBuffer() const;
-		GLuint getNormalBuffer() const;
-		GLuint getIndexBuffer() const;
+		// the vertex and index data in the MeshBuffer
+		uint32_t getMesh() const;
+		bool hasVertexColors() const;
 		unsigned int getNumIndices() const;
 		unsigned int getNumVertices() const;
+		// bytes of the vertex and index data
+		size_t getMemorySize() const;
+		// center x, y, z and radius in model space
+		const float* getBoundingSphere() const;
+		// min x, y, z and max x, y, z in model space
+		const float* getBoundingBox() const;
 
 		static const unsigned int VERTEX_POS_INDEX;
 		static const unsigned int TEXCOORD_INDEX;
 		static const unsigned int NORMAL_INDEX;
+		static const unsigned int COLOR_INDEX;
 
 	private:
-		void initBuffers(GLuint programObject, const Model& model);
+		void calculateBounds(const std::vector<GLfloat>& vertexCoords);
 
-		GLuint mVBOIDs[4];
+		MeshBuffer& mMeshBuffer;
+		uint32_t mMesh;
+		bool mVertexColors;
 		unsigned int mNumIndices;
 		unsigned int mNumVertices;
+		float mBoundingSphere[4];
+		float mBoundingBox[6];
 };
 
-const unsigned int Drawable::VERTEX_POS_INDEX = 0;
-const unsigned int Drawable::TEXCOORD_INDEX = 1;
-const unsigned int Drawable::NORMAL_INDEX = 2;
+const unsigned int Drawable::VERTEX_POS_INDEX = MeshBuffer::POSITION_INDEX;
+const unsigned int Drawable::TEXCOORD_INDEX = MeshBuffer::TEXCOORD_INDEX;
+const unsigned int Drawable::NORMAL_INDEX = MeshBuffer::NORMAL_INDEX;
+const unsigned int Drawable::COLOR_INDEX = MeshBuffer::COLOR_INDEX;
 
-Drawable::Drawable(GLuint programObject, const Model& model)
+Drawable::Drawable(const Model& model, MeshBuffer& meshBuffer)
+	: mMeshBuffer(meshBuffer)
 {
-	initBuffers(programObject, model);
+	mMesh = mMeshBuffer.add(model);
+	mVertexColors = !model.getColors().empty();
 	mNumIndices = model.getIndices().size();
 	mNumVertices = model.getVertexCoords().size() / 3;
+	calculateBounds(model.getVertexCoords());
 }
 
-Drawable::~Drawable()
+void Drawable::calculateBounds(const std::vector<GLfloat>& vertexCoords)
 {
-	glDeleteBuffers(4, mVBOIDs);
+	// the sphere is centered on the bounding box, which is good enough
+	// for culling
+	float* minv = mBoundingBox;
+	float* maxv = mBoundingBox + 3;
+	for(int c = 0; c < 3; c++) {
+		minv[c] = 0.0f;
+		maxv[c] = 0.0f;
+	}
+	for(size_t i = 0; i + 2 < vertexCoords.size(); i += 3) {
+		for(int c = 0; c < 3; c++) {
+			if(i == 0 || vertexCoords[i + c] < minv[c])
+				minv[c] = vertexCoords[i + c];
+			if(i == 0 || vertexCoords[i + c] > maxv[c])
+				maxv[c] = vertexCoords[i + c];
+		}
+	}
+
+	float r2 = 0.0f;
+	for(int c = 0; c < 3; c++)
+		mBoundingSphere[c] = (minv[c] + maxv[c]) * 0.5f;
+	for(size_t i = 0; i + 2 < vertexCoords.size(); i += 3) {
+		float d2 = 0.0f;
+		for(int c = 0; c < 3; c++) {
+			float d = vertexCoords[i + c] - mBoundingSphere[c];
+			d2 += d * d;
+		}
+		r2 = std::max(r2, d2);
+	}
+	mBoundingSphere[3] = std::sqrt(r2);
 }
 
-GLuint Drawable::getVertexBuffer() const
+const float* Drawable::getBoundingSphere() const
 {
-	return mVBOIDs[0];
+	return mBoundingSphere;
 }
 
-GLuint Drawable::getTexCoordBuffer() const
+const float* Drawable::getBoundingBox() const
 {
-	return mVBOIDs[1];
+	return mBoundingBox;
 }
 
-GLuint Drawable::getNormalBuffer() const
+Drawable::~Drawable()
+{
+	mMeshBuffer.remove(mMesh);
+}
+
+uint32_t Drawable::getMesh() const
 {
-	return mVBOIDs[2];
+	return mMesh;
 }
 
-GLuint Drawable::getIndexBuffer() const
+bool Drawable::hasVertexColors() const
 {
-	return mVBOIDs[3];
+	return mVertexColors;
 }
 
 unsigned int Drawable::getNumIndices() const
@@ -462,19 +474,11 @@ unsigned int Drawable::getNumVertices() const
 	return mNumVertices;
 }
 
-void Drawable::initBuffers(GLuint programObject, const Model& model)
+size_t Drawable::getMemorySize() const
 {
-	glGenBuffers(4, mVBOIDs);
-
-	std::vector<attrib> attribs = { { "a_Position", 3, model.getVertexCoords() },
-		{ "a_texCoord", 2, model.getTexCoords() },
-		{ "a_Normal", 3, model.getNormals() } };
-
-	loadBufferData(attribs, mVBOIDs);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVBOIDs[3]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, model.getIndices().size() * sizeof(GLushort),
-			&model.getIndices()[0], GL_STATIC_DRAW);
+	// position, texture coordinates and normal, and RGBA colors
+	size_t perVertex = (3 + 2 + 3 + (mVertexColors ? 4 : 0)) * sizeof(GLfloat);
+	return mNumVertices * perVertex + mNumIndices * sizeof(GLushort);
 }
 
 struct Shader {
@@ -484,15 +488,11 @@ struct Shader {
 	std::vector<std::pair<GLuint, const char*>> attribs;
 };
 
-GLuint Scene::loadShader(const Shader& s)
+GLuint Scene::startProgram(const Shader& s)
 {
-	GLuint vshader;
-	GLuint fshader;
-	GLint linked;
-	GLuint program;
-
-	vshader = HelperFunctions::loadShader(GL_VERTEX_SHADER, s.vertexShader);
-	fshader = HelperFunctions::loadShader(GL_FRAGMENT_SHADER, s.fragmentShader);
+	GLuint program = mProgramCache->load(ProgramCache::hash(s.vertexShader, s.fragmentShader, s.attribs));
+	if(program)
+		return program;
 
 	program = glCreateProgram();
 
@@ -501,19 +501,44 @@ GLuint Scene::loadShader(const Shader& s)
 		throw std::runtime_error("Error initialising 3D");
 	}
 
+	// the results are only checked in finishProgram(), so that the
+	// driver can compile in the background meanwhile
+	GLuint vshader = HelperFunctions::compileShader(GL_VERTEX_SHADER, s.vertexShader);
+	GLuint fshader = HelperFunctions::compileShader(GL_FRAGMENT_SHADER, s.fragmentShader);
 	glAttachShader(program, vshader);
 	glAttachShader(program, fshader);
+	// deleted once detached from the program
+	glDeleteShader(vshader);
+	glDeleteShader(fshader);
 
+	// the arrays are enabled by the passes that use them; programs may
+	// be linked in the middle of a frame
 	for(const auto& attr : s.attribs) {
-		glEnableVertexAttribArray(attr.first);
 		glBindAttribLocation(program, attr.first, attr.second);
 	}
 
+	mProgramCache->prepare(program);
 	glLinkProgram(program);
+	return program;
+}
+
+bool Scene::finishProgram(GLuint program, const Shader& s)
+{
+	GLint linked;
+	GLuint shaders[2];
+	GLsizei numShaders = 0;
 
 	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	glGetAttachedShaders(program, 2, &numShaders, shaders);
 
 	if(!linked) {
+		for(GLsizei i = 0; i < numShaders; i++) {
+			GLint compiled = 0;
+			glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+			if(!compiled)
+				HelperFunctions::printShaderLog(shaders[i]);
+		}
+
 		GLint infoLen = 0;
 		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
 		if(infoLen > 1) {
@@ -526,25 +551,82 @@ GLuint Scene::loadShader(const Shader& s)
 		}
 
 		glDeleteProgram(program);
-		throw std::runtime_error("Error initialising 3D");
+		return false;
 	}
 
+	// programs loaded from the cache have no shaders and are stored
+	// already
+	if(numShaders) {
+		mProgramCache->store(ProgramCache::hash(s.vertexShader, s.fragmentShader, s.attribs), program);
+		for(GLsizei i = 0; i < numShaders; i++)
+			glDetachShader(program, shaders[i]);
+	}
+
+	// the name may have belonged to a program deleted by a reload
+	auto& uniforms = mUniformLocationMap[program];
+	uniforms.clear();
 	for(auto& p : s.uniforms) {
-		mUniformLocationMap[program][p] = glGetUniformLocation(program, p);
+		uniforms[p] = glGetUniformLocation(program, p);
 	}
 
-	return program;
+	return true;
+}
+
+ShaderVariants* Scene::createVariants(const Shader& s, uint32_t usedFeatures)
+{
+	ShaderVariants::Linker linker;
+	linker.begin = [this, s] (const char* vs, const char* fs) {
+		Shader variant = s;
+		variant.vertexShader = vs;
+		variant.fragmentShader = fs;
+		return startProgram(variant);
+	};
+	linker.finish = [this, s] (GLuint program, const char* vs, const char* fs) {
+		Shader variant = s;
+		variant.vertexShader = vs;
+		variant.fragmentShader = fs;
+		return finishProgram(program, variant);
+	};
+	return new ShaderVariants(s.vertexShader, s.fragmentShader, usedFeatures, linker);
+}
+
+SceneSnapshot::SceneSnapshot()
+	: camera(InstanceTransform::make(Vector3(), Matrix44::Identity, Vector3(1, 1, 1))),
+	ambientLight(Color::White, false),
+	directionalLight(Vector3(1, 0, 0), Color::White, false),
+	pointLight(Vector3(), Vector3(), Color::White, false)
+{
 }
 
-Scene::Scene(float screenWidth, float screenHeight)
+Scene::Scene(float screenWidth, float screenHeight, unsigned int workerThreads)
 	: mScreenWidth(screenWidth),
 	mScreenHeight(screenHeight),
+	mProgramCache(new ProgramCache()),
+	mShaderWatcher(new FileWatcher()),
+	mTextureLoader(new TextureLoader()),
+	mMeshBuffer(new MeshBuffer()),
 	mAmbientLight(Color::White, false),
 	mDirectionalLight(Vector3(1, 0, 0), Color::White, false),
 	mPointLight(Vector3(), Vector3(), Color::White, false),
+	mInstances(new InstanceStore()),
+	mHierarchy(new TransformHierarchy(mInstances.get())),
 	mFOV(90.0f),
 	mZFar(200.0f),
-	mClearColor(0, 0, 0)
+	mClearColor(0, 0, 0),
+	mProfiler(new FrameProfiler()),
+	mValidation(new GLValidation()),
+	mJobs(new JobSystem(workerThreads)),
+	mDynamicBuffer(new DynamicBuffer()),
+	mInstanceBuffer(new InstanceBuffer()),
+	mMultiDraw(new MultiDraw()),
+	mTextureResidency(new TextureResidency(mJobs.get())),
+	mShadows(new CascadedShadowMap()),
+	mOcclusion(new OcclusionQueries()),
+	mSimulationTransforms(new InstanceTransformTable()),
+	mStates(new TripleBuffer<SceneSnapshot>()),
+	mRenderAmbientLight(mAmbientLight),
+	mRenderDirectionalLight(mDirectionalLight),
+	mRenderPointLight(mPointLight)
 {
 }
 
@@ -565,44 +647,96 @@ void Scene::init()
 	printf("%-20s: %s\n", "GL version", glGetString(GL_VERSION));
 	printf("%-20s: %s\n", "GLSL version", glGetString(GL_SHADING_LANGUAGE_VERSION));
 
-	Shader scene;
-	scene.vertexShader = scene_vert;
-	scene.fragmentShader = scene_frag;
-	scene.uniforms = {
-		"u_MVP",
-		"u_inverseMVP",
-		"s_texture",
-		"u_ambientLight",
-		"u_directionalLightDirection",
-		"u_directionalLightColor",
-		"u_pointLightPosition",
-		"u_pointLightAttenuation",
-		"u_pointLightColor",
-		"u_ambientLightEnabled",
-		"u_directionalLightEnabled",
-		"u_pointLightEnabled"
-	};
+	mProgramCache->init();
+	mTextureLoader->init();
 
-	scene.attribs = {
-		{ Drawable::VERTEX_POS_INDEX, "a_Position" },
-		{ Drawable::TEXCOORD_INDEX, "a_texCoord" },
-		{ Drawable::NORMAL_INDEX, "a_Normal" }
+	// the per instance attributes are only used by the instanced
+	// variants
+	const std::vector<std::pair<GLuint, const char*>> instanceAttribs = {
+		{ InstanceBuffer::WORLD_INDEX, "a_World" },
+		{ InstanceBuffer::NORMAL_MATRIX_INDEX, "a_NormalMatrix" }
 	};
 
-	mSceneProgram = loadShader(scene);
+	// lets the driver compile shaders on its own threads; a program is
+	// then only waited for when first used
+	if(GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if(GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
 
-	Shader line;
-	line.vertexShader = line_vert;
-	line.fragmentShader = line_frag;
-	line.uniforms = {
-		"u_MVP"
-	};
+	// the scene and depth programs are compiled per feature combination
+	// when first drawn with
+	{
+		Shader scene;
+		scene.vertexShader = scene_vert;
+		scene.fragmentShader = scene_frag;
+		scene.uniforms = {
+			"u_viewProjection",
+			"u_world",
+			"u_normalMatrix",
+			"s_texture",
+			"u_ambientLight",
+			"u_directionalLightDirection",
+			"u_directionalLightColor",
+			"u_pointLightPosition",
+			"u_pointLightAttenuation",
+			"u_pointLightColor",
+			"s_shadowMap",
+			"u_shadowMatrix",
+			"u_cascadeSplits",
+			"u_numCascades",
+			"u_pcfRadius",
+			"u_shadowTexelSize"
+		};
 
-	line.attribs = {
-		{ Line::VERTEX_POS_INDEX, "a_Position" },
-		{ Line::COLOR_INDEX, "a_Color" }
-	};
-	mLineProgram = loadShader(line);
+		scene.attribs = {
+			{ Drawable::VERTEX_POS_INDEX, "a_Position" },
+			{ Drawable::TEXCOORD_INDEX, "a_texCoord" },
+			{ Drawable::NORMAL_INDEX, "a_Normal" },
+			{ Drawable::COLOR_INDEX, "a_Color" }
+		};
+		scene.attribs.insert(scene.attribs.end(), instanceAttribs.begin(), instanceAttribs.end());
+		mSceneVariants.reset(createVariants(scene,
+					ShaderAmbientLight | ShaderDirectionalLight | ShaderPointLight |
+					ShaderShadows | ShaderAlphaTest | ShaderVertexColor | ShaderInstancing));
+	}
+
+	{
+		Shader depth;
+		depth.vertexShader = depth_vert;
+		depth.fragmentShader = depth_frag;
+		depth.uniforms = {
+			"u_viewProjection",
+			"u_world",
+			"s_texture"
+		};
+
+		depth.attribs = {
+			{ Drawable::VERTEX_POS_INDEX, "a_Position" },
+			{ Drawable::TEXCOORD_INDEX, "a_texCoord" },
+			{ Drawable::COLOR_INDEX, "a_Color" }
+		};
+		depth.attribs.insert(depth.attribs.end(), instanceAttribs.begin(), instanceAttribs.end());
+		mDepthVariants.reset(createVariants(depth,
+					ShaderAlphaTest | ShaderVertexColor | ShaderInstancing));
+	}
+
+	// the rest have a single variant, built here
+	{
+		Shader line;
+		line.vertexShader = line_vert;
+		line.fragmentShader = line_frag;
+		line.uniforms = {
+			"u_MVP"
+		};
+
+		line.attribs = {
+			{ Line::VERTEX_POS_INDEX, "a_Position" },
+			{ Line::COLOR_INDEX, "a_Color" }
+		};
+		mLineVariants.reset(createVariants(line, 0));
+		mLineVariants->get(0);
+	}
 
 	{
 		Shader overlay;
@@ -617,7 +751,24 @@ void Scene::init()
 			{ Overlay::VERTEX_POS_INDEX, "a_Position" },
 			{ Overlay::TEXCOORD_INDEX, "a_texCoord" }
 		};
-		mOverlayProgram = loadShader(overlay);
+		mOverlayVariants.reset(createVariants(overlay, 0));
+		mOverlayVariants->get(0);
+	}
+
+	{
+		Shader shadow;
+		shadow.vertexShader = shadow_vert;
+		shadow.fragmentShader = shadow_frag;
+		shadow.uniforms = {
+			"u_viewProjection",
+			"u_world"
+		};
+
+		shadow.attribs = {
+			{ Drawable::VERTEX_POS_INDEX, "a_Position" }
+		};
+		shadow.attribs.insert(shadow.attribs.end(), instanceAttribs.begin(), instanceAttribs.end());
+		mShadowVariants.reset(createVariants(shadow, ShaderInstancing));
 	}
 
 	HelperFunctions::enableDepthTest();
@@ -625,16 +776,81 @@ void Scene::init()
 
 	glViewport(0, 0, mScreenWidth, mScreenHeight);
 
-	glUseProgram(mSceneProgram);
+	if(mProgramCache->isEnabled()) {
+		printf("%-20s: %u hits, %u misses\n", "Program cache",
+				mProgramCache->getHits(), mProgramCache->getMisses());
+	}
+
+	mProfiler->init();
+	mProfiler->setPixelCount(mScreenWidth * mScreenHeight);
+	mValidation->init();
+	mShadows->init();
+	mOcclusion->init();
+	mMeshBuffer->init();
+	mDynamicBuffer->init(1 << 20);
+	mInstanceBuffer->init(mDynamicBuffer.get());
+	mMultiDraw->init(mDynamicBuffer.get());
+
+	// the most common variant, which also finds errors in the shader
+	// sources early
+	mSceneVariants->get(ShaderAmbientLight | ShaderDirectionalLight | ShaderAlphaTest |
+			(mInstanceBuffer->isSupported() ? ShaderInstancing : 0));
+	mShadowVariants->get(mInstanceBuffer->isSupported() ? ShaderInstancing : 0);
 }
 
-boost::shared_ptr<Common::Texture> Scene::getModelTexture(const std::string& mname) const
+void Scene::setProgramCacheDirectory(const std::string& directory)
 {
-	auto it = mMeshInstanceTextures.find(mname);
-	if(it == mMeshInstanceTextures.end()) {
-		throw std::runtime_error("Couldn't find texture for model");
-	} else {
-		return it->second;
+	mProgramCache->setDirectory(directory);
+}
+
+void Scene::setTextureCacheDirectory(const std::string& directory)
+{
+	mTextureLoader->setCacheDirectory(directory);
+}
+
+void Scene::setShaderReloadDirectory(const std::string& directory)
+{
+	mShaderWatcher->watch(directory);
+}
+
+void Scene::reloadShaders()
+{
+	if(!mShaderWatcher->isWatching())
+		return;
+
+	const struct {
+		ShaderVariants* variants;
+		const char* vertexFile;
+		const char* fragmentFile;
+	} sources[] = {
+		{ mSceneVariants.get(), "scene.vert", "scene.frag" },
+		{ mDepthVariants.get(), "depth.vert", "depth.frag" },
+		{ mLineVariants.get(), "line.vert", "line.frag" },
+		{ mOverlayVariants.get(), "overlay.vert", "overlay.frag" },
+		{ mShadowVariants.get(), "shadow.vert", "shadow.frag" }
+	};
+
+	std::vector<std::string> changed = mShaderWatcher->poll();
+	for(const auto& src : sources) {
+		if(std::find(changed.begin(), changed.end(), src.vertexFile) == changed.end() &&
+				std::find(changed.begin(), changed.end(), src.fragmentFile) == changed.end())
+			continue;
+
+		std::string vs;
+		std::string fs;
+		const std::string dir = mShaderWatcher->getDirectory() + "/";
+		if(!HelperFunctions::readFile(dir + src.vertexFile, vs) ||
+				!HelperFunctions::readFile(dir + src.fragmentFile, fs)) {
+			std::cerr << "Unable to read " << src.vertexFile << " or " << src.fragmentFile << ".\n";
+			continue;
+		}
+		printf("Reloading %s and %s\n", src.vertexFile, src.fragmentFile);
+		src.variants->reload(vs, fs);
+	}
+
+	for(const auto& src : sources) {
+		if(src.variants->update())
+			printf("Reloaded %s and %s\n", src.vertexFile, src.fragmentFile);
 	}
 }
 
@@ -663,172 +879,811 @@ PointLight& Scene::getPointLight()
 	return mPointLight;
 }
 
-void Scene::calculateModelMatrix(const MeshInstance& mi)
+bool Scene::updateFrameMatrices(const Camera& cam)
+{
+	if(!mProjectionDirty && mCameraVersion == cam.getTransformVersion())
+		return false;
+
+	mPerspectiveMatrix = HelperFunctions::perspectiveMatrix(mFOV, mScreenWidth, mScreenHeight, mZFar);
+	auto camrot = HelperFunctions::cameraRotationMatrix(cam.getTargetVector(), cam.getUpVector());
+	auto camtrans = HelperFunctions::translationMatrix(cam.getPosition().negated());
+	mViewMatrix = camtrans * camrot;
+	TransformKernels::multiply(mViewMatrix.m, mPerspectiveMatrix.m, mViewProjectionMatrix.m);
+
+	mCameraVersion = cam.getTransformVersion();
+	mProjectionDirty = false;
+	return true;
+}
+
+Common::Matrix44 Scene::getOrthoMVP(const Overlay& ov) const
+{
+	return HelperFunctions::scaleMatrix(Common::Vector3(ov.getW(), ov.getH(), 1.0f)) *
+			HelperFunctions::translationMatrix(Common::Vector3(ov.getX() - mScreenWidth * 0.5f,
+						ov.getY() - mScreenHeight * 0.5f, ov.getDepth())) *
+			HelperFunctions::orthoMatrix(mScreenWidth, mScreenHeight);
+}
+
+// bounding sphere of the drawable in world space; the radius is scaled
+// by the largest axis scale
+static float worldBoundingSphere(const Drawable& d, const float* world, float* center)
 {
-	auto translation = HelperFunctions::translationMatrix(mi.getPosition());
-	auto rotation = mi.getRotation();
-	auto scale = HelperFunctions::scaleMatrix(mi.getScale());
-	mModelMatrix = scale * rotation * translation;
+	const float* sphere = d.getBoundingSphere();
+	float scale = 0.0f;
+	for(int c = 0; c < 3; c++) {
+		center[c] = sphere[0] * world[c] + sphere[1] * world[4 + c] +
+			sphere[2] * world[8 + c] + world[12 + c];
+		scale = std::max(scale, world[c * 4] * world[c * 4] +
+				world[c * 4 + 1] * world[c * 4 + 1] +
+				world[c * 4 + 2] * world[c * 4 + 2]);
+	}
+	return sphere[3] * std::sqrt(scale);
+}
 
-	auto invTranslation(translation);
-	invTranslation.m[3] = -invTranslation.m[3];
-	invTranslation.m[7] = -invTranslation.m[7];
-	invTranslation.m[11] = -invTranslation.m[11];
+void Scene::prepareInstances(CommandChunk& chunk, size_t begin, size_t end, const Frustum& frustum) const
+{
+	const float* vp = mViewProjectionMatrix.m;
+	// pixels per unit of size at unit depth
+	const float pixelScale = mPerspectiveMatrix.m[5] * mScreenHeight * 0.5f;
+	for(size_t i = begin; i < end; i++) {
+		const float* world = mInstances->getWorldMatrix(i);
+		const Drawable* d = mInstances->getDrawable(i);
 
-	auto invRotation = rotation.transposed();
+		float center[3];
+		float radius = worldBoundingSphere(*d, world, center);
+		if(!frustum.intersectsSphere(center, radius)) {
+			chunk.culled++;
+			continue;
+		}
 
-	auto invScale = scale;
-	invScale.m[0] = 1.0f / invScale.m[0];
-	invScale.m[5] = 1.0f / invScale.m[5];
-	invScale.m[10] = 1.0f / invScale.m[10];
+		// clip space w
+		float depth = center[0] * vp[3] + center[1] * vp[7] + center[2] * vp[11] + vp[15];
+		if(mOcclusionCulling && !prepareOcclusionTest(chunk, i, depth)) {
+			chunk.occluded++;
+			continue;
+		}
 
-	mInverseModelMatrix = invTranslation * invRotation * invScale;
+		auto flags = mInstances->getFlags(i);
+		auto& cmds = (flags & InstanceBlending) ? chunk.blended : chunk.opaque;
+		cmds.emplace_back();
+		auto& cmd = cmds.back();
+		cmd.drawable = d;
+		cmd.texture = mInstances->getTexture(i);
+		cmd.flags = flags & (InstanceBackfaceCulling | InstanceBlending | InstanceAlphaTest);
+		cmd.sortKey = (uint64_t(cmd.texture) << 33) |
+			(uint64_t(flags & InstanceBackfaceCulling) << 32) |
+			uint32_t(uintptr_t(d));
+		cmd.depth = depth;
+		// a sphere around the camera covers the screen
+		cmd.screenSize = depth > radius ? 2.0f * radius * pixelScale / depth : FLT_MAX;
+		std::copy(world, world + 16, cmd.world);
+		// the upper 3x3 of the inverse, transposed
+		const float* inverse = mInstances->getInverseWorldMatrix(i);
+		for(int r = 0; r < 3; r++) {
+			for(int c = 0; c < 3; c++)
+				cmd.normalMatrix[r * 3 + c] = inverse[c * 4 + r];
+		}
+		cmd.name = mInstances->getName(i);
+	}
 }
 
-void Scene::updateMVPMatrix(const MeshInstance& mi)
+// boxes closer than this to the camera are not tested
+static const float OcclusionNearDistance = 1.0f;
+
+bool Scene::prepareOcclusionTest(CommandChunk& chunk, size_t i, float depth) const
 {
-	calculateModelMatrix(mi);
-	auto mvp = mModelMatrix * mViewMatrix * mPerspectiveMatrix;
-	auto imvp = mInverseModelMatrix;
+	const float* world = mInstances->getWorldMatrix(i);
+	const float* box = mInstances->getDrawable(i)->getBoundingBox();
 
-	glUniformMatrix4fv(mUniformLocationMap[mSceneProgram]["u_MVP"], 1, GL_FALSE, mvp.m);
-	glUniformMatrix4fv(mUniformLocationMap[mSceneProgram]["u_inverseMVP"], 1, GL_FALSE, imvp.m);
+	// a box reaching the near plane would be clipped and might seem
+	// hidden, so those are always drawn. The test uses the half
+	// diagonal of the box scaled by the largest axis scale.
+	float scale = 0.0f;
+	float diagonal = 0.0f;
+	for(int c = 0; c < 3; c++) {
+		scale = std::max(scale, world[c * 4] * world[c * 4] +
+				world[c * 4 + 1] * world[c * 4 + 1] +
+				world[c * 4 + 2] * world[c * 4 + 2]);
+		diagonal += (box[3 + c] - box[c]) * (box[3 + c] - box[c]);
+	}
+	if(depth - 0.5f * std::sqrt(diagonal * scale) < OcclusionNearDistance)
+		return true;
+
+	auto h = mInstances->getHandle(i);
+	if(mOcclusion->canQuery(h)) {
+		// unit cube to the box, then to world space
+		float boxMatrix[16] = {
+			box[3] - box[0], 0, 0, 0,
+			0, box[4] - box[1], 0, 0,
+			0, 0, box[5] - box[2], 0,
+			box[0], box[1], box[2], 1
+		};
+		chunk.occlusionTests.emplace_back();
+		auto& test = chunk.occlusionTests.back();
+		test.instance = h;
+		TransformKernels::multiply(boxMatrix, world, test.world);
+	}
+	return mOcclusion->isVisible(h);
 }
 
-void Scene::updateFrameMatrices(const Camera& cam)
+// the features a draw needs from the shader besides the lights
+static uint32_t materialFeatures(const DrawCommand& cmd, bool instancing)
 {
-	mPerspectiveMatrix = HelperFunctions::perspectiveMatrix(mFOV, mScreenWidth, mScreenHeight, mZFar);
-	auto camrot = HelperFunctions::cameraRotationMatrix(cam.getTargetVector(), cam.getUpVector());
-	auto camtrans = HelperFunctions::translationMatrix(cam.getPosition().negated());
-	mViewMatrix = camtrans * camrot;
+	return ((cmd.flags & InstanceAlphaTest) ? ShaderAlphaTest : 0) |
+		(cmd.drawable->hasVertexColors() ? ShaderVertexColor : 0) |
+		(instancing ? ShaderInstancing : 0);
 }
 
-Common::Matrix44 Scene::getOrthoMVP(const Overlay& ov) const
+void Scene::drawBatch(const DrawBatch& batch, bool instancing, bool indirect, FrameStats& stats)
 {
-	return HelperFunctions::scaleMatrix(Common::Vector3(ov.getW(), ov.getH(), 1.0f)) *
-			HelperFunctions::translationMatrix(Common::Vector3(ov.getX() - mScreenWidth * 0.5f,
-						ov.getY() - mScreenHeight * 0.5f, ov.getDepth())) *
-			HelperFunctions::orthoMatrix(mScreenWidth, mScreenHeight);
+	const auto& d = *batch.command->drawable;
+	const unsigned int triangles = (d.getNumIndices() != 0 ? d.getNumIndices() : d.getNumVertices()) / 3;
+	if(indirect) {
+		// drawn by the next flush
+		mMultiDraw->add(mMeshBuffer->getMesh(d.getMesh()), batch.count, batch.firstInstance);
+		stats.triangles += triangles * batch.count;
+		return;
+	}
+	if(instancing) {
+		mInstanceBuffer->bind(batch.firstInstance);
+		stats.bufferBinds++;
+		mMeshBuffer->drawInstanced(d.getMesh(), batch.count);
+		stats.triangles += triangles * batch.count;
+	} else {
+		mMeshBuffer->draw(d.getMesh());
+		stats.triangles += triangles;
+	}
+	stats.drawCalls++;
 }
 
-void Scene::render()
+void Scene::drawDepthPrepass(FrameStats& stats)
 {
-	glClearColor(mClearColor.r / 256.0f, mClearColor.g / 256.0f, mClearColor.b / 256.0f, 1.0f);
+	const bool instancing = mInstanceBuffer->isSupported();
+	const bool indirect = instancing && mMultiDraw->isSupported();
+
+	glActiveTexture(GL_TEXTURE0);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable(GL_BLEND);
+	glEnableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	glEnableVertexAttribArray(Drawable::TEXCOORD_INDEX);
+	if(instancing)
+		mInstanceBuffer->enable();
+	if(indirect) {
+		// the base instance of each draw picks its instances
+		mInstanceBuffer->bind(0);
+		stats.bufferBinds++;
+	}
+	stats.stateChanges += 2;
+
+	// the same batches as in the shading pass so that both produce the
+	// same fragments
+	std::vector<GLuint> programs;
+	GLuint program = 0;
+	GLint worldLoc = -1;
+	bool first = true;
+	bool colors = false;
+	uint32_t texture = 0;
+	uint32_t flags = 0;
+	MeshBinding mesh;
+	for(const auto& batch : mCommands.getOpaqueBatches()) {
+		const auto& cmd = *batch.command;
+		mValidation->setCurrentObject(cmd.name);
+
+		// the vertex colors only matter to the alpha test here
+		uint32_t features = materialFeatures(cmd, instancing);
+		if(!(features & ShaderAlphaTest))
+			features &= ~ShaderVertexColor;
+		GLuint p = mDepthVariants->get(features);
+
+		// a multi draw only spans batches that change no state
+		const auto& d = *cmd.drawable;
+		const uint32_t attributes = MeshPosition | MeshTexCoord | MeshColor;
+		if(indirect && (p != program || ((features & ShaderAlphaTest) && cmd.texture != texture) ||
+					(cmd.flags & InstanceBackfaceCulling) != (flags & InstanceBackfaceCulling) ||
+					!mMeshBuffer->isBound(d.getMesh(), attributes, mesh) ||
+					d.hasVertexColors() != colors))
+			mMultiDraw->flush(stats);
+
+		if(p != program) {
+			auto& uniforms = mUniformLocationMap[p];
+			glUseProgram(p);
+			stats.stateChanges++;
+			if(std::find(programs.begin(), programs.end(), p) == programs.end()) {
+				glUniform1i(uniforms["s_texture"], 0);
+				glUniformMatrix4fv(uniforms["u_viewProjection"], 1, GL_FALSE, mViewProjectionMatrix.m);
+				stats.uniformUploads += 2;
+				stats.bytesUploaded += sizeof(GLint) + 16 * sizeof(GLfloat);
+				programs.push_back(p);
+			}
+			worldLoc = uniforms["u_world"];
+			program = p;
+		}
+
+		if((features & ShaderAlphaTest) && (first || cmd.texture != texture)) {
+			glBindTexture(GL_TEXTURE_2D, cmd.texture);
+			texture = cmd.texture;
+			stats.textureBinds++;
+			stats.stateChanges++;
+		}
+		if(first || (cmd.flags & InstanceBackfaceCulling) != (flags & InstanceBackfaceCulling)) {
+			if(cmd.flags & InstanceBackfaceCulling) {
+				glCullFace(GL_BACK);
+				glEnable(GL_CULL_FACE);
+			} else {
+				glDisable(GL_CULL_FACE);
+			}
+			stats.stateChanges++;
+		}
+		flags = cmd.flags;
+		first = false;
 
-	glUseProgram(mSceneProgram);
-	glUniform1i(mUniformLocationMap[mSceneProgram]["u_ambientLightEnabled"], mAmbientLight.isOn());
-	glUniform1i(mUniformLocationMap[mSceneProgram]["u_directionalLightEnabled"], mDirectionalLight.isOn());
-	glUniform1i(mUniformLocationMap[mSceneProgram]["u_pointLightEnabled"], mPointLight.isOn());
+		if(mMeshBuffer->bind(d.getMesh(), attributes, mesh)) {
+			stats.bufferBinds += 2;
+			stats.stateChanges += d.hasVertexColors() ? 3 : 2;
+		}
+		if(d.hasVertexColors() != colors) {
+			if(d.hasVertexColors())
+				glEnableVertexAttribArray(Drawable::COLOR_INDEX);
+			else
+				glDisableVertexAttribArray(Drawable::COLOR_INDEX);
+			colors = d.hasVertexColors();
+			stats.stateChanges++;
+		}
+
+		if(!instancing) {
+			glUniformMatrix4fv(worldLoc, 1, GL_FALSE, cmd.world);
+			stats.uniformUploads++;
+			stats.bytesUploaded += 16 * sizeof(GLfloat);
+		}
 
-	updateFrameMatrices(mDefaultCamera);
+		drawBatch(batch, instancing, indirect, stats);
+		CHECK_GL_ERROR(*mValidation);
+	}
+	if(indirect) {
+		mMultiDraw->flush(stats);
+		CHECK_GL_ERROR(*mValidation);
+	}
 
-	if(mPointLight.isOn()) {
-		auto at = mPointLight.getAttenuation();
-		auto col = mPointLight.getColor();
-		glUniform3f(mUniformLocationMap[mSceneProgram]["u_pointLightAttenuation"], at.x, at.y, at.z);
-		glUniform3f(mUniformLocationMap[mSceneProgram]["u_pointLightColor"], col.x, col.y, col.z);
+	glDisableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	glDisableVertexAttribArray(Drawable::TEXCOORD_INDEX);
+	if(colors)
+		glDisableVertexAttribArray(Drawable::COLOR_INDEX);
+	if(instancing)
+		mInstanceBuffer->disable();
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Scene::drawOcclusionTests(FrameStats& stats)
+{
+	const GLuint program = mShadowVariants->get(0);
+	auto& uniforms = mUniformLocationMap[program];
+	const GLint worldLoc = uniforms["u_world"];
+
+	// the boxes only test the depth, from both sides
+	glUseProgram(program);
+	glUniformMatrix4fv(uniforms["u_viewProjection"], 1, GL_FALSE, mViewProjectionMatrix.m);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+	glEnableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	mOcclusion->bindBox(Drawable::VERTEX_POS_INDEX);
+	stats.stateChanges += 5;
+	stats.bufferBinds++;
+	stats.uniformUploads++;
+	stats.bytesUploaded += 16 * sizeof(GLfloat);
+
+	mValidation->setCurrentObject(nullptr);
+	for(unsigned int i = 0; i < mCommands.getNumChunks(); i++) {
+		for(const auto& test : mCommands.getChunk(i).occlusionTests) {
+			glUniformMatrix4fv(worldLoc, 1, GL_FALSE, test.world);
+			mOcclusion->beginQuery(test.instance);
+			mOcclusion->drawBox();
+			mOcclusion->endQuery();
+			stats.uniformUploads++;
+			stats.bytesUploaded += 16 * sizeof(GLfloat);
+			stats.occlusionQueries++;
+		}
+	}
+	CHECK_GL_ERROR(*mValidation);
+
+	glDisableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Scene::prepareCommands()
+{
+	// small chunks so that the workers stay evenly loaded
+	const size_t chunkSize = 256;
+	size_t n = mInstances->size();
+	unsigned int numChunks = (n + chunkSize - 1) / chunkSize;
+	mCommands.reset(numChunks);
+
+	Frustum frustum(mViewProjectionMatrix);
+	mJobs->parallelFor(0, n, chunkSize, [&] (size_t b, size_t e) {
+		auto& chunk = mCommands.getChunk(b / chunkSize);
+		prepareInstances(chunk, b, e, frustum);
+		chunk.sort();
+	});
+}
+
+void Scene::setSceneUniforms(GLuint program, FrameStats& stats)
+{
+	auto& uniforms = mUniformLocationMap[program];
+	const auto& ambientLight = *mFrameAmbientLight;
+	const auto& directionalLight = *mFrameDirectionalLight;
+	const auto& pointLight = *mFramePointLight;
+
+	// samplers of different types must not share a unit even if unused
+	glUniform1i(uniforms["s_texture"], 0);
+	glUniform1i(uniforms["s_shadowMap"], 1);
+	glUniformMatrix4fv(uniforms["u_viewProjection"], 1, GL_FALSE, mViewProjectionMatrix.m);
+	stats.uniformUploads += 3;
+	stats.bytesUploaded += 2 * sizeof(GLint) + 16 * sizeof(GLfloat);
+
+	if(mFrameFeatures & ShaderShadows) {
+		unsigned int numCascades = mShadows->getNumCascades();
+		GLfloat matrices[ShadowSettings::MaxCascades * 16];
+		GLfloat splits[ShadowSettings::MaxCascades] = { 0.0f };
+		for(unsigned int c = 0; c < numCascades; c++) {
+			std::copy(mShadows->getShadowMatrix(c).m, mShadows->getShadowMatrix(c).m + 16,
+					matrices + c * 16);
+			splits[c] = mShadows->getSplits()[c];
+		}
+		glUniformMatrix4fv(uniforms["u_shadowMatrix"], numCascades, GL_FALSE, matrices);
+		glUniform4fv(uniforms["u_cascadeSplits"], 1, splits);
+		glUniform1i(uniforms["u_numCascades"], numCascades);
+		glUniform1i(uniforms["u_pcfRadius"], mShadows->getSettings().pcfRadius);
+		glUniform2f(uniforms["u_shadowTexelSize"], 1.0f / mShadows->getTextureWidth(),
+				1.0f / mShadows->getTextureHeight());
+		stats.uniformUploads += 5;
+		stats.bytesUploaded += (numCascades * 16 + 4 + 2) * sizeof(GLfloat) + 2 * sizeof(GLint);
 	}
 
-	if(mDirectionalLight.isOn()) {
-		auto col = mDirectionalLight.getColor();
-		glUniform3f(mUniformLocationMap[mSceneProgram]["u_directionalLightColor"], col.x, col.y, col.z);
+	// the lights are in world space, so they are uploaded once per frame
+	if(mFrameFeatures & ShaderPointLight) {
+		auto pos = pointLight.getPosition();
+		auto at = pointLight.getAttenuation();
+		auto col = pointLight.getColor();
+		glUniform3f(uniforms["u_pointLightPosition"], pos.x, pos.y, pos.z);
+		glUniform3f(uniforms["u_pointLightAttenuation"], at.x, at.y, at.z);
+		glUniform3f(uniforms["u_pointLightColor"], col.x, col.y, col.z);
+		stats.uniformUploads += 3;
+		stats.bytesUploaded += 9 * sizeof(GLfloat);
 	}
 
-	if(mAmbientLight.isOn()) {
-		auto col = mAmbientLight.getColor();
-		glUniform3f(mUniformLocationMap[mSceneProgram]["u_ambientLight"], col.x, col.y, col.z);
+	if(mFrameFeatures & ShaderDirectionalLight) {
+		auto dir = directionalLight.getDirection();
+		auto col = directionalLight.getColor();
+		glUniform3f(uniforms["u_directionalLightDirection"], dir.x, dir.y, dir.z);
+		glUniform3f(uniforms["u_directionalLightColor"], col.x, col.y, col.z);
+		stats.uniformUploads += 2;
+		stats.bytesUploaded += 6 * sizeof(GLfloat);
 	}
 
-	for(const auto& mi : mMeshInstances) {
-		/* TODO: add support for vertex colors. */
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, getModelTexture(mi.first)->getTexture());
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glUniform1i(mUniformLocationMap[mSceneProgram]["s_texture"], 0);
-
-		updateMVPMatrix(*mi.second);
-
-		if(mPointLight.isOn()) {
-			// inverse translation matrix
-			Vector3 plpos(mPointLight.getPosition());
-			Vector3 plposrel = mi.second->getPosition() - plpos;
-			glUniform3f(mUniformLocationMap[mSceneProgram]["u_pointLightPosition"],
-					plposrel.x, plposrel.y, plposrel.z);
+	if(mFrameFeatures & ShaderAmbientLight) {
+		auto col = ambientLight.getColor();
+		glUniform3f(uniforms["u_ambientLight"], col.x, col.y, col.z);
+		stats.uniformUploads++;
+		stats.bytesUploaded += 3 * sizeof(GLfloat);
+	}
+}
+
+void Scene::submitCommands(FrameStats& stats, bool blended)
+{
+	const bool instancing = mInstanceBuffer->isSupported();
+	// the blended draws must stay in order
+	const bool indirect = instancing && !blended && mMultiDraw->isSupported();
+
+	glActiveTexture(GL_TEXTURE0);
+	glEnableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	glEnableVertexAttribArray(Drawable::TEXCOORD_INDEX);
+	glEnableVertexAttribArray(Drawable::NORMAL_INDEX);
+	if(instancing)
+		mInstanceBuffer->enable();
+	if(indirect) {
+		// the base instance of each draw picks its instances
+		mInstanceBuffer->bind(0);
+		stats.bufferBinds++;
+	}
+
+	// only state that differs from the previous draw is set
+	bool first = true;
+	bool colors = false;
+	GLuint program = 0;
+	GLint worldLoc = -1;
+	GLint normalMatrixLoc = -1;
+	uint32_t texture = 0;
+	uint32_t flags = 0;
+	MeshBinding mesh;
+
+	const auto& batches = blended ? mCommands.getBlendedBatches() : mCommands.getOpaqueBatches();
+	for(const auto& batch : batches) {
+		const auto& cmd = *batch.command;
+		mValidation->setCurrentObject(cmd.name);
+
+		// one variant per material; its per frame uniforms are set when
+		// it is first used in the frame
+		GLuint p = mSceneVariants->get(mFrameFeatures | materialFeatures(cmd, instancing));
+
+		// a multi draw only spans batches that change no state
+		const auto& d = *cmd.drawable;
+		const uint32_t attributes = MeshPosition | MeshTexCoord | MeshNormal | MeshColor;
+		if(indirect && (p != program || cmd.texture != texture || cmd.flags != flags ||
+					!mMeshBuffer->isBound(d.getMesh(), attributes, mesh) ||
+					d.hasVertexColors() != colors))
+			mMultiDraw->flush(stats);
+
+		if(p != program) {
+			glUseProgram(p);
+			stats.stateChanges++;
+			if(std::find(mFramePrograms.begin(), mFramePrograms.end(), p) == mFramePrograms.end()) {
+				setSceneUniforms(p, stats);
+				mFramePrograms.push_back(p);
+			}
+			// look the uniform locations up once rather than per instance
+			auto& uniforms = mUniformLocationMap[p];
+			worldLoc = uniforms["u_world"];
+			normalMatrixLoc = uniforms["u_normalMatrix"];
+			program = p;
 		}
 
-		if(mDirectionalLight.isOn()) {
-			// inverse rotation matrix (normal matrix)
-			Vector3 dir = mDirectionalLight.getDirection();
-			glUniform3f(mUniformLocationMap[mSceneProgram]["u_directionalLightDirection"], dir.x, dir.y, dir.z);
+		if(first || cmd.texture != texture) {
+			glBindTexture(GL_TEXTURE_2D, cmd.texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			texture = cmd.texture;
+			stats.textureBinds++;
+			stats.stateChanges++;
 		}
 
-		const auto& d = mi.second->getDrawable();
-		if(mi.second->useBlending()) {
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		} else {
-			glDisable(GL_BLEND);
+		if(!instancing) {
+			glUniformMatrix4fv(worldLoc, 1, GL_FALSE, cmd.world);
+			glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, cmd.normalMatrix);
+			stats.uniformUploads += 2;
+			stats.bytesUploaded += (16 + 9) * sizeof(GLfloat);
 		}
 
-		if(mi.second->useBackfaceCulling()) {
-			glCullFace(GL_BACK);
-			glEnable(GL_CULL_FACE);
-		} else {
-			glDisable(GL_CULL_FACE);
+		if(first || (cmd.flags & InstanceBlending) != (flags & InstanceBlending)) {
+			if(cmd.flags & InstanceBlending) {
+				glEnable(GL_BLEND);
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			} else {
+				glDisable(GL_BLEND);
+			}
+			stats.stateChanges++;
 		}
 
-		const auto& ib = d.getIndexBuffer();
-		if(d.getNumIndices() != 0) {
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib);
+		if(first || (cmd.flags & InstanceBackfaceCulling) != (flags & InstanceBackfaceCulling)) {
+			if(cmd.flags & InstanceBackfaceCulling) {
+				glCullFace(GL_BACK);
+				glEnable(GL_CULL_FACE);
+			} else {
+				glDisable(GL_CULL_FACE);
+			}
+			stats.stateChanges++;
 		}
+		flags = cmd.flags;
+		first = false;
 
-		glEnableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
-		glEnableVertexAttribArray(Drawable::TEXCOORD_INDEX);
-		glEnableVertexAttribArray(Drawable::NORMAL_INDEX);
-		glBindBuffer(GL_ARRAY_BUFFER, d.getVertexBuffer());
-		glVertexAttribPointer(Drawable::VERTEX_POS_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glBindBuffer(GL_ARRAY_BUFFER, d.getTexCoordBuffer());
-		glVertexAttribPointer(Drawable::TEXCOORD_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
-		glBindBuffer(GL_ARRAY_BUFFER, d.getNormalBuffer());
-		glVertexAttribPointer(Drawable::NORMAL_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		if(d.getNumIndices() != 0) {
-			glDrawElements(GL_TRIANGLES, d.getNumIndices(),
-					GL_UNSIGNED_SHORT, NULL);
-		} else {
-			glDrawArrays(GL_TRIANGLES, 0, d.getNumVertices());
+		if(mMeshBuffer->bind(d.getMesh(), attributes, mesh)) {
+			stats.bufferBinds += 2;
+			stats.stateChanges += d.hasVertexColors() ? 5 : 4;
+		}
+		if(d.hasVertexColors() != colors) {
+			if(d.hasVertexColors())
+				glEnableVertexAttribArray(Drawable::COLOR_INDEX);
+			else
+				glDisableVertexAttribArray(Drawable::COLOR_INDEX);
+			colors = d.hasVertexColors();
+			stats.stateChanges++;
+		}
+
+		drawBatch(batch, instancing, indirect, stats);
+		stats.instancesDrawn += batch.count;
+
+		CHECK_GL_ERROR(*mValidation);
+	}
+	if(indirect) {
+		mMultiDraw->flush(stats);
+		CHECK_GL_ERROR(*mValidation);
+	}
+
+	glDisableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	glDisableVertexAttribArray(Drawable::TEXCOORD_INDEX);
+	glDisableVertexAttribArray(Drawable::NORMAL_INDEX);
+	if(colors)
+		glDisableVertexAttribArray(Drawable::COLOR_INDEX);
+	if(instancing)
+		mInstanceBuffer->disable();
+}
+
+void Scene::prepareShadowInstances(CommandChunk& chunk, size_t begin, size_t end,
+		const Frustum& frustum) const
+{
+	for(size_t i = begin; i < end; i++) {
+		// blended instances don't cast shadows
+		auto flags = mInstances->getFlags(i);
+		if(flags & InstanceBlending)
+			continue;
+
+		const float* world = mInstances->getWorldMatrix(i);
+		const Drawable* d = mInstances->getDrawable(i);
+		float center[3];
+		float radius = worldBoundingSphere(*d, world, center);
+		if(!frustum.intersectsSphere(center, radius)) {
+			chunk.culled++;
+			continue;
+		}
+
+		chunk.opaque.emplace_back();
+		auto& cmd = chunk.opaque.back();
+		cmd.drawable = d;
+		cmd.texture = 0;
+		cmd.flags = 0;
+		cmd.sortKey = uintptr_t(d);
+		cmd.depth = 0.0f;
+		std::copy(world, world + 16, cmd.world);
+		// part of the instance data, but unused by the shadow shader
+		std::fill(cmd.normalMatrix, cmd.normalMatrix + 9, 0.0f);
+		cmd.name = mInstances->getName(i);
+	}
+}
+
+void Scene::prepareShadowCommands()
+{
+	const size_t chunkSize = 256;
+	size_t n = mInstances->size();
+	unsigned int numChunks = (n + chunkSize - 1) / chunkSize;
+	unsigned int numCascades = mShadows->getNumCascades();
+
+	Frustum frustums[ShadowSettings::MaxCascades];
+	for(unsigned int c = 0; c < numCascades; c++) {
+		mShadowCommands[c].reset(numChunks);
+		frustums[c].set(mShadows->getLightViewProjection(c));
+	}
+
+	// one task per chunk and cascade
+	mJobs->parallelFor(0, numChunks * numCascades, 1, [&] (size_t b, size_t e) {
+		for(size_t t = b; t < e; t++) {
+			unsigned int c = t / numChunks;
+			unsigned int k = t % numChunks;
+			auto& chunk = mShadowCommands[c].getChunk(k);
+			prepareShadowInstances(chunk, k * chunkSize, std::min(n, (k + 1) * chunkSize),
+					frustums[c]);
+			chunk.sort();
+		}
+	});
+}
+
+void Scene::drawShadows(FrameStats& stats)
+{
+	const bool instancing = mInstanceBuffer->isSupported();
+	const bool indirect = instancing && mMultiDraw->isSupported();
+	const auto& settings = mShadows->getSettings();
+	const GLuint program = mShadowVariants->get(instancing ? ShaderInstancing : 0);
+	auto& uniforms = mUniformLocationMap[program];
+	const GLint viewProjectionLoc = uniforms["u_viewProjection"];
+	const GLint worldLoc = uniforms["u_world"];
+
+	glUseProgram(program);
+	mShadows->begin();
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable(GL_BLEND);
+	// both sides cast, so that open meshes have shadows too
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(settings.slopeBias, settings.depthBias);
+	glEnableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	if(instancing)
+		mInstanceBuffer->enable();
+	stats.stateChanges += 5;
+
+	for(unsigned int c = 0; c < mShadows->getNumCascades(); c++) {
+		mShadows->beginCascade(c);
+		glUniformMatrix4fv(viewProjectionLoc, 1, GL_FALSE, mShadows->getLightViewProjection(c).m);
+		stats.uniformUploads++;
+		stats.bytesUploaded += 16 * sizeof(GLfloat);
+
+		// the casters of the cascade, one batch per drawable
+		auto& commands = mShadowCommands[c];
+		commands.buildBatches(instancing);
+		if(instancing) {
+			stats.bytesUploaded += mInstanceBuffer->upload(commands.getInstanceData());
+			stats.bufferBinds++;
+		}
+		if(indirect) {
+			mInstanceBuffer->bind(0);
+			stats.bufferBinds++;
+		}
+
+		MeshBinding mesh;
+		for(const auto& batch : commands.getOpaqueBatches()) {
+			const auto& cmd = *batch.command;
+			mValidation->setCurrentObject(cmd.name);
+			const auto& d = *cmd.drawable;
+			if(indirect && !mMeshBuffer->isBound(d.getMesh(), MeshPosition, mesh))
+				mMultiDraw->flush(stats, &FrameStats::shadowDrawCalls);
+			if(mMeshBuffer->bind(d.getMesh(), MeshPosition, mesh))
+				stats.bufferBinds += 2;
+
+			if(indirect) {
+				mMultiDraw->add(mMeshBuffer->getMesh(d.getMesh()), batch.count, batch.firstInstance);
+			} else if(instancing) {
+				mInstanceBuffer->bind(batch.firstInstance);
+				stats.bufferBinds++;
+				mMeshBuffer->drawInstanced(d.getMesh(), batch.count);
+				stats.shadowDrawCalls++;
+			} else {
+				glUniformMatrix4fv(worldLoc, 1, GL_FALSE, cmd.world);
+				stats.uniformUploads++;
+				stats.bytesUploaded += 16 * sizeof(GLfloat);
+				mMeshBuffer->draw(d.getMesh());
+				stats.shadowDrawCalls++;
+			}
+			stats.shadowTriangles += (d.getNumIndices() != 0 ? d.getNumIndices() : d.getNumVertices()) / 3 *
+				batch.count;
+			CHECK_GL_ERROR(*mValidation);
+		}
+		if(indirect) {
+			mMultiDraw->flush(stats, &FrameStats::shadowDrawCalls);
+			CHECK_GL_ERROR(*mValidation);
 		}
-		glDisableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
-		glDisableVertexAttribArray(Drawable::TEXCOORD_INDEX);
-		glDisableVertexAttribArray(Drawable::NORMAL_INDEX);
+		stats.shadowCastersCulled += commands.getNumCulled();
+	}
+
+	glDisableVertexAttribArray(Drawable::VERTEX_POS_INDEX);
+	if(instancing)
+		mInstanceBuffer->disable();
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	mShadows->end();
+	glViewport(0, 0, mScreenWidth, mScreenHeight);
+}
+
+void Scene::render()
+{
+	mProfiler->beginFrame();
+	auto& stats = mProfiler->current();
+
+	mJobs->runMainThreadJobs();
+	reloadShaders();
+	applySnapshot();
+	const auto& ambientLight = *mFrameAmbientLight;
+	const auto& directionalLight = *mFrameDirectionalLight;
+	const auto& pointLight = *mFramePointLight;
+
+	glClearColor(mClearColor.r / 256.0f, mClearColor.g / 256.0f, mClearColor.b / 256.0f, 1.0f);
+
+	// prepare: culling, matrices and the command list, with no GL calls
+	updateFrameMatrices(*mFrameCamera);
+	mHierarchy->update();
+	mInstances->updateWorldMatrices(mJobs.get());
+	if(mOcclusionCulling)
+		mOcclusion->beginFrame(mInstances->getSlotCount());
+	prepareCommands();
+
+	bool shadows = mShadows->isSupported() && mShadows->getSettings().enabled &&
+		directionalLight.isOn();
+	// the features every scene variant drawn this frame has
+	mFrameFeatures = (ambientLight.isOn() ? ShaderAmbientLight : 0) |
+		(directionalLight.isOn() ? ShaderDirectionalLight : 0) |
+		(pointLight.isOn() ? ShaderPointLight : 0) |
+		(shadows ? ShaderShadows : 0);
+	mFramePrograms.clear();
+
+	if(mTextureResidency->isEnabled())
+		updateTextureResidency(stats);
+
+	unsigned int stalls = mDynamicBuffer->getStalls();
+	mDynamicBuffer->beginFrame();
+	stats.uploadStalls += mDynamicBuffer->getStalls() - stalls;
+
+	if(shadows) {
+		// 0.1 is the near plane of HelperFunctions::perspectiveMatrix()
+		const auto& cam = *mFrameCamera;
+		mShadows->update(cam.getPosition(), cam.getTargetVector(), mFOV,
+				mScreenWidth / mScreenHeight, 0.1f, mZFar, directionalLight.getDirection());
+		prepareShadowCommands();
+
+		mProfiler->beginPass(RenderPass::Shadows);
+		drawShadows(stats);
+	}
+
+	// after the shadows, whose cascades upload their own instance data
+	mCommands.buildBatches(mInstanceBuffer->isSupported());
+	if(mInstanceBuffer->isSupported()) {
+		stats.bytesUploaded += mInstanceBuffer->upload(mCommands.getInstanceData());
+		stats.bufferBinds++;
+	}
 
-		CHECK_GL_ERROR();
+	// submit: replay the commands on this thread
+	mProfiler->beginPass(RenderPass::Scene);
+	if(mDepthPrepass) {
+		drawDepthPrepass(stats);
+		if(mOcclusionCulling)
+			drawOcclusionTests(stats);
 	}
 
-	glUseProgram(mLineProgram);
-	auto mvp = mViewMatrix * mPerspectiveMatrix;
-	glUniformMatrix4fv(mUniformLocationMap[mSceneProgram]["u_MVP"], 1, GL_FALSE, mvp.m);
+	if(shadows) {
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, mShadows->getTexture());
+		glActiveTexture(GL_TEXTURE0);
+		stats.textureBinds++;
+		stats.stateChanges++;
+	}
+
+	// opaque first, with only the visible fragments shaded if the depth
+	// is already there. GL_EQUAL relies on scene.vert and depth.vert
+	// declaring gl_Position invariant.
+	mProfiler->beginSampleCount();
+	if(mDepthPrepass) {
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+		stats.stateChanges += 2;
+	}
+	submitCommands(stats, false);
+	if(mDepthPrepass) {
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_TRUE);
+		stats.stateChanges += 2;
+	}
+	mProfiler->endSampleCount();
+
+	// the boxes are tested against the opaque depth
+	if(mOcclusionCulling && !mDepthPrepass)
+		drawOcclusionTests(stats);
+
+	// then the blended ones back to front
+	submitCommands(stats, true);
+	stats.instancesCulled += mCommands.getNumCulled();
+	stats.instancesOccluded += mCommands.getNumOccluded();
+
+	mProfiler->beginPass(RenderPass::Lines);
+	const GLuint lineProgram = mLineVariants->get(0);
+	glUseProgram(lineProgram);
+	glUniformMatrix4fv(mUniformLocationMap[lineProgram]["u_MVP"], 1, GL_FALSE, mViewProjectionMatrix.m);
+	stats.stateChanges++;
+	stats.uniformUploads++;
+	stats.bytesUploaded += 16 * sizeof(GLfloat);
 	for(const auto& kv : mLines) {
 		if(kv.second.isEmpty())
 			continue;
 
+		mValidation->setCurrentObject(&kv.first);
+
+		const auto& vertices = kv.second.getVertices();
+		const auto& colors = kv.second.getColors();
+		auto v = mDynamicBuffer->upload(&vertices[0], vertices.size() * sizeof(GLfloat));
+		auto c = mDynamicBuffer->upload(&colors[0], colors.size() * sizeof(GLfloat));
+		stats.bytesUploaded += (vertices.size() + colors.size()) * sizeof(GLfloat);
+
 		glEnableVertexAttribArray(Line::VERTEX_POS_INDEX);
 		glEnableVertexAttribArray(Line::COLOR_INDEX);
-		glBindBuffer(GL_ARRAY_BUFFER, kv.second.getVertexBuffer());
-		glVertexAttribPointer(Line::VERTEX_POS_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glBindBuffer(GL_ARRAY_BUFFER, kv.second.getColorBuffer());
-		glVertexAttribPointer(Line::COLOR_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, v.buffer);
+		glVertexAttribPointer(Line::VERTEX_POS_INDEX, 3, GL_FLOAT, GL_FALSE, 0,
+				reinterpret_cast<const GLvoid*>(v.offset));
+		glBindBuffer(GL_ARRAY_BUFFER, c.buffer);
+		glVertexAttribPointer(Line::COLOR_INDEX, 3, GL_FLOAT, GL_FALSE, 0,
+				reinterpret_cast<const GLvoid*>(c.offset));
 		glDrawArrays(GL_LINES, 0, kv.second.getNumVertices());
+		stats.bufferBinds += 2;
+		stats.stateChanges += 2;
+		stats.drawCalls++;
 		glDisableVertexAttribArray(Line::VERTEX_POS_INDEX);
 		glDisableVertexAttribArray(Line::COLOR_INDEX);
-		CHECK_GL_ERROR();
+		CHECK_GL_ERROR(*mValidation);
 	}
 
+	mProfiler->beginPass(RenderPass::Overlays);
+	if(mStatsOverlayEnabled)
+		updateStatsOverlay();
 	if(!mOverlays.empty()) {
-		glUseProgram(mOverlayProgram);
+		const GLuint overlayProgram = mOverlayVariants->get(0);
+		glUseProgram(overlayProgram);
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		stats.stateChanges += 2;
 
 		std::vector<std::pair<std::string, boost::shared_ptr<Overlay>>> sortedOverlays;
 		std::copy(mOverlays.begin(), mOverlays.end(), back_inserter(sortedOverlays));
@@ -844,14 +1699,19 @@ void Scene::render()
 				continue;
 			}
 
+			mValidation->setCurrentObject(&kv.first);
+
 			auto mvp = getOrthoMVP(*kv.second);
-			glUniformMatrix4fv(mUniformLocationMap[mOverlayProgram]["u_MVP"], 1, GL_FALSE, mvp.m);
-			glUniform1i(mUniformLocationMap[mOverlayProgram]["s_texture"], 0);
+			glUniformMatrix4fv(mUniformLocationMap[overlayProgram]["u_MVP"], 1, GL_FALSE, mvp.m);
+			glUniform1i(mUniformLocationMap[overlayProgram]["s_texture"], 0);
+			stats.uniformUploads += 2;
+			stats.bytesUploaded += 16 * sizeof(GLfloat) + sizeof(GLint);
 
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, kv.second->getTexture());
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			stats.textureBinds++;
 
 			glEnableVertexAttribArray(Overlay::VERTEX_POS_INDEX);
 			glEnableVertexAttribArray(Overlay::TEXCOORD_INDEX);
@@ -860,45 +1720,230 @@ void Scene::render()
 
 			glBindBuffer(GL_ARRAY_BUFFER, kv.second->getTexCoordBuffer());
 			glVertexAttribPointer(Overlay::TEXCOORD_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
+			stats.bufferBinds += 2;
 
 			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+			stats.stateChanges += 3;
+			stats.drawCalls++;
+			stats.triangles += 2;
 			glDisableVertexAttribArray(Overlay::VERTEX_POS_INDEX);
 			glDisableVertexAttribArray(Overlay::TEXCOORD_INDEX);
-			CHECK_GL_ERROR();
+			CHECK_GL_ERROR(*mValidation);
 		}
 	}
+
+	mDynamicBuffer->endFrame();
+	mValidation->setCurrentObject(nullptr);
+	mProfiler->endFrame();
+}
+
+void Scene::updateStatsOverlay()
+{
+	static const char* name = "Frame stats";
+	static const unsigned int updateInterval = 30;
+
+	if(mStatsOverlayCounter++ % updateInterval)
+		return;
+
+	auto texture = mTextRenderer->renderText(getAverageFrameStats().toString().c_str(), Color::White);
+	float scale = 0.5f;
+	unsigned int w = texture->getWidth() * scale;
+	unsigned int h = texture->getHeight() * scale;
+	unsigned int y = mScreenHeight > h ? mScreenHeight - h : 0;
+
+	auto it = mOverlays.find(name);
+	if(it == mOverlays.end()) {
+		auto ov = boost::shared_ptr<Overlay>(new Overlay(texture, mScreenWidth, mScreenHeight));
+		ov->setDepth(-1.0f);
+		it = mOverlays.insert({name, ov}).first;
+	} else {
+		it->second->setTexture(texture);
+	}
+	it->second->setPosition(0, y, w, h);
+	it->second->setEnabled(true);
 }
 
 void Scene::addTexture(const std::string& name, const std::string& filename)
 {
 	if(mTextures.find(name) != mTextures.end()) {
 		throw std::runtime_error("Tried adding an already existing texture");
-	} else {
-		mTextures.insert({name, HelperFunctions::loadTexture(filename)});
 	}
+
+	// a file already loaded under another name is shared
+	const std::string key = mTextureLoader->getKey(filename);
+	auto texture = mTextureCache.find(key);
+	if(!texture) {
+		// with streaming only the small levels are loaded now
+		const auto& streaming = mTextureResidency->getSettings();
+		texture = mTextureLoader->load(filename,
+				mTextureResidency->isEnabled() ? streaming.residentSize : 0);
+		mTextureCache.insert(key, texture->getTexture(), texture);
+		mTextureResidency->add(texture);
+
+		// only textures with an alpha channel need the alpha test
+		if(texture->hasAlpha())
+			mAlphaTextures.insert(texture->getTexture());
+	}
+	mTextureCache.addRef(texture->getTexture());
+	mTextures.insert({name, texture});
+	mTextureFiles[name] = filename;
+}
+
+void Scene::removeTexture(const std::string& name)
+{
+	auto it = mTextures.find(name);
+	if(it == mTextures.end()) {
+		throw std::runtime_error("Tried removing a non-existing texture\n");
+	}
+
+	GLuint texture = it->second->getTexture();
+	mTextures.erase(it);
+	mTextureFiles.erase(name);
+	releaseTexture(texture, 1);
+}
+
+void Scene::releaseTexture(GLuint texture, unsigned int count)
+{
+	// deleted with the last reference, when the returned pointer goes
+	if(mTextureCache.release(texture, count)) {
+		mTextureResidency->remove(texture);
+		mAlphaTextures.erase(texture);
+	}
+}
+
+void Scene::updateTextureResidency(FrameStats& stats)
+{
+	for(unsigned int i = 0; i < mCommands.getNumChunks(); i++) {
+		const auto& chunk = mCommands.getChunk(i);
+		for(const auto& cmd : chunk.opaque)
+			mTextureResidency->markUsed(cmd.texture, cmd.screenSize);
+		for(const auto& cmd : chunk.blended)
+			mTextureResidency->markUsed(cmd.texture, cmd.screenSize);
+	}
+	mTextureResidency->update(stats);
+}
+
+void Scene::setTextureStreamingSettings(const TextureStreamingSettings& s)
+{
+	mTextureResidency->setSettings(s);
+}
+
+const TextureStreamingSettings& Scene::getTextureStreamingSettings() const
+{
+	return mTextureResidency->getSettings();
+}
+
+size_t Scene::getTextureMemory() const
+{
+	return mTextureCache.getMemorySize();
+}
+
+std::vector<ResourceInfo> Scene::getResources() const
+{
+	std::vector<ResourceInfo> resources;
+	mDrawableCache.forEach([&] (const std::string& key, const Drawable& d, unsigned int refs) {
+			resources.push_back({ ResourceInfo::Type::Model, key, d.getMemorySize(), refs });
+			});
+	mTextureCache.forEach([&] (const std::string& key, const GPUTexture& t, unsigned int refs) {
+			resources.push_back({ ResourceInfo::Type::Texture, key, t.getMemorySize(), refs });
+			});
+	return resources;
 }
 
 void Scene::addModel(const std::string& name, const Model& model)
+{
+	// not from a file, so never shared
+	addDrawable(name, model, name, false);
+}
+
+void Scene::addDrawable(const std::string& name, const Model& model, const std::string& key, bool shared)
 {
 	if(mDrawables.find(name) != mDrawables.end()) {
 		throw std::runtime_error("Tried adding a model with an already existing name");
 	} else {
-		boost::shared_ptr<Drawable> d(new Drawable(mSceneProgram, model));
+		boost::shared_ptr<Drawable> d(new Drawable(model, *mMeshBuffer));
 		std::cout << (d->getNumVertices()) << " vertices.\n";
 		std::cout << (d->getNumIndices() / 3) << " triangles.\n";
+		mDrawableCache.insert(key, uintptr_t(d.get()), d, shared);
+		mDrawableCache.addRef(uintptr_t(d.get()));
 		mDrawables.insert({name, d});
 	}
 }
 
+bool Scene::addCachedModel(const std::string& name, const std::string& key)
+{
+	auto d = mDrawableCache.find(key);
+	if(!d)
+		return false;
+	if(mDrawables.find(name) != mDrawables.end()) {
+		throw std::runtime_error("Tried adding a model with an already existing name");
+	}
+	mDrawableCache.addRef(uintptr_t(d.get()));
+	mDrawables.insert({name, d});
+	return true;
+}
+
 void Scene::addModel(const std::string& name, const std::string& filename)
 {
-	auto m = Model(filename);
-	addModel(name, m);
+	// a file already loaded under another name is shared. All files are
+	// imported with the same options, so the path is the key.
+	const std::string key = HelperFunctions::canonicalPath(filename);
+	if(!addCachedModel(name, key))
+		addDrawable(name, Model(filename), key, true);
+	mModelFiles[name] = filename;
+}
+
+JobHandle Scene::addModelAsync(const std::string& name, const std::string& filename)
+{
+	// loaded on a worker unless it is already, uploaded on the GL thread
+	const std::string key = HelperFunctions::canonicalPath(filename);
+	auto model = std::make_shared<std::unique_ptr<Model>>();
+	JobHandle load;
+	if(!mDrawableCache.find(key))
+		load = mJobs->schedule([=] { model->reset(new Model(filename)); });
+	return mJobs->scheduleOnMainThread([=] {
+			// passes on a loading error
+			mJobs->wait(load);
+			// another load of the file may have finished first, or the
+			// cached one been removed meanwhile
+			if(!addCachedModel(name, key)) {
+				if(!*model)
+					model->reset(new Model(filename));
+				addDrawable(name, **model, key, true);
+			}
+			mModelFiles[name] = filename;
+			}, { load });
+}
+
+void Scene::removeModel(const std::string& name)
+{
+	auto it = mDrawables.find(name);
+	if(it == mDrawables.end()) {
+		throw std::runtime_error("Tried removing a non-existing model\n");
+	}
+
+	const Drawable* d = it->second.get();
+	mDrawables.erase(it);
+	mModelFiles.erase(name);
+	releaseDrawable(d, 1);
+}
+
+void Scene::releaseDrawable(const Drawable* drawable, unsigned int count)
+{
+	// deleted with the last reference, when the returned pointer goes
+	mDrawableCache.release(uintptr_t(drawable), count);
+}
+
+void Scene::releaseInstanceResources(InstanceHandle h)
+{
+	size_t i = mInstances->getDenseIndex(h);
+	releaseDrawable(mInstances->getDrawable(i), 1);
+	releaseTexture(mInstances->getTexture(i), 1);
 }
 
 void Scene::addModelFromHeightmap(const std::string& name, const Heightmap& heightmap)
 {
-	auto m = Model(heightmap, 1.0f, 1.0f);
+	auto m = Model(heightmap, 1.0f, 1.0f, mJobs.get());
 	addModel(name, m);
 }
 
@@ -915,6 +1960,10 @@ class PlaneHeightmap : public Heightmap {
 		{
 			return 0.0f;
 		}
+		virtual bool isThreadSafe() const
+		{
+			return true;
+		}
 		virtual unsigned int getWidth() const
 		{
 			return mSegments;
@@ -932,7 +1981,7 @@ void Scene::addPlane(const std::string& name, float uscale, float vscale, unsign
 {
 	PlaneHeightmap heightmap(segments);
 
-	auto m = Model(heightmap, uscale, vscale);
+	auto m = Model(heightmap, uscale, vscale, mJobs.get());
 	addModel(name, m);
 }
 
@@ -953,6 +2002,7 @@ void Scene::clearLine(const std::string& name)
 void Scene::setFOV(float angle)
 {
 	mFOV = angle;
+	mProjectionDirty = true;
 }
 
 float Scene::getFOV() const
@@ -963,6 +2013,7 @@ float Scene::getFOV() const
 void Scene::setZFar(float zfar)
 {
 	mZFar = zfar;
+	mProjectionDirty = true;
 }
 
 float Scene::getZFar() const
@@ -982,6 +2033,7 @@ void Scene::addOverlay(const std::string& name, const std::string& filename)
 	} else {
 		auto ov = boost::shared_ptr<Overlay>(new Overlay(filename, mScreenWidth, mScreenHeight));
 		mOverlays.insert({name, ov});
+		mOverlayFiles[name] = filename;
 	}
 }
 
@@ -1061,28 +2113,548 @@ void Scene::getModel(const std::string& name)
 	}
 }
 
-boost::shared_ptr<MeshInstance> Scene::addMeshInstance(const std::string& name,
-		const std::string& modelname, const std::string& texturename, bool usebackfaceculling, bool useblending)
+const Drawable& Scene::findDrawable(const std::string& modelname) const
 {
-	if(mMeshInstances.find(name) != mMeshInstances.end()) {
-		throw std::runtime_error("Tried adding a mesh instance with an already existing name");
-	}
-
 	auto modelit = mDrawables.find(modelname);
 	if(modelit == mDrawables.end())
 		throw std::runtime_error("Tried getting a non-existing model\n");
+	return *modelit->second;
+}
 
+GLuint Scene::findTexture(const std::string& texturename) const
+{
 	auto textit = mTextures.find(texturename);
 	if(textit == mTextures.end())
 		throw std::runtime_error("Tried getting a non-existing texture\n");
+	return textit->second->getTexture();
+}
+
+static uint32_t instanceFlags(bool usebackfaceculling, bool useblending, bool usealphatest)
+{
+	return (usebackfaceculling ? InstanceBackfaceCulling : 0) |
+		(useblending ? InstanceBlending : 0) |
+		(usealphatest ? InstanceAlphaTest : 0);
+}
 
-	auto mi = boost::shared_ptr<MeshInstance>(new MeshInstance(*modelit->second, usebackfaceculling, useblending));
-	mMeshInstances.insert({name, mi});
+boost::shared_ptr<MeshInstance> Scene::addMeshInstance(const std::string& name,
+		const std::string& modelname, const std::string& texturename, bool usebackfaceculling, bool useblending)
+{
+	const auto& drawable = findDrawable(modelname);
+	auto texture = findTexture(texturename);
+
+	auto it = mMeshInstances.insert({name, NamedInstance()});
+	if(!it.second) {
+		throw std::runtime_error("Tried adding a mesh instance with an already existing name");
+	}
 
-	mMeshInstanceTextures.insert({name, textit->second});
+	auto mi = boost::shared_ptr<MeshInstance>(new MeshInstance(drawable, usebackfaceculling, useblending));
+	auto h = mInstances->add(&drawable, texture, instanceFlags(usebackfaceculling, useblending, mAlphaTextures.count(texture)),
+			mi->getPosition(), mi->getRotation(), mi->getScale());
+	mDrawableCache.addRef(uintptr_t(&drawable));
+	mTextureCache.addRef(texture);
+	it.first->second.handle = h;
+	it.first->second.instance = mi;
+	mInstances->setName(h, &it.first->first);
+	mi->attach(mInstances.get(), h);
+	if(mThreadedSimulation)
+		mi->setSimulationTable(mSimulationTransforms.get());
 
 	return mi;
 }
 
+void Scene::removeMeshInstance(const std::string& name)
+{
+	auto it = mMeshInstances.find(name);
+	if(it == mMeshInstances.end()) {
+		throw std::runtime_error("Tried removing a non-existing mesh instance\n");
+	}
+
+	removeNode(*it->second.instance);
+	mSimulationTransforms->remove(it->second.handle);
+	releaseInstanceResources(it->second.handle);
+	mInstances->remove(it->second.handle);
+	it->second.instance->detach();
+	mMeshInstances.erase(it);
+}
+
+boost::shared_ptr<MeshInstance> Scene::getMeshInstance(const std::string& name) const
+{
+	auto it = mMeshInstances.find(name);
+	if(it == mMeshInstances.end()) {
+		throw std::runtime_error("Tried getting a non-existing mesh instance\n");
+	}
+	return it->second.instance;
+}
+
+std::vector<InstanceHandle> Scene::addMeshInstances(const std::string& modelname,
+		const std::string& texturename, const InstanceTransform* transforms, size_t count,
+		bool usebackfaceculling, bool useblending)
+{
+	const auto& drawable = findDrawable(modelname);
+	auto texture = findTexture(texturename);
+
+	std::vector<InstanceHandle> handles(count);
+	if(count) {
+		mInstances->add(&drawable, texture, instanceFlags(usebackfaceculling, useblending, mAlphaTextures.count(texture)),
+				transforms, count, &handles[0]);
+		mDrawableCache.addRef(uintptr_t(&drawable), count);
+		mTextureCache.addRef(texture, count);
+		if(mThreadedSimulation) {
+			for(size_t i = 0; i < count; i++)
+				mSimulationTransforms->set(handles[i], transforms[i]);
+		}
+	}
+	return handles;
+}
+
+void Scene::updateMeshInstances(const InstanceHandle* handles, const InstanceTransform* transforms, size_t count)
+{
+	if(mThreadedSimulation) {
+		for(size_t i = 0; i < count; i++) {
+			if(!mInstances->isValid(handles[i]))
+				throw std::runtime_error("Tried updating a non-existing mesh instance\n");
+			mSimulationTransforms->set(handles[i], transforms[i]);
+		}
+		return;
+	}
+	mInstances->setTransforms(handles, transforms, count);
 }
 
+void Scene::removeMeshInstances(const InstanceHandle* handles, size_t count)
+{
+	for(size_t i = 0; i < count; i++) {
+		if(!mInstances->isValid(handles[i]))
+			throw std::runtime_error("Tried removing a non-existing mesh instance\n");
+	}
+
+	// a handle given twice must release its resources only once. Valid
+	// handles with the same slot are the same instance.
+	std::vector<InstanceHandle> unique(handles, handles + count);
+	std::sort(unique.begin(), unique.end(), [] (const InstanceHandle& a, const InstanceHandle& b) {
+			return a.slot < b.slot;
+			});
+	unique.erase(std::unique(unique.begin(), unique.end(), [] (const InstanceHandle& a, const InstanceHandle& b) {
+				return a.slot == b.slot;
+				}), unique.end());
+
+	// instances added by name also need to be dropped from the name map
+	for(const auto& h : unique) {
+		auto name = mInstances->getName(h);
+		if(name) {
+			auto it = mMeshInstances.find(*name);
+			if(it != mMeshInstances.end()) {
+				removeNode(*it->second.instance);
+				it->second.instance->detach();
+				mMeshInstances.erase(it);
+			}
+		}
+	}
+
+	for(const auto& h : unique) {
+		mSimulationTransforms->remove(h);
+		releaseInstanceResources(h);
+	}
+	mInstances->remove(unique.data(), unique.size());
+}
+
+NodeHandle Scene::getOrAddNode(MeshInstance& mi)
+{
+	auto n = mi.getNode();
+	if(!mHierarchy->isValid(n)) {
+		n = mHierarchy->addNode();
+		mHierarchy->bindInstance(n, mi.getHandle());
+		mi.setNode(mHierarchy.get(), n);
+		mInstanceNodes[mi.getHandle().slot] = n;
+	}
+	return n;
+}
+
+void Scene::removeNode(MeshInstance& mi)
+{
+	auto n = mi.getNode();
+	if(mHierarchy->isValid(n)) {
+		mHierarchy->removeNode(n);
+		mi.setNode(nullptr, NodeHandle());
+		mInstanceNodes.erase(mi.getHandle().slot);
+	}
+}
+
+void Scene::setParent(const std::string& child, const std::string& parent)
+{
+	auto cit = mMeshInstances.find(child);
+	if(cit == mMeshInstances.end())
+		throw std::runtime_error("Tried parenting a non-existing mesh instance\n");
+
+	auto& ci = *cit->second.instance;
+	if(parent.empty()) {
+		if(mHierarchy->isValid(ci.getNode()))
+			mHierarchy->setParent(ci.getNode(), NodeHandle());
+		return;
+	}
+
+	auto pit = mMeshInstances.find(parent);
+	if(pit == mMeshInstances.end())
+		throw std::runtime_error("Tried parenting to a non-existing mesh instance\n");
+
+	auto pn = getOrAddNode(*pit->second.instance);
+	auto cn = getOrAddNode(ci);
+	mHierarchy->setParent(cn, pn);
+}
+
+const FrameStats& Scene::getFrameStats() const
+{
+	return mProfiler->getLastFrame();
+}
+
+FrameStats Scene::getAverageFrameStats() const
+{
+	return mProfiler->getAverage();
+}
+
+void Scene::setFrameStatsAverageWindow(unsigned int frames)
+{
+	mProfiler->setAverageWindow(frames);
+}
+
+void Scene::setGLValidationMode(GLValidationMode mode)
+{
+	mValidation->setMode(mode);
+}
+
+JobSystem& Scene::getJobSystem()
+{
+	return *mJobs;
+}
+
+void Scene::setDepthPrepassEnabled(bool enabled)
+{
+	mDepthPrepass = enabled;
+}
+
+void Scene::setOcclusionCullingEnabled(bool enabled)
+{
+	if(mOcclusionCulling && !enabled)
+		mOcclusion->reset();
+	mOcclusionCulling = enabled;
+}
+
+void Scene::setShadowSettings(const ShadowSettings& s)
+{
+	mShadows->setSettings(s);
+}
+
+const ShadowSettings& Scene::getShadowSettings() const
+{
+	return mShadows->getSettings();
+}
+
+void Scene::setThreadedSimulation(bool enabled, bool interpolate)
+{
+	mInterpolate = interpolate;
+	if(enabled == mThreadedSimulation)
+		return;
+	mThreadedSimulation = enabled;
+
+	if(!enabled) {
+		for(auto& kv : mMeshInstances)
+			kv.second.instance->setSimulationTable(nullptr);
+		return;
+	}
+
+	// start the simulation from the current state. The stored transform
+	// of an instance in the hierarchy is stale, so the named instances
+	// are seeded by setSimulationTable() from their own position,
+	// rotation and scale, i.e. the local transform that applySnapshot()
+	// gives back to the hierarchy. Unnamed instances have no node.
+	mSimulationTransforms->clear();
+	const auto& transforms = mInstances->getTransforms();
+	for(size_t i = 0; i < mInstances->size(); i++) {
+		if(!mInstances->getName(i))
+			mSimulationTransforms->set(mInstances->getHandle(i), transforms.get(i));
+	}
+	for(auto& kv : mMeshInstances)
+		kv.second.instance->setSimulationTable(mSimulationTransforms.get());
+
+	mAppliedVersions.clear();
+	mPreviousState = SceneSnapshot();
+	publishState();
+}
+
+void Scene::publishState()
+{
+	if(!mThreadedSimulation)
+		throw std::runtime_error("publishState() requires threaded simulation\n");
+
+	auto& state = mStates->getWriteBuffer();
+	state.instances = *mSimulationTransforms;
+	state.camera = InstanceTransform::make(mDefaultCamera.getPosition(),
+			mDefaultCamera.getRotation(), Vector3(1, 1, 1));
+	state.ambientLight = mAmbientLight;
+	state.directionalLight = mDirectionalLight;
+	state.pointLight = mPointLight;
+	state.time = std::chrono::steady_clock::now();
+	state.sequence++;
+	mStates->publish();
+}
+
+void Scene::setInstanceTransform(InstanceHandle h, const InstanceTransform& t)
+{
+	auto it = mInstanceNodes.find(h.slot);
+	if(it != mInstanceNodes.end()) {
+		mHierarchy->setLocalTransform(it->second,
+				Vector3(t.position[0], t.position[1], t.position[2]),
+				t.getRotation(),
+				Vector3(t.scale[0], t.scale[1], t.scale[2]));
+	} else {
+		mInstances->setTransforms(&h, &t, 1);
+	}
+}
+
+void Scene::applySnapshot()
+{
+	if(!mThreadedSimulation) {
+		mFrameCamera = &mDefaultCamera;
+		mFrameAmbientLight = &mAmbientLight;
+		mFrameDirectionalLight = &mDirectionalLight;
+		mFramePointLight = &mPointLight;
+		return;
+	}
+
+	if(mStates->hasNew()) {
+		// the read buffer is ours until acquire() hands it back
+		if(mInterpolate)
+			std::swap(mPreviousState, mStates->getReadBuffer());
+		mStates->acquire();
+	}
+	const auto& cur = mStates->getReadBuffer();
+	const auto& prev = mPreviousState;
+
+	// how far along from the previous to the current state, with the
+	// current state reached one step after it was published
+	float alpha = 1.0f;
+	bool interpolate = mInterpolate && prev.sequence != 0 && prev.sequence != cur.sequence;
+	if(interpolate) {
+		auto step = cur.time - prev.time;
+		auto since = std::chrono::steady_clock::now() - cur.time;
+		alpha = step.count() > 0 ? std::min(1.0f, float(since.count()) / float(step.count())) : 1.0f;
+	}
+
+	const auto& table = cur.instances;
+	size_t n = table.generations.size();
+	if(mAppliedVersions.size() < n)
+		mAppliedVersions.resize(n, 0);
+	for(size_t slot = 0; slot < n; slot++) {
+		InstanceHandle h;
+		h.slot = slot;
+		h.generation = table.generations[slot];
+		if(!h.generation || !mInstances->isValid(h))
+			continue;
+
+		bool moving = interpolate && alpha < 1.0f && slot < prev.instances.generations.size() &&
+			prev.instances.generations[slot] == h.generation &&
+			prev.instances.versions[slot] != table.versions[slot];
+		if(moving) {
+			setInstanceTransform(h, InstanceTransform::lerp(prev.instances.transforms[slot],
+						table.transforms[slot], alpha));
+			// not at the end yet
+			mAppliedVersions[slot] = prev.instances.versions[slot];
+		} else if(mAppliedVersions[slot] != table.versions[slot]) {
+			setInstanceTransform(h, table.transforms[slot]);
+			mAppliedVersions[slot] = table.versions[slot];
+		}
+	}
+
+	auto camera = interpolate ? InstanceTransform::lerp(prev.camera, cur.camera, alpha) : cur.camera;
+	mRenderCamera.setPosition(Vector3(camera.position[0], camera.position[1], camera.position[2]));
+	mRenderCamera.setRotation(camera.getRotation());
+
+	mRenderAmbientLight = cur.ambientLight;
+	mRenderDirectionalLight = cur.directionalLight;
+	mRenderPointLight = cur.pointLight;
+	if(interpolate) {
+		const auto& p0 = prev.pointLight.getPosition();
+		const auto& p1 = cur.pointLight.getPosition();
+		mRenderPointLight.setPosition(p0 + (p1 - p0) * alpha);
+	}
+
+	mFrameCamera = &mRenderCamera;
+	mFrameAmbientLight = &mRenderAmbientLight;
+	mFrameDirectionalLight = &mRenderDirectionalLight;
+	mFramePointLight = &mRenderPointLight;
+}
+
+void Scene::setFrameStatsOverlayEnabled(bool enabled)
+{
+	if(enabled && !mTextRenderer)
+		throw std::runtime_error("The frame stats overlay requires enableText()\n");
+
+	mStatsOverlayEnabled = enabled;
+	mStatsOverlayCounter = 0;
+	auto it = mOverlays.find("Frame stats");
+	if(it != mOverlays.end())
+		it->second->setEnabled(enabled);
+}
+
+void Scene::saveScene(const std::string& filename) const
+{
+	SceneFile::Writer writer;
+
+	// instances refer to the first name of their model or texture
+	std::map<const Drawable*, uint32_t> models;
+	std::map<GLuint, uint32_t> textures;
+	for(const auto& kv : mModelFiles)
+		models.insert({ mDrawables.find(kv.first)->second.get(), writer.addModel(kv.first, kv.second) });
+	for(const auto& kv : mTextureFiles)
+		textures.insert({ findTexture(kv.first), writer.addTexture(kv.first, kv.second) });
+
+	// the unnamed instances are grouped for addMeshInstances()
+	const uint32_t savedFlags = InstanceBackfaceCulling | InstanceBlending;
+	std::map<std::tuple<uint32_t, uint32_t, uint32_t>, std::vector<InstanceTransform>> groups;
+	const TransformSoA& transforms = mInstances->getTransforms();
+	unsigned int skipped = 0;
+	unsigned int flattened = 0;
+	for(size_t i = 0; i < mInstances->size(); i++) {
+		auto model = models.find(mInstances->getDrawable(i));
+		auto texture = textures.find(mInstances->getTexture(i));
+		if(model == models.end() || texture == textures.end()) {
+			skipped++;
+			continue;
+		}
+		uint32_t flags = mInstances->getFlags(i) & savedFlags;
+		// the stored transform of an instance in the hierarchy is its
+		// local one, or older still, so the world matrix is saved instead
+		InstanceTransform t;
+		auto node = mInstanceNodes.find(mInstances->getHandle(i).slot);
+		if(node != mInstanceNodes.end() && mHierarchy->isValid(node->second)) {
+			t = InstanceTransform::decompose(mHierarchy->getWorldMatrix(node->second));
+			if(mHierarchy->isValid(mHierarchy->getParent(node->second)))
+				flattened++;
+		} else {
+			t = transforms.get(i);
+		}
+		const std::string* name = mInstances->getName(i);
+		if(name)
+			writer.addGroup(model->second, texture->second, flags, &t, 1, *name);
+		else
+			groups[std::make_tuple(model->second, texture->second, flags)].push_back(t);
+	}
+	for(const auto& kv : groups) {
+		writer.addGroup(std::get<0>(kv.first), std::get<1>(kv.first), std::get<2>(kv.first),
+				&kv.second[0], kv.second.size());
+	}
+	if(skipped) {
+		std::cerr << "Not saving " << skipped << " instances of models or textures not loaded from files\n";
+	}
+	if(flattened) {
+		std::cerr << "Saving " << flattened << " child instances with their world transform, "
+			"without their parents\n";
+	}
+
+	for(const auto& kv : mOverlayFiles) {
+		const Overlay& ov = *mOverlays.find(kv.first)->second;
+		SceneFile::Overlay o;
+		o.name = writer.addString(kv.first);
+		o.filename = writer.addString(kv.second);
+		o.enabled = ov.isEnabled();
+		o.x = ov.getX();
+		o.y = ov.getY();
+		o.w = ov.getW();
+		o.h = ov.getH();
+		o.depth = ov.getDepth();
+		writer.addOverlay(o);
+	}
+
+	auto vec = [] (float* out, const Vector3& v) {
+		out[0] = v.x;
+		out[1] = v.y;
+		out[2] = v.z;
+	};
+	auto light = [&] (SceneFile::Light& out, const Light& l) {
+		vec(out.color, l.getColor());
+		out.on = l.isOn();
+	};
+	SceneFile::Header& h = writer.getHeader();
+	h.camera = InstanceTransform::make(mDefaultCamera.getPosition(),
+			mDefaultCamera.getRotation(), Vector3(1, 1, 1));
+	h.fov = mFOV;
+	h.zFar = mZFar;
+	h.clearColor[0] = mClearColor.r;
+	h.clearColor[1] = mClearColor.g;
+	h.clearColor[2] = mClearColor.b;
+	light(h.ambientLight, mAmbientLight);
+	light(h.directionalLight, mDirectionalLight);
+	vec(h.lightDirection, mDirectionalLight.getDirection());
+	light(h.pointLight, mPointLight);
+	vec(h.lightPosition, mPointLight.getPosition());
+	vec(h.lightAttenuation, mPointLight.getAttenuation());
+
+	writer.write(filename);
+}
+
+void Scene::loadScene(const std::string& filename)
+{
+	SceneFile::Reader reader(filename);
+	const SceneFile::Header& h = reader.getHeader();
+	const SceneFile::Resource* models = reader.getModels();
+	const SceneFile::Resource* textures = reader.getTextures();
+
+	// the models are read on the workers while the textures load
+	std::vector<JobHandle> loads;
+	for(uint32_t i = 0; i < h.numModels; i++)
+		loads.push_back(addModelAsync(reader.getString(models[i].name), reader.getString(models[i].filename)));
+	for(uint32_t i = 0; i < h.numTextures; i++)
+		addTexture(reader.getString(textures[i].name), reader.getString(textures[i].filename));
+	for(const auto& l : loads)
+		mJobs->wait(l);
+
+	// the transforms go from the mapping to the instance store as they are
+	const SceneFile::InstanceGroup* groups = reader.getGroups();
+	const InstanceTransform* transforms = reader.getTransforms();
+	for(uint32_t i = 0; i < h.numGroups; i++) {
+		const SceneFile::InstanceGroup& g = groups[i];
+		std::string model = reader.getString(models[g.model].name);
+		std::string texture = reader.getString(textures[g.texture].name);
+		bool backfaceCulling = g.flags & InstanceBackfaceCulling;
+		bool blending = g.flags & InstanceBlending;
+		const InstanceTransform* t = &transforms[g.firstTransform];
+		if(g.name.length) {
+			auto mi = addMeshInstance(reader.getString(g.name), model, texture, backfaceCulling, blending);
+			mi->setPosition(Vector3(t->position[0], t->position[1], t->position[2]));
+			mi->setRotation(t->getRotation());
+			mi->setScale(t->scale[0], t->scale[1], t->scale[2]);
+		} else {
+			addMeshInstances(model, texture, t, g.count, backfaceCulling, blending);
+		}
+	}
+
+	const SceneFile::Overlay* overlays = reader.getOverlays();
+	for(uint32_t i = 0; i < h.numOverlays; i++) {
+		const SceneFile::Overlay& o = overlays[i];
+		std::string name = reader.getString(o.name);
+		addOverlay(name, reader.getString(o.filename));
+		setOverlayEnabled(name, o.enabled);
+		setOverlayPosition(name, o.x, o.y, o.w, o.h);
+		setOverlayDepth(name, o.depth);
+	}
+
+	auto vec = [] (const float* v) {
+		return Vector3(v[0], v[1], v[2]);
+	};
+	auto light = [&] (Light& l, const SceneFile::Light& in) {
+		l.setColor(vec(in.color));
+		l.setState(in.on);
+	};
+	mDefaultCamera.setPosition(vec(h.camera.position));
+	mDefaultCamera.setRotation(h.camera.getRotation());
+	setFOV(h.fov);
+	setZFar(h.zFar);
+	setClearColor(Common::Color(h.clearColor[0], h.clearColor[1], h.clearColor[2]));
+	light(mAmbientLight, h.ambientLight);
+	light(mDirectionalLight, h.directionalLight);
+	mDirectionalLight.setDirection(vec(h.lightDirection));
+	light(mPointLight, h.pointLight);
+	mPointLight.setPosition(vec(h.lightPosition));
+	mPointLight.setAttenuation(vec(h.lightAttenuation));
+}
+
+}
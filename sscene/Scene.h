@@ -3,6 +3,9 @@
 
 #include <tuple>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
 
 #include <boost/shared_ptr.hpp>
 
@@ -16,6 +19,25 @@
 #include "common/TextRenderer.h"
 
 #include "Model.h"
+#include "FrameStats.h"
+#include "GLValidation.h"
+#include "InstanceStore.h"
+#include "TransformHierarchy.h"
+#include "RenderCommands.h"
+#include "JobSystem.h"
+#include "TripleBuffer.h"
+#include "ShadowMap.h"
+#include "OcclusionQueries.h"
+#include "ShaderVariants.h"
+#include "DynamicBuffer.h"
+#include "MeshBuffer.h"
+#include "InstanceBuffer.h"
+#include "MultiDraw.h"
+#include "ProgramCache.h"
+#include "FileWatcher.h"
+#include "TextureLoader.h"
+#include "TextureResidency.h"
+#include "ResourceCache.h"
 
 namespace Scene {
 
@@ -88,14 +110,28 @@ class DirectionalLight : public Light {
 		Common::Vector3 mDirection;
 };
 
+// State written by the simulation thread, published to render() as a
+// whole. See Scene::setThreadedSimulation().
+struct SceneSnapshot {
+	SceneSnapshot();
+
+	InstanceTransformTable instances;
+	InstanceTransform camera;
+	Light ambientLight;
+	DirectionalLight directionalLight;
+	PointLight pointLight;
+	std::chrono::steady_clock::time_point time;
+	// 0 until the first publish
+	unsigned int sequence = 0;
+};
+
 class Drawable;
 
+// the segments are uploaded with the other per frame data when drawn
 class Line {
 	public:
-		Line();
-		~Line();
-		GLuint getVertexBuffer() const;
-		GLuint getColorBuffer() const;
+		const std::vector<GLfloat>& getVertices() const;
+		const std::vector<GLfloat>& getColors() const;
 		unsigned int getNumVertices() const;
 		void addSegment(const Common::Vector3& start, const Common::Vector3& end, const Common::Color& color);
 		void clear();
@@ -105,8 +141,8 @@ class Line {
 		static const unsigned int COLOR_INDEX;
 
 	private:
-		std::vector<std::tuple<Common::Vector3, Common::Vector3, Common::Color>> mSegments;
-		GLuint mVBOIDs[2];
+		std::vector<GLfloat> mVertices;
+		std::vector<GLfloat> mColors;
 };
 
 class Overlay {
@@ -144,19 +180,51 @@ class Overlay {
 };
 
 struct Shader;
+class Frustum;
 
 class Scene {
 	public:
-		Scene(float screenWidth, float screenHeight);
+		// workerThreads is the number of threads used besides the
+		// calling one, by default one less than there are cores
+		Scene(float screenWidth, float screenHeight,
+				unsigned int workerThreads = JobSystem::DefaultWorkers);
 		void init();
+		// keeps the linked programs in the directory, which must exist,
+		// so that later runs needn't compile them. Call before init().
+		void setProgramCacheDirectory(const std::string& directory);
+		// for development: rebuilds the programs whenever their sources
+		// in the directory are saved, e.g. sscene/shaders, instead of
+		// using the built in ones until then. If a source has errors,
+		// they are printed and the previous program stays in use.
+		void setShaderReloadDirectory(const std::string& directory);
+		// keeps images other than DDS and KTX files compressed in the
+		// directory, which must exist, so that they are only compressed
+		// on the first run. Call before init().
+		void setTextureCacheDirectory(const std::string& directory);
 		Camera& getDefaultCamera();
 		void addSkyBox();
 		Light& getAmbientLight();
 		DirectionalLight& getDirectionalLight();
 		PointLight& getPointLight();
 		void render();
+		// DDS and KTX files are used as they are, with their mip levels.
+		// A file added under several names is loaded once.
 		void addTexture(const std::string& name, const std::string& filename);
+		// the texture is unloaded once no names or instances use it
+		void removeTexture(const std::string& name);
+		// bytes of all the textures added
+		size_t getTextureMemory() const;
+		// with a budget, compressed textures loaded from files are only
+		// kept with the mip levels their size on screen needs. Set before
+		// adding the textures.
+		void setTextureStreamingSettings(const TextureStreamingSettings& s);
+		const TextureStreamingSettings& getTextureStreamingSettings() const;
+		// a file added under several names is loaded once
 		void addModel(const std::string& name, const std::string& filename);
+		// loads the model in the background; it is added during a later
+		// render() (or a wait() on the handle) and can be used after that.
+		// Loading errors are rethrown by wait().
+		JobHandle addModelAsync(const std::string& name, const std::string& filename);
 		void addModel(const std::string& name, const Model& model);
 		void addModel(const std::string& name, const std::vector<Common::Vector3>& vertexcoords,
 				const std::vector<Common::Vector2>& texcoords,
@@ -165,6 +233,10 @@ class Scene {
 		// resulting model will span from (0, 0) to (width * xzscale, width * xzscale)
 		void addModelFromHeightmap(const std::string& name, const Heightmap& heightmap);
 		void addPlane(const std::string& name, float uscale, float vscale, unsigned int segments);
+		// the model is unloaded once no names or instances use it
+		void removeModel(const std::string& name);
+		// the models and textures loaded, with their sizes
+		std::vector<ResourceInfo> getResources() const;
 		void addLine(const std::string& name, const Common::Vector3& start, const Common::Vector3& end, const Common::Color& color);
 		void clearLine(const std::string& name);
 		void getModel(const std::string& name);
@@ -186,22 +258,149 @@ class Scene {
 		boost::shared_ptr<MeshInstance> addMeshInstance(const std::string& name,
 				const std::string& modelname,
 				const std::string& texturename, bool usebackfaceculling = true, bool useblending = false);
+		void removeMeshInstance(const std::string& name);
+		boost::shared_ptr<MeshInstance> getMeshInstance(const std::string& name) const;
+
+		// bulk versions for adding, moving and removing many instances
+		// at once. The instances added in bulk have no name or
+		// MeshInstance object and are referred to by their handles.
+		std::vector<InstanceHandle> addMeshInstances(const std::string& modelname,
+				const std::string& texturename,
+				const InstanceTransform* transforms, size_t count,
+				bool usebackfaceculling = true, bool useblending = false);
+		void updateMeshInstances(const InstanceHandle* handles,
+				const InstanceTransform* transforms, size_t count);
+		// also accepts handles of named instances (MeshInstance::getHandle())
+		void removeMeshInstances(const InstanceHandle* handles, size_t count);
+
+		// makes the position, rotation and scale of the instance child
+		// relative to the instance parent. An empty parent name makes
+		// child a root again. Removing a parent moves its children to its
+		// own parent.
+		void setParent(const std::string& child, const std::string& parent);
+
+		// statistics of the last rendered frame
+		const FrameStats& getFrameStats() const;
+		// average over the last frames (60 by default)
+		FrameStats getAverageFrameStats() const;
+		void setFrameStatsAverageWindow(unsigned int frames);
+		// draws the average frame stats as text; throws if enableText()
+		// wasn't called
+		void setFrameStatsOverlayEnabled(bool enabled);
+		// call after init(). Defaults to PerDraw when built with
+		// SSCENE_GL_DEBUG, Off otherwise.
+		void setGLValidationMode(GLValidationMode mode);
+		// for running the application's own work on the scene's threads
+		JobSystem& getJobSystem();
+		// draws the depth of the opaque instances first, so that the
+		// shading pass only shades the visible fragments
+		void setDepthPrepassEnabled(bool enabled);
+		// skips instances whose bounding box was hidden in the last
+		// frame, found with occlusion queries that are read back late.
+		// Instances coming into view may appear a frame late.
+		void setOcclusionCullingEnabled(bool enabled);
+		// shadows of the directional light. Silently off if the GL
+		// implementation lacks framebuffer objects.
+		void setShadowSettings(const ShadowSettings& s);
+		const ShadowSettings& getShadowSettings() const;
+
+		// Lets a simulation thread run concurrently with render(). While
+		// enabled, changes to the transforms of the mesh instances, the
+		// default camera and the lights are only seen by render() after
+		// the simulation thread calls publishState(), once per step.
+		// Anything else, such as adding or removing instances or models,
+		// changing parents or the bulk instance functions, must not
+		// overlap with the simulation.
+		// With interpolation, render() draws between the last two
+		// published states according to the time passed, i.e. one step
+		// behind the simulation.
+		void setThreadedSimulation(bool enabled, bool interpolate = false);
+		void publishState();
+
+		// writes the models, textures and overlays loaded from files,
+		// the instances using them, the lights and the default camera to
+		// a binary scene file (see SceneFile.h). Models not loaded from
+		// files, lines, text and instance parents aren't saved; child
+		// instances are saved with their world transform.
+		void saveScene(const std::string& filename) const;
+		// adds what saveScene() wrote, with the models loaded in
+		// parallel; the names must not exist yet. The lights, camera and
+		// clear color are replaced.
+		void loadScene(const std::string& filename);
 
 	private:
-		void calculateModelMatrix(const MeshInstance& mi);
-		void updateMVPMatrix(const MeshInstance& mi);
-		void updateFrameMatrices(const Camera& cam);
-		GLuint loadShader(const Shader& s);
-		boost::shared_ptr<Common::Texture> getModelTexture(const std::string& mname) const;
+		// returns true if the view-projection has changed
+		bool updateFrameMatrices(const Camera& cam);
+		// a program is built in two steps so that the driver can
+		// compile it in the background in between. finishProgram()
+		// prints any errors and returns false after deleting the program.
+		GLuint startProgram(const Shader& s);
+		bool finishProgram(GLuint program, const Shader& s);
+		ShaderVariants* createVariants(const Shader& s, uint32_t usedFeatures);
+		// picks up changed shader sources, between frames
+		void reloadShaders();
 		Common::Matrix44 getOrthoMVP(const Overlay& ov) const;
+		const Drawable& findDrawable(const std::string& modelname) const;
+		// adds the model under the name, keeping it under the key if
+		// shared, so that addCachedModel() finds it
+		void addDrawable(const std::string& name, const Model& model, const std::string& key, bool shared);
+		// returns false if no model is kept under the key
+		bool addCachedModel(const std::string& name, const std::string& key);
+		// a name or instances stop using the resources
+		void releaseDrawable(const Drawable* drawable, unsigned int count);
+		void releaseTexture(GLuint texture, unsigned int count);
+		void releaseInstanceResources(InstanceHandle h);
+		GLuint findTexture(const std::string& texturename) const;
+		NodeHandle getOrAddNode(MeshInstance& mi);
+		void removeNode(MeshInstance& mi);
+		// picks up the latest published state and sets the frame's
+		// camera and lights from it
+		void applySnapshot();
+		void setInstanceTransform(InstanceHandle h, const InstanceTransform& t);
+		void updateStatsOverlay();
+		// fills mCommands from the instances, on the worker threads
+		void prepareCommands();
+		void prepareInstances(CommandChunk& chunk, size_t begin, size_t end, const Frustum& frustum) const;
+		// issues the GL calls for mCommands
+		void submitCommands(FrameStats& stats, bool blended);
+		// the per frame uniforms of a scene variant
+		void setSceneUniforms(GLuint program, FrameStats& stats);
+		// one draw call for the batch, instanced or with the matrices
+		// set as uniforms, or a command for mMultiDraw if indirect
+		void drawBatch(const DrawBatch& batch, bool instancing, bool indirect, FrameStats& stats);
+		// queues the box test of instance i if possible and returns
+		// whether it is to be drawn
+		bool prepareOcclusionTest(CommandChunk& chunk, size_t i, float depth) const;
+		void drawDepthPrepass(FrameStats& stats);
+		void drawOcclusionTests(FrameStats& stats);
+		// culls against each cascade and fills mShadowCommands
+		void prepareShadowCommands();
+		void prepareShadowInstances(CommandChunk& chunk, size_t begin, size_t end,
+				const Frustum& frustum) const;
+		void drawShadows(FrameStats& stats);
+		// marks the textures of mCommands as used and streams
+		void updateTextureResidency(FrameStats& stats);
 
 		float mScreenWidth;
 		float mScreenHeight;
 
-		GLuint mSceneProgram;
-		GLuint mLineProgram;
-		GLuint mOverlayProgram;
 		std::map<GLuint, std::map<const char*, GLint>> mUniformLocationMap;
+		std::unique_ptr<ShaderVariants> mSceneVariants;
+		std::unique_ptr<ShaderVariants> mDepthVariants;
+		// these have a single variant, get(0)
+		std::unique_ptr<ShaderVariants> mLineVariants;
+		std::unique_ptr<ShaderVariants> mOverlayVariants;
+		// position only, for the shadow maps and the occlusion boxes
+		std::unique_ptr<ShaderVariants> mShadowVariants;
+		std::unique_ptr<ProgramCache> mProgramCache;
+		std::unique_ptr<FileWatcher> mShaderWatcher;
+		std::unique_ptr<TextureLoader> mTextureLoader;
+		// the vertex and index data of the drawables
+		std::unique_ptr<MeshBuffer> mMeshBuffer;
+		// the light and shadow features of this frame, and the scene
+		// variants whose per frame uniforms are set already
+		uint32_t mFrameFeatures = 0;
+		std::vector<GLuint> mFramePrograms;
 
 		Camera mDefaultCamera;
 
@@ -209,25 +408,88 @@ class Scene {
 		DirectionalLight mDirectionalLight;
 		PointLight mPointLight;
 
-		std::map<std::string, boost::shared_ptr<Common::Texture>> mTextures;
-
-		Common::Matrix44 mInverseModelMatrix;
-		Common::Matrix44 mModelMatrix;
+		std::map<std::string, boost::shared_ptr<GPUTexture>> mTextures;
+		// the textures by GL name, referenced by mTextures and the
+		// instances
+		ResourceCache<GPUTexture> mTextureCache;
+		// textures with an alpha channel
+		std::unordered_set<GLuint> mAlphaTextures;
 
 		Common::Matrix44 mViewMatrix;
 		Common::Matrix44 mPerspectiveMatrix;
+		Common::Matrix44 mViewProjectionMatrix;
+		// view-projection is only recalculated when the camera or the
+		// projection parameters have changed
+		unsigned int mCameraVersion = 0;
+		bool mProjectionDirty = true;
 
 		std::map<std::string, boost::shared_ptr<Drawable>> mDrawables;
-		std::map<std::string, boost::shared_ptr<MeshInstance>> mMeshInstances;
-		std::map<std::string, boost::shared_ptr<Common::Texture>> mMeshInstanceTextures;
+		// the drawables by pointer, referenced by mDrawables and the
+		// instances
+		ResourceCache<Drawable> mDrawableCache;
+		// the instances are rendered from mInstances; names and the
+		// MeshInstance objects are only used at the API edge
+		struct NamedInstance {
+			InstanceHandle handle;
+			boost::shared_ptr<MeshInstance> instance;
+		};
+		std::unique_ptr<InstanceStore> mInstances;
+		// only instances that have or are parents have nodes here
+		std::unique_ptr<TransformHierarchy> mHierarchy;
+		std::unordered_map<std::string, NamedInstance> mMeshInstances;
 		std::map<std::string, Line> mLines;
 		std::map<std::string, boost::shared_ptr<Overlay>> mOverlays;
+		// the files added by name, for saveScene()
+		std::map<std::string, std::string> mModelFiles;
+		std::map<std::string, std::string> mTextureFiles;
+		std::map<std::string, std::string> mOverlayFiles;
 
 		float mFOV;
 		float mZFar;
 		Common::Color mClearColor;
 
 		std::unique_ptr<Common::TextRenderer> mTextRenderer;
+
+		std::unique_ptr<FrameProfiler> mProfiler;
+		std::unique_ptr<GLValidation> mValidation;
+		bool mStatsOverlayEnabled = false;
+		unsigned int mStatsOverlayCounter = 0;
+
+		std::unique_ptr<JobSystem> mJobs;
+		RenderCommandList mCommands;
+		// the vertex data written every frame: instance attributes and
+		// lines
+		std::unique_ptr<DynamicBuffer> mDynamicBuffer;
+		std::unique_ptr<InstanceBuffer> mInstanceBuffer;
+		std::unique_ptr<MultiDraw> mMultiDraw;
+		std::unique_ptr<TextureResidency> mTextureResidency;
+
+		std::unique_ptr<CascadedShadowMap> mShadows;
+		std::unique_ptr<OcclusionQueries> mOcclusion;
+		bool mDepthPrepass = false;
+		bool mOcclusionCulling = false;
+		RenderCommandList mShadowCommands[ShadowSettings::MaxCascades];
+
+		// threaded simulation: the transforms written by the simulation
+		// thread, the published states and the render side copies
+		bool mThreadedSimulation = false;
+		bool mInterpolate = false;
+		std::unique_ptr<InstanceTransformTable> mSimulationTransforms;
+		std::unique_ptr<TripleBuffer<SceneSnapshot>> mStates;
+		SceneSnapshot mPreviousState;
+		std::vector<uint32_t> mAppliedVersions;
+		std::unordered_map<uint32_t, NodeHandle> mInstanceNodes;
+		Camera mRenderCamera;
+		Light mRenderAmbientLight;
+		DirectionalLight mRenderDirectionalLight;
+		PointLight mRenderPointLight;
+
+		// what render() uses this frame: the members above or the
+		// snapshot copies
+		const Camera* mFrameCamera = nullptr;
+		const Light* mFrameAmbientLight = nullptr;
+		const DirectionalLight* mFrameDirectionalLight = nullptr;
+		const PointLight* mFramePointLight = nullptr;
 };
 
 }
@@ -0,0 +1,227 @@
+#include "SceneFile.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Scene {
+
+namespace SceneFile {
+
+Writer::Writer()
+{
+	memset(&mHeader, 0, sizeof(mHeader));
+	mHeader.magic = Magic;
+	mHeader.version = Version;
+}
+
+String Writer::addString(const std::string& s)
+{
+	String ret = { uint32_t(mStrings.size()), uint32_t(s.size()) };
+	mStrings.insert(mStrings.end(), s.begin(), s.end());
+	return ret;
+}
+
+uint32_t Writer::addModel(const std::string& name, const std::string& filename)
+{
+	mModels.push_back({ addString(name), addString(filename) });
+	return mModels.size() - 1;
+}
+
+uint32_t Writer::addTexture(const std::string& name, const std::string& filename)
+{
+	mTextures.push_back({ addString(name), addString(filename) });
+	return mTextures.size() - 1;
+}
+
+void Writer::addOverlay(const Overlay& ov)
+{
+	mOverlays.push_back(ov);
+}
+
+void Writer::addGroup(uint32_t model, uint32_t texture, uint32_t flags,
+		const InstanceTransform* transforms, size_t count, const std::string& name)
+{
+	InstanceGroup g;
+	g.model = model;
+	g.texture = texture;
+	g.flags = flags;
+	g.count = count;
+	g.firstTransform = mTransforms.size();
+	g.name = name.empty() ? String{ 0, 0 } : addString(name);
+	mGroups.push_back(g);
+	mTransforms.insert(mTransforms.end(), transforms, transforms + count);
+}
+
+Header& Writer::getHeader()
+{
+	return mHeader;
+}
+
+void Writer::write(const std::string& filename)
+{
+	// every section starts at a multiple of 8 bytes
+	uint64_t offset = sizeof(Header);
+	auto place = [&] (size_t bytes) {
+		offset = (offset + 7) & ~uint64_t(7);
+		uint64_t start = offset;
+		offset += bytes;
+		return start;
+	};
+	mHeader.modelsOffset = place(mModels.size() * sizeof(Resource));
+	mHeader.texturesOffset = place(mTextures.size() * sizeof(Resource));
+	mHeader.overlaysOffset = place(mOverlays.size() * sizeof(Overlay));
+	mHeader.groupsOffset = place(mGroups.size() * sizeof(InstanceGroup));
+	mHeader.transformsOffset = place(mTransforms.size() * sizeof(InstanceTransform));
+	mHeader.stringsOffset = place(mStrings.size());
+	mHeader.numModels = mModels.size();
+	mHeader.numTextures = mTextures.size();
+	mHeader.numOverlays = mOverlays.size();
+	mHeader.numGroups = mGroups.size();
+	mHeader.numTransforms = mTransforms.size();
+	mHeader.stringsSize = mStrings.size();
+
+	// written under another name first so that a failure doesn't
+	// destroy an existing file
+	std::string tmpPath = filename + ".tmp";
+	{
+		std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+		auto writeAt = [&] (uint64_t at, const void* data, size_t bytes) {
+			static const char padding[8] = { 0 };
+			ofs.write(padding, at - uint64_t(ofs.tellp()));
+			if(bytes)
+				ofs.write(reinterpret_cast<const char*>(data), bytes);
+		};
+		ofs.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+		writeAt(mHeader.modelsOffset, mModels.data(), mModels.size() * sizeof(Resource));
+		writeAt(mHeader.texturesOffset, mTextures.data(), mTextures.size() * sizeof(Resource));
+		writeAt(mHeader.overlaysOffset, mOverlays.data(), mOverlays.size() * sizeof(Overlay));
+		writeAt(mHeader.groupsOffset, mGroups.data(), mGroups.size() * sizeof(InstanceGroup));
+		writeAt(mHeader.transformsOffset, mTransforms.data(), mTransforms.size() * sizeof(InstanceTransform));
+		writeAt(mHeader.stringsOffset, mStrings.data(), mStrings.size());
+		if(!ofs) {
+			ofs.close();
+			std::remove(tmpPath.c_str());
+			throw std::runtime_error("Unable to write scene file " + filename + "\n");
+		}
+	}
+	if(std::rename(tmpPath.c_str(), filename.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		throw std::runtime_error("Unable to write scene file " + filename + "\n");
+	}
+}
+
+Reader::Reader(const std::string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("Unable to open scene file " + filename + "\n");
+	struct stat st;
+	if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+		close(fd);
+		throw std::runtime_error("Scene file " + filename + " is truncated\n");
+	}
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		throw std::runtime_error("Unable to map scene file " + filename + "\n");
+	mData = static_cast<const char*>(data);
+	mSize = st.st_size;
+
+	try {
+		const Header& h = getHeader();
+		if(h.magic != Magic || h.version != Version)
+			throw std::runtime_error("Scene file " + filename + " has an unsupported format\n");
+
+		section<char>(h.stringsOffset, h.stringsSize);
+		for(uint32_t i = 0; i < h.numModels; i++) {
+			checkString(getModels()[i].name);
+			checkString(getModels()[i].filename);
+		}
+		for(uint32_t i = 0; i < h.numTextures; i++) {
+			checkString(getTextures()[i].name);
+			checkString(getTextures()[i].filename);
+		}
+		for(uint32_t i = 0; i < h.numOverlays; i++) {
+			checkString(getOverlays()[i].name);
+			checkString(getOverlays()[i].filename);
+		}
+		getTransforms();
+		for(uint32_t i = 0; i < h.numGroups; i++) {
+			const InstanceGroup& g = getGroups()[i];
+			checkString(g.name);
+			if(g.model >= h.numModels || g.texture >= h.numTextures ||
+					uint64_t(g.firstTransform) + g.count > h.numTransforms ||
+					(g.name.length && g.count != 1))
+				throw std::runtime_error("Scene file " + filename + " has an invalid instance group\n");
+		}
+	} catch(...) {
+		munmap(const_cast<char*>(mData), mSize);
+		throw;
+	}
+}
+
+Reader::~Reader()
+{
+	munmap(const_cast<char*>(mData), mSize);
+}
+
+template<typename T>
+const T* Reader::section(uint64_t offset, uint64_t count) const
+{
+	if(offset % alignof(T) != 0 || offset > mSize || count > (mSize - offset) / sizeof(T))
+		throw std::runtime_error("Scene file section out of bounds\n");
+	return reinterpret_cast<const T*>(mData + offset);
+}
+
+void Reader::checkString(const String& s) const
+{
+	if(uint64_t(s.offset) + s.length > getHeader().stringsSize)
+		throw std::runtime_error("Scene file string out of bounds\n");
+}
+
+const Header& Reader::getHeader() const
+{
+	return *reinterpret_cast<const Header*>(mData);
+}
+
+const Resource* Reader::getModels() const
+{
+	return section<Resource>(getHeader().modelsOffset, getHeader().numModels);
+}
+
+const Resource* Reader::getTextures() const
+{
+	return section<Resource>(getHeader().texturesOffset, getHeader().numTextures);
+}
+
+const Overlay* Reader::getOverlays() const
+{
+	return section<Overlay>(getHeader().overlaysOffset, getHeader().numOverlays);
+}
+
+const InstanceGroup* Reader::getGroups() const
+{
+	return section<InstanceGroup>(getHeader().groupsOffset, getHeader().numGroups);
+}
+
+const InstanceTransform* Reader::getTransforms() const
+{
+	return section<InstanceTransform>(getHeader().transformsOffset, getHeader().numTransforms);
+}
+
+std::string Reader::getString(const String& s) const
+{
+	return std::string(mData + getHeader().stringsOffset + s.offset, s.length);
+}
+
+}
+
+}
+
@@ -0,0 +1,155 @@
+#ifndef SCENE_SCENEFILE_H
+#define SCENE_SCENEFILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "TransformKernels.h"
+
+namespace Scene {
+
+// The binary scene file written by Scene::saveScene(). It is read by
+// mapping it into memory: the records are used in place and the
+// transforms of an instance group are handed to the bulk instance
+// functions as they are, so loading doesn't depend on the number of
+// instances beyond copying their transforms once.
+//
+// Layout: the header, then the sections it points to, each an array
+// of the records below. Strings are kept in one section and referred
+// to by offset and length. Everything is in the byte order of the
+// machine that wrote it; the magic number tells if that differs.
+namespace SceneFile {
+
+// "SSCN"
+static const uint32_t Magic = 0x4e435353;
+static const uint32_t Version = 1;
+
+struct String {
+	uint32_t offset;
+	uint32_t length;
+};
+
+// a model or texture and the file it is loaded from
+struct Resource {
+	String name;
+	String filename;
+};
+
+struct Overlay {
+	String name;
+	String filename;
+	uint32_t enabled;
+	uint32_t x, y, w, h;
+	float depth;
+};
+
+// instances with the same model, texture and flags. A group with a
+// name has a single instance, added with Scene::addMeshInstance().
+struct InstanceGroup {
+	uint32_t model;
+	uint32_t texture;
+	// InstanceBackfaceCulling and InstanceBlending
+	uint32_t flags;
+	uint32_t count;
+	uint32_t firstTransform;
+	String name;
+};
+
+struct Light {
+	float color[3];
+	uint32_t on;
+};
+
+struct Header {
+	uint32_t magic;
+	uint32_t version;
+
+	// sections: offset in bytes from the start of the file and number
+	// of records, or bytes for the strings
+	uint64_t modelsOffset;
+	uint64_t texturesOffset;
+	uint64_t overlaysOffset;
+	uint64_t groupsOffset;
+	uint64_t transformsOffset;
+	uint64_t stringsOffset;
+	uint32_t numModels;
+	uint32_t numTextures;
+	uint32_t numOverlays;
+	uint32_t numGroups;
+	uint32_t numTransforms;
+	uint32_t stringsSize;
+
+	InstanceTransform camera;
+	float fov;
+	float zFar;
+	uint8_t clearColor[4];
+
+	Light ambientLight;
+	Light directionalLight;
+	float lightDirection[3];
+	Light pointLight;
+	float lightPosition[3];
+	float lightAttenuation[3];
+};
+
+// Collects the sections and writes them out
+class Writer {
+	public:
+		Writer();
+		String addString(const std::string& s);
+		uint32_t addModel(const std::string& name, const std::string& filename);
+		uint32_t addTexture(const std::string& name, const std::string& filename);
+		void addOverlay(const Overlay& ov);
+		// the name is empty for groups of unnamed instances
+		void addGroup(uint32_t model, uint32_t texture, uint32_t flags,
+				const InstanceTransform* transforms, size_t count,
+				const std::string& name = std::string());
+		Header& getHeader();
+		// throws if the file can't be written
+		void write(const std::string& filename);
+
+	private:
+		Header mHeader;
+		std::vector<Resource> mModels;
+		std::vector<Resource> mTextures;
+		std::vector<Overlay> mOverlays;
+		std::vector<InstanceGroup> mGroups;
+		std::vector<InstanceTransform> mTransforms;
+		std::vector<char> mStrings;
+};
+
+// A scene file mapped into memory. The constructor checks that all the
+// records, strings and indices are within the file and throws if not,
+// so that the accessors needn't.
+class Reader {
+	public:
+		Reader(const std::string& filename);
+		~Reader();
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		const Header& getHeader() const;
+		const Resource* getModels() const;
+		const Resource* getTextures() const;
+		const Overlay* getOverlays() const;
+		const InstanceGroup* getGroups() const;
+		const InstanceTransform* getTransforms() const;
+		std::string getString(const String& s) const;
+
+	private:
+		template<typename T>
+		const T* section(uint64_t offset, uint64_t count) const;
+		void checkString(const String& s) const;
+
+		const char* mData = nullptr;
+		size_t mSize = 0;
+};
+
+}
+
+}
+
+#endif
+
@@ -0,0 +1,137 @@
+#include "ShaderVariants.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+
+namespace Scene {
+
+static const char* FeatureDefines[] = {
+	"AMBIENT_LIGHT",
+	"DIRECTIONAL_LIGHT",
+	"POINT_LIGHT",
+	"SHADOWS",
+	"ALPHA_TEST",
+	"VERTEX_COLOR",
+	"INSTANCING"
+};
+
+ShaderVariants::ShaderVariants(const char* vertexShader, const char* fragmentShader,
+		uint32_t usedFeatures, const Linker& linker)
+	: mVertexShader(vertexShader),
+	mFragmentShader(fragmentShader),
+	mUsedFeatures(usedFeatures),
+	mLinker(linker)
+{
+}
+
+ShaderVariants::~ShaderVariants()
+{
+	clearPending();
+	for(const auto& kv : mPrograms)
+		glDeleteProgram(kv.second);
+}
+
+GLuint ShaderVariants::get(uint32_t features)
+{
+	features &= mUsedFeatures;
+	auto it = mPrograms.find(features);
+	if(it != mPrograms.end())
+		return it->second;
+
+	std::string vs = addDefines(mVertexShader.c_str(), features);
+	std::string fs = addDefines(mFragmentShader.c_str(), features);
+	GLuint program = mLinker.begin(vs.c_str(), fs.c_str());
+	if(!mLinker.finish(program, vs.c_str(), fs.c_str()))
+		throw std::runtime_error("Error initialising 3D");
+	mPrograms.insert({features, program});
+	return program;
+}
+
+unsigned int ShaderVariants::getNumVariants() const
+{
+	return mPrograms.size();
+}
+
+void ShaderVariants::clearPending()
+{
+	for(const auto& kv : mPending)
+		glDeleteProgram(kv.second);
+	mPending.clear();
+	mReloading = false;
+}
+
+void ShaderVariants::reload(const std::string& vertexShader, const std::string& fragmentShader)
+{
+	clearPending();
+	mReloading = true;
+	mPendingVertexShader = vertexShader;
+	mPendingFragmentShader = fragmentShader;
+	for(const auto& kv : mPrograms) {
+		std::string vs = addDefines(vertexShader.c_str(), kv.first);
+		std::string fs = addDefines(fragmentShader.c_str(), kv.first);
+		mPending.insert({kv.first, mLinker.begin(vs.c_str(), fs.c_str())});
+	}
+}
+
+bool ShaderVariants::update()
+{
+	if(!mReloading)
+		return false;
+
+	// without parallel compilation the status queries below wait for the
+	// driver, so the programs are simply finished now
+	if(GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile) {
+		for(const auto& kv : mPending) {
+			GLint done = GL_FALSE;
+			glGetProgramiv(kv.second, GL_COMPLETION_STATUS_KHR, &done);
+			if(!done)
+				return false;
+		}
+	}
+
+	for(auto it = mPending.begin(); it != mPending.end(); ++it) {
+		std::string vs = addDefines(mPendingVertexShader.c_str(), it->first);
+		std::string fs = addDefines(mPendingFragmentShader.c_str(), it->first);
+		if(!mLinker.finish(it->second, vs.c_str(), fs.c_str())) {
+			// finish() has deleted the failed one
+			mPending.erase(it);
+			clearPending();
+			std::cerr << "Keeping the previous shader programs.\n";
+			return false;
+		}
+	}
+
+	// variants first asked for during the reload were built from the old
+	// sources; they are rebuilt when asked for again
+	for(const auto& kv : mPrograms)
+		glDeleteProgram(kv.second);
+	mPrograms.swap(mPending);
+	mPending.clear();
+	mVertexShader.swap(mPendingVertexShader);
+	mFragmentShader.swap(mPendingFragmentShader);
+	mReloading = false;
+	return true;
+}
+
+std::string ShaderVariants::addDefines(const char* source, uint32_t features)
+{
+	std::string defines;
+	for(unsigned int i = 0; i < sizeof(FeatureDefines) / sizeof(FeatureDefines[0]); i++) {
+		if(features & (1u << i)) {
+			defines += "#define ";
+			defines += FeatureDefines[i];
+			defines += "\n";
+		}
+	}
+
+	// #version has to stay the first line
+	const char* body = source;
+	if(strncmp(source, "#version", 8) == 0) {
+		body = strchr(source, '\n');
+		body = body ? body + 1 : source + strlen(source);
+	}
+	return std::string(source, body) + defines + body;
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef SCENE_SHADERVARIANTS_H
+#define SCENE_SHADERVARIANTS_H
+
+#include <map>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+namespace Scene {
+
+// Optional parts of a shader. Each is compiled in with a #define, so
+// that a program only contains the features it is used with.
+enum ShaderFeature : uint32_t {
+	ShaderAmbientLight     = 1 << 0,
+	ShaderDirectionalLight = 1 << 1,
+	ShaderPointLight       = 1 << 2,
+	ShaderShadows          = 1 << 3,
+	ShaderAlphaTest        = 1 << 4,
+	ShaderVertexColor      = 1 << 5,
+	// the world and normal matrices are per instance attributes
+	ShaderInstancing       = 1 << 6
+};
+
+// The programs built from one pair of shader sources, one per
+// combination of features. A variant is compiled the first time it is
+// asked for and kept for the lifetime of the object.
+//
+// The sources can be replaced at runtime. The variants are then rebuilt
+// in the background where the driver supports parallel compilation and
+// swapped in all at once by update(); if any fails to build, the old
+// programs stay in use.
+class ShaderVariants {
+	public:
+		struct Linker {
+			// starts compiling and linking a program from the given
+			// sources, which may still be going on when it returns
+			std::function<GLuint(const char* vertexShader, const char* fragmentShader)> begin;
+			// waits for the program and checks it. On errors it prints
+			// them, deletes the program and returns false.
+			std::function<bool(GLuint program, const char* vertexShader, const char* fragmentShader)> finish;
+		};
+
+		// features outside of usedFeatures are ignored by get(), so
+		// that they don't create identical programs
+		ShaderVariants(const char* vertexShader, const char* fragmentShader,
+				uint32_t usedFeatures, const Linker& linker);
+		~ShaderVariants();
+		ShaderVariants(const ShaderVariants&) = delete;
+		ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+		// throws if the variant fails to build
+		GLuint get(uint32_t features);
+		unsigned int getNumVariants() const;
+
+		// starts rebuilding the variants from new sources, replacing a
+		// reload still in progress
+		void reload(const std::string& vertexShader, const std::string& fragmentShader);
+		// call between frames. Returns true if the rebuilt programs were
+		// swapped in, which makes the handles from get() invalid.
+		bool update();
+
+		// the source with a #define for each feature, placed after the
+		// #version line if there is one
+		static std::string addDefines(const char* source, uint32_t features);
+
+	private:
+		void clearPending();
+
+		std::string mVertexShader;
+		std::string mFragmentShader;
+		uint32_t mUsedFeatures;
+		Linker mLinker;
+		std::map<uint32_t, GLuint> mPrograms;
+
+		// the reload in progress
+		bool mReloading = false;
+		std::string mPendingVertexShader;
+		std::string mPendingFragmentShader;
+		std::map<uint32_t, GLuint> mPending;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,247 @@
+#include "ShadowMap.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "common/Math.h"
+
+using namespace Common;
+
+namespace Scene {
+
+const unsigned int ShadowSettings::MaxCascades;
+
+CascadedShadowMap::CascadedShadowMap()
+{
+	for(unsigned int i = 0; i < ShadowSettings::MaxCascades; i++) {
+		mLightViewProjection[i] = Matrix44::Identity;
+		mShadowMatrix[i] = Matrix44::Identity;
+		mSplits[i] = 0.0f;
+	}
+}
+
+CascadedShadowMap::~CascadedShadowMap()
+{
+	deleteTexture();
+	if(mFramebuffer)
+		glDeleteFramebuffers(1, &mFramebuffer);
+}
+
+void CascadedShadowMap::init()
+{
+	mSupported = GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+	if(!mSupported)
+		return;
+
+	glGenFramebuffers(1, &mFramebuffer);
+	setSettings(mSettings);
+}
+
+bool CascadedShadowMap::isSupported() const
+{
+	return mSupported;
+}
+
+void CascadedShadowMap::setSettings(const ShadowSettings& s)
+{
+	mSettings = s;
+	mSettings.numCascades = std::max(1u, std::min(mSettings.numCascades, ShadowSettings::MaxCascades));
+	mSettings.resolution = std::max(16u, mSettings.resolution);
+
+	if(!mSupported || !mSettings.enabled)
+		return;
+
+	// all cascades have to fit in one texture row
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if(maxSize > 0)
+		mSettings.resolution = std::min<unsigned int>(mSettings.resolution, maxSize / mSettings.numCascades);
+
+	if(mTexture && mTextureCascades == mSettings.numCascades &&
+			mTextureResolution == mSettings.resolution)
+		return;
+
+	deleteTexture();
+	createTexture();
+}
+
+const ShadowSettings& CascadedShadowMap::getSettings() const
+{
+	return mSettings;
+}
+
+void CascadedShadowMap::createTexture()
+{
+	mTextureCascades = mSettings.numCascades;
+	mTextureResolution = mSettings.resolution;
+
+	glGenTextures(1, &mTexture);
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, getTextureWidth(), getTextureHeight(),
+			0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	// linear filtering with depth comparison gives bilinear PCF for free
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		deleteTexture();
+		throw std::runtime_error("Unable to create the shadow map framebuffer\n");
+	}
+}
+
+void CascadedShadowMap::deleteTexture()
+{
+	if(mTexture) {
+		glDeleteTextures(1, &mTexture);
+		mTexture = 0;
+	}
+	mTextureCascades = 0;
+	mTextureResolution = 0;
+}
+
+void CascadedShadowMap::update(const Vector3& cameraPosition, const Vector3& forward,
+		float fov, float aspectRatio, float znear, float zfar,
+		const Vector3& lightDirection)
+{
+	const unsigned int n = mSettings.numCascades;
+	const float shadowFar = std::max(znear, std::min(zfar, mSettings.distance));
+	const float tanY = std::tan(Math::degreesToRadians(fov * 0.5f));
+	const float tanX = tanY * aspectRatio;
+	// squared distance from the view axis of a frustum corner at depth 1
+	const float k2 = tanX * tanX + tanY * tanY;
+	const Vector3 dir = forward.normalized();
+
+	// the light space axes only depend on the light
+	const Vector3 lz = lightDirection.normalized();
+	const Vector3 up = std::fabs(lz.y) < 0.99f ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+	const Vector3 lx = up.cross(lz).normalized();
+	const Vector3 ly = lz.cross(lx);
+
+	float prev = znear;
+	for(unsigned int i = 0; i < n; i++) {
+		float t = float(i + 1) / n;
+		float logSplit = znear * std::pow(shadowFar / znear, t);
+		float linSplit = znear + (shadowFar - znear) * t;
+		float f = mSettings.splitLambda * logSplit + (1.0f - mSettings.splitLambda) * linSplit;
+		mSplits[i] = f;
+
+		// smallest sphere around the slice [prev, f] with its center on
+		// the view axis. Its radius doesn't depend on the camera
+		// orientation.
+		float z = (f + prev) * (1.0f + k2) * 0.5f;
+		float r;
+		if(z >= f) {
+			z = f;
+			r = f * std::sqrt(k2);
+		} else {
+			r = std::sqrt((f - z) * (f - z) + f * f * k2);
+		}
+		prev = f;
+
+		// snap the center to whole texels so that moving the camera
+		// doesn't make the shadow edges shimmer. The cascade is made one
+		// texel larger on each side to still cover the sphere.
+		r *= float(mSettings.resolution) / (mSettings.resolution - 2);
+		Vector3 center = cameraPosition + dir * z;
+		float texel = 2.0f * r / mSettings.resolution;
+		float cx = std::floor(center.dot(lx) / texel) * texel;
+		float cy = std::floor(center.dot(ly) / texel) * texel;
+		float cz = center.dot(lz);
+		float nearZ = cz - r - mSettings.casterDistance;
+		float farZ = cz + r;
+		float depth = farZ - nearZ;
+
+		Matrix44& m = mLightViewProjection[i];
+		m = Matrix44::Identity;
+		m.m[0 * 4 + 0] = lx.x / r;
+		m.m[1 * 4 + 0] = lx.y / r;
+		m.m[2 * 4 + 0] = lx.z / r;
+		m.m[3 * 4 + 0] = -cx / r;
+		m.m[0 * 4 + 1] = ly.x / r;
+		m.m[1 * 4 + 1] = ly.y / r;
+		m.m[2 * 4 + 1] = ly.z / r;
+		m.m[3 * 4 + 1] = -cy / r;
+		m.m[0 * 4 + 2] = 2.0f * lz.x / depth;
+		m.m[1 * 4 + 2] = 2.0f * lz.y / depth;
+		m.m[2 * 4 + 2] = 2.0f * lz.z / depth;
+		m.m[3 * 4 + 2] = -2.0f * nearZ / depth - 1.0f;
+
+		// clip space to [0, 1], with x moved to the cascade's column
+		Matrix44& s = mShadowMatrix[i];
+		for(int row = 0; row < 4; row++) {
+			const float* src = &m.m[row * 4];
+			float* dst = &s.m[row * 4];
+			dst[0] = (src[0] * 0.5f + src[3] * (0.5f + i)) / n;
+			dst[1] = src[1] * 0.5f + src[3] * 0.5f;
+			dst[2] = src[2] * 0.5f + src[3] * 0.5f;
+			dst[3] = src[3];
+		}
+	}
+}
+
+unsigned int CascadedShadowMap::getNumCascades() const
+{
+	return mSettings.numCascades;
+}
+
+const Matrix44& CascadedShadowMap::getLightViewProjection(unsigned int cascade) const
+{
+	return mLightViewProjection[cascade];
+}
+
+const Matrix44& CascadedShadowMap::getShadowMatrix(unsigned int cascade) const
+{
+	return mShadowMatrix[cascade];
+}
+
+const float* CascadedShadowMap::getSplits() const
+{
+	return mSplits;
+}
+
+void CascadedShadowMap::begin()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glViewport(0, 0, getTextureWidth(), getTextureHeight());
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void CascadedShadowMap::beginCascade(unsigned int cascade)
+{
+	glViewport(cascade * mTextureResolution, 0, mTextureResolution, mTextureResolution);
+}
+
+void CascadedShadowMap::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+GLuint CascadedShadowMap::getTexture() const
+{
+	return mTexture;
+}
+
+unsigned int CascadedShadowMap::getTextureWidth() const
+{
+	return mTextureResolution * mTextureCascades;
+}
+
+unsigned int CascadedShadowMap::getTextureHeight() const
+{
+	return mTextureResolution;
+}
+
+}
+
@@ -0,0 +1,103 @@
+#ifndef SCENE_SHADOWMAP_H
+#define SCENE_SHADOWMAP_H
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "common/Vector3.h"
+#include "common/Matrix44.h"
+
+namespace Scene {
+
+struct ShadowSettings {
+	bool enabled = false;
+	// 1 to MaxCascades
+	unsigned int numCascades = 4;
+	// width and height of each cascade in texels
+	unsigned int resolution = 1024;
+	// PCF kernel of (2 * pcfRadius + 1)^2 taps, each filtered bilinearly
+	// by the hardware. 0 gives a single tap.
+	unsigned int pcfRadius = 1;
+	// shadows are drawn up to this distance from the camera
+	float distance = 100.0f;
+	// 0 splits the cascades evenly, 1 logarithmically
+	float splitLambda = 0.75f;
+	// how far behind a cascade objects still cast shadows into it
+	float casterDistance = 100.0f;
+	// glPolygonOffset() in the depth pass against shadow acne
+	float depthBias = 2.0f;
+	float slopeBias = 2.0f;
+
+	static const unsigned int MaxCascades = 4;
+};
+
+// Cascaded shadow map of the directional light. All cascades share one
+// depth texture side by side, so that the scene shader only needs one
+// sampler.
+//
+// Each cascade is fitted to the bounding sphere of its slice of the view
+// frustum, which doesn't change as the camera turns, and its position is
+// snapped to whole texels in light space. Shadow edges therefore don't
+// shimmer as the camera moves.
+class CascadedShadowMap {
+	public:
+		CascadedShadowMap();
+		~CascadedShadowMap();
+		CascadedShadowMap(const CascadedShadowMap&) = delete;
+		CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+		// must be called with a current GL context. Needs framebuffer
+		// objects; isSupported() returns false without them.
+		void init();
+		bool isSupported() const;
+
+		// recreates the texture if the cascade count or the resolution
+		// has changed
+		void setSettings(const ShadowSettings& s);
+		const ShadowSettings& getSettings() const;
+
+		// fits the cascades to the view described by the camera
+		// parameters. fov is the vertical field of view in degrees.
+		void update(const Common::Vector3& cameraPosition, const Common::Vector3& forward,
+				float fov, float aspectRatio, float znear, float zfar,
+				const Common::Vector3& lightDirection);
+
+		unsigned int getNumCascades() const;
+		// view-projection of the cascade for the depth pass
+		const Common::Matrix44& getLightViewProjection(unsigned int cascade) const;
+		// world space to shadow map coordinates, including the position
+		// of the cascade in the texture
+		const Common::Matrix44& getShadowMatrix(unsigned int cascade) const;
+		// far distance of each cascade along the view direction
+		const float* getSplits() const;
+
+		// binds the framebuffer and clears it
+		void begin();
+		// sets the viewport to the cascade
+		void beginCascade(unsigned int cascade);
+		// binds the default framebuffer again; the viewport is left as is
+		void end();
+		GLuint getTexture() const;
+		unsigned int getTextureWidth() const;
+		unsigned int getTextureHeight() const;
+
+	private:
+		void createTexture();
+		void deleteTexture();
+
+		ShadowSettings mSettings;
+		bool mSupported = false;
+		GLuint mFramebuffer = 0;
+		GLuint mTexture = 0;
+		unsigned int mTextureCascades = 0;
+		unsigned int mTextureResolution = 0;
+
+		Common::Matrix44 mLightViewProjection[ShadowSettings::MaxCascades];
+		Common::Matrix44 mShadowMatrix[ShadowSettings::MaxCascades];
+		float mSplits[ShadowSettings::MaxCascades];
+};
+
+}
+
+#endif
+
@@ -0,0 +1,610 @@
+#include "TextureLoader.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+
+#include "HelperFunctions.h"
+
+namespace Scene {
+
+// bump when the transcoded files change, so that old ones are ignored
+static const uint64_t TranscodeVersion = 1;
+
+static const unsigned char KTXIdentifier[12] = {
+	0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+struct FormatInfo {
+	GLenum format;
+	GLenum baseFormat;
+	// bytes per 4x4 block
+	unsigned int blockSize;
+	bool alpha;
+};
+
+static const FormatInfo Formats[] = {
+	{ GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_RGB, 8, false },
+	{ GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_RGBA, 8, true },
+	{ GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_RGBA, 16, true },
+	{ GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_RGBA, 16, true },
+	{ GL_COMPRESSED_RED_RGTC1, GL_RED, 8, false },
+	{ GL_COMPRESSED_RG_RGTC2, GL_RG, 16, false },
+	{ GL_COMPRESSED_RGB8_ETC2, GL_RGB, 8, false },
+	{ GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, GL_RGBA, 8, true },
+	{ GL_COMPRESSED_RGBA8_ETC2_EAC, GL_RGBA, 16, true },
+	{ GL_COMPRESSED_R11_EAC, GL_RED, 8, false },
+	{ GL_COMPRESSED_RG11_EAC, GL_RG, 16, false }
+};
+
+static const FormatInfo* findFormat(GLenum format)
+{
+	for(const auto& f : Formats) {
+		if(f.format == format)
+			return &f;
+	}
+	return nullptr;
+}
+
+static size_t levelSize(const FormatInfo& f, unsigned int width, unsigned int height)
+{
+	return size_t(std::max(1u, (width + 3) / 4)) * std::max(1u, (height + 3) / 4) * f.blockSize;
+}
+
+static unsigned int maxLevels(unsigned int width, unsigned int height)
+{
+	unsigned int levels = 1;
+	for(unsigned int s = std::max(width, height); s > 1; s >>= 1)
+		levels++;
+	return levels;
+}
+
+static uint32_t fourCC(const char* s)
+{
+	return uint32_t(uint8_t(s[0])) | uint32_t(uint8_t(s[1])) << 8 |
+		uint32_t(uint8_t(s[2])) << 16 | uint32_t(uint8_t(s[3])) << 24;
+}
+
+// lower case, with the dot
+static std::string extension(const std::string& filename)
+{
+	std::string ext = filename.substr(std::min(filename.size(), filename.rfind('.')));
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext;
+}
+
+static std::vector<char> readBinary(const std::string& filename)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	if(!ifs)
+		throw std::runtime_error("Unable to open " + filename + "\n");
+	return std::vector<char>((std::istreambuf_iterator<char>(ifs)),
+			std::istreambuf_iterator<char>());
+}
+
+// copies the levels, which follow each other in data without sizes
+static void readLevels(CompressedImage& image, const std::vector<char>& data, size_t offset,
+		unsigned int numLevels, const std::string& filename)
+{
+	const FormatInfo* f = findFormat(image.format);
+	if(!f)
+		throw std::runtime_error("Unknown texture format in " + filename + "\n");
+	if(image.width == 0 || image.height == 0)
+		throw std::runtime_error("Empty texture in " + filename + "\n");
+	numLevels = std::min(std::max(numLevels, 1u), maxLevels(image.width, image.height));
+
+	for(unsigned int i = 0; i < numLevels; i++) {
+		size_t size = levelSize(*f, std::max(1u, image.width >> i), std::max(1u, image.height >> i));
+		if(offset + size > data.size())
+			throw std::runtime_error("Truncated texture file " + filename + "\n");
+		image.levels.emplace_back(data.begin() + offset, data.begin() + offset + size);
+		offset += size;
+	}
+}
+
+GPUTexture::GPUTexture(GLuint texture, const CompressedImage& image, unsigned int baseLevel,
+		const std::string& source)
+	: mTexture(texture),
+	mFormat(image.format),
+	mMemorySize(0),
+	mAlpha(findFormat(image.format)->alpha),
+	mSource(source),
+	mWidth(image.width),
+	mHeight(image.height),
+	mNumLevels(image.levels.size()),
+	mBaseLevel(baseLevel)
+{
+	for(unsigned int i = baseLevel; i < mNumLevels; i++)
+		mMemorySize += getLevelSize(i);
+}
+
+GPUTexture::GPUTexture(const boost::shared_ptr<Common::Texture>& image, size_t memorySize, bool alpha)
+	: mTexture(image->getTexture()),
+	mFormat(0),
+	mMemorySize(memorySize),
+	mAlpha(alpha),
+	mImage(image)
+{
+}
+
+GPUTexture::~GPUTexture()
+{
+	if(!mImage)
+		glDeleteTextures(1, &mTexture);
+}
+
+GLuint GPUTexture::getTexture() const
+{
+	return mTexture;
+}
+
+GLenum GPUTexture::getFormat() const
+{
+	return mFormat;
+}
+
+size_t GPUTexture::getMemorySize() const
+{
+	return mMemorySize;
+}
+
+bool GPUTexture::hasAlpha() const
+{
+	return mAlpha;
+}
+
+bool GPUTexture::isStreamable() const
+{
+	return !mSource.empty() && mNumLevels > 1;
+}
+
+const std::string& GPUTexture::getSource() const
+{
+	return mSource;
+}
+
+unsigned int GPUTexture::getWidth() const
+{
+	return mWidth;
+}
+
+unsigned int GPUTexture::getHeight() const
+{
+	return mHeight;
+}
+
+unsigned int GPUTexture::getNumLevels() const
+{
+	return mNumLevels;
+}
+
+unsigned int GPUTexture::getBaseLevel() const
+{
+	return mBaseLevel;
+}
+
+size_t GPUTexture::getLevelSize(unsigned int level) const
+{
+	const FormatInfo* f = findFormat(mFormat);
+	if(!f)
+		return 0;
+	return levelSize(*f, std::max(1u, mWidth >> level), std::max(1u, mHeight >> level));
+}
+
+unsigned int GPUTexture::getLevelForSize(unsigned int size) const
+{
+	unsigned int level = 0;
+	while(level + 1 < mNumLevels && std::max(mWidth >> level, mHeight >> level) > size)
+		level++;
+	return level;
+}
+
+void GPUTexture::evictLevels(unsigned int baseLevel)
+{
+	baseLevel = std::min(baseLevel, mNumLevels - 1);
+	if(!isStreamable() || baseLevel <= mBaseLevel)
+		return;
+
+	// the base level first so that the texture stays complete
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+	for(unsigned int i = mBaseLevel; i < baseLevel; i++) {
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, mFormat, 0, 0, 0, 0, NULL);
+		mMemorySize -= getLevelSize(i);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	mBaseLevel = baseLevel;
+}
+
+void GPUTexture::uploadLevels(const CompressedImage& image, unsigned int baseLevel)
+{
+	if(baseLevel >= mBaseLevel)
+		return;
+	if(image.format != mFormat || image.width != mWidth || image.height != mHeight ||
+			image.levels.size() < mBaseLevel)
+		throw std::runtime_error("Texture " + mSource + " has changed\n");
+
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	for(unsigned int i = baseLevel; i < mBaseLevel; i++) {
+		const auto& level = image.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, mFormat,
+				std::max(1u, mWidth >> i), std::max(1u, mHeight >> i), 0,
+				level.size(), &level[0]);
+		mMemorySize += level.size();
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	mBaseLevel = baseLevel;
+}
+
+void TextureLoader::setCacheDirectory(const std::string& directory)
+{
+	mCacheDirectory = directory;
+}
+
+void TextureLoader::init()
+{
+	mS3TC = GLEW_EXT_texture_compression_s3tc;
+	mRGTC = GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+	mETC2 = GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility;
+}
+
+bool TextureLoader::isSupported(GLenum format) const
+{
+	switch(format) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			return mS3TC;
+		case GL_COMPRESSED_RED_RGTC1:
+		case GL_COMPRESSED_RG_RGTC2:
+			return mRGTC;
+		case GL_COMPRESSED_RGB8_ETC2:
+		case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+		case GL_COMPRESSED_RGBA8_ETC2_EAC:
+		case GL_COMPRESSED_R11_EAC:
+		case GL_COMPRESSED_RG11_EAC:
+			return mETC2;
+		default:
+			return false;
+	}
+}
+
+std::string TextureLoader::getKey(const std::string& filename) const
+{
+	std::string key = HelperFunctions::canonicalPath(filename);
+	std::string ext = extension(filename);
+	if(ext != ".dds" && ext != ".ktx" && !mCacheDirectory.empty() && mS3TC)
+		key += "|transcoded";
+	return key;
+}
+
+unsigned int TextureLoader::getCacheHits() const
+{
+	return mCacheHits;
+}
+
+unsigned int TextureLoader::getCacheMisses() const
+{
+	return mCacheMisses;
+}
+
+boost::shared_ptr<GPUTexture> TextureLoader::load(const std::string& filename, unsigned int maxSize)
+{
+	std::string ext = extension(filename);
+	if(ext == ".dds" || ext == ".ktx") {
+		CompressedImage image = readImage(filename);
+		if(!isSupported(image.format))
+			throw std::runtime_error("Unsupported texture format in " + filename + "\n");
+		return upload(image, filename, maxSize);
+	}
+
+	if(mCacheDirectory.empty() || !mS3TC)
+		return decode(filename);
+
+	// keyed by the contents so that changed images are transcoded again
+	std::vector<char> data = readBinary(filename);
+	uint64_t h = 14695981039346656037ull ^ TranscodeVersion;
+	for(char c : data) {
+		h ^= uint8_t(c);
+		h *= 1099511628211ull;
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.ktx", static_cast<unsigned long long>(h));
+	std::string cachePath = mCacheDirectory + "/" + name;
+
+	if(std::ifstream(cachePath).good()) {
+		try {
+			CompressedImage image = readKTX(cachePath);
+			if(isSupported(image.format)) {
+				mCacheHits++;
+				return upload(image, cachePath, maxSize);
+			}
+		} catch(const std::exception& e) {
+			std::cerr << "Ignoring cached texture: " << e.what();
+		}
+	}
+	mCacheMisses++;
+	return transcode(filename, cachePath, maxSize);
+}
+
+boost::shared_ptr<GPUTexture> TextureLoader::upload(const CompressedImage& image, const std::string& source,
+		unsigned int maxSize) const
+{
+	// the levels larger than maxSize are streamed in later
+	unsigned int baseLevel = 0;
+	if(maxSize) {
+		while(baseLevel + 1 < image.levels.size() &&
+				std::max(image.width >> baseLevel, image.height >> baseLevel) > maxSize)
+			baseLevel++;
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	for(unsigned int i = baseLevel; i < image.levels.size(); i++) {
+		const auto& level = image.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, image.format,
+				std::max(1u, image.width >> i), std::max(1u, image.height >> i), 0,
+				level.size(), &level[0]);
+	}
+
+	// files may stop before the 1x1 level
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return boost::shared_ptr<GPUTexture>(new GPUTexture(texture, image, baseLevel, source));
+}
+
+boost::shared_ptr<GPUTexture> TextureLoader::decode(const std::string& filename) const
+{
+	auto image = HelperFunctions::loadTexture(filename);
+	GLint width = 0;
+	GLint height = 0;
+	GLint alphaSize = 0;
+	glBindTexture(GL_TEXTURE_2D, image->getTexture());
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_ALPHA_SIZE, &alphaSize);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// RGBA, plus a third for the mip chain if there is one
+	size_t memorySize = size_t(width) * height * 4;
+	if(GLEW_VERSION_3_0)
+		memorySize += memorySize / 3;
+	return boost::shared_ptr<GPUTexture>(new GPUTexture(image, memorySize, alphaSize > 0));
+}
+
+boost::shared_ptr<GPUTexture> TextureLoader::transcode(const std::string& filename,
+		const std::string& cachePath, unsigned int maxSize) const
+{
+	// the driver compresses the decoded levels as they are uploaded
+	auto decoded = decode(filename);
+	GLuint source = decoded->getTexture();
+	CompressedImage image;
+	image.format = decoded->hasAlpha() ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	const FormatInfo& f = *findFormat(image.format);
+
+	GLint width = 0;
+	GLint height = 0;
+	glBindTexture(GL_TEXTURE_2D, source);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	image.width = width;
+	image.height = height;
+	unsigned int numLevels = GLEW_VERSION_3_0 ? maxLevels(width, height) : 1;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	std::vector<unsigned char> pixels;
+	// tightly packed rows, restored before returning
+	GLint packAlignment = 4;
+	GLint unpackAlignment = 4;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+	auto restoreAlignment = [&] () {
+		glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+	};
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(unsigned int i = 0; i < numLevels; i++) {
+		unsigned int w = std::max(1u, image.width >> i);
+		unsigned int h = std::max(1u, image.height >> i);
+		pixels.resize(size_t(w) * h * 4);
+		glBindTexture(GL_TEXTURE_2D, source);
+		glGetTexImage(GL_TEXTURE_2D, i, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, i, image.format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		GLint compressed = GL_FALSE;
+		GLint size = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED, &compressed);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+		if(!compressed || size_t(size) != levelSize(f, w, h)) {
+			std::cerr << "Unable to compress " << filename << ", using it uncompressed.\n";
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glDeleteTextures(1, &texture);
+			restoreAlignment();
+			return decoded;
+		}
+		image.levels.emplace_back(size);
+		glGetCompressedTexImage(GL_TEXTURE_2D, i, &image.levels.back()[0]);
+	}
+	restoreAlignment();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// a failed write only means transcoding again next time, and that
+	// the levels can't be streamed
+	std::string stored = cachePath;
+	try {
+		writeKTX(cachePath, image);
+	} catch(const std::exception& e) {
+		std::cerr << e.what();
+		stored.clear();
+	}
+	boost::shared_ptr<GPUTexture> result(new GPUTexture(texture, image, 0, stored));
+	if(maxSize)
+		result->evictLevels(result->getLevelForSize(maxSize));
+	return result;
+}
+
+CompressedImage TextureLoader::readImage(const std::string& filename)
+{
+	return extension(filename) == ".dds" ? readDDS(filename) : readKTX(filename);
+}
+
+CompressedImage TextureLoader::readDDS(const std::string& filename)
+{
+	static const size_t HeaderSize = 4 + 124;
+	static const size_t DX10HeaderSize = 20;
+	static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	static const uint32_t DDPF_ALPHAPIXELS = 0x1;
+	static const uint32_t DDPF_FOURCC = 0x4;
+
+	std::vector<char> data = readBinary(filename);
+	if(data.size() < HeaderSize || memcmp(&data[0], "DDS ", 4) != 0)
+		throw std::runtime_error("Not a DDS file: " + filename + "\n");
+
+	// the header as 31 dwords: flags at 1, height and width at 2 and 3,
+	// the mip count at 6 and the pixel format from 18
+	uint32_t header[31];
+	memcpy(header, &data[4], sizeof(header));
+	const uint32_t pfFlags = header[19];
+	const uint32_t pfFourCC = header[20];
+
+	CompressedImage image;
+	image.height = header[2];
+	image.width = header[3];
+	size_t offset = HeaderSize;
+
+	if(pfFlags & DDPF_FOURCC) {
+		if(pfFourCC == fourCC("DXT1"))
+			image.format = (pfFlags & DDPF_ALPHAPIXELS) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT :
+				GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		else if(pfFourCC == fourCC("DXT3"))
+			image.format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+		else if(pfFourCC == fourCC("DXT5"))
+			image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		else if(pfFourCC == fourCC("ATI1") || pfFourCC == fourCC("BC4U"))
+			image.format = GL_COMPRESSED_RED_RGTC1;
+		else if(pfFourCC == fourCC("ATI2") || pfFourCC == fourCC("BC5U"))
+			image.format = GL_COMPRESSED_RG_RGTC2;
+		else if(pfFourCC == fourCC("DX10")) {
+			if(data.size() < HeaderSize + DX10HeaderSize)
+				throw std::runtime_error("Truncated texture file " + filename + "\n");
+			// DXGI_FORMAT, D3D10_RESOURCE_DIMENSION, misc flags, array size
+			uint32_t dx10[4];
+			memcpy(dx10, &data[HeaderSize], sizeof(dx10));
+			if(dx10[1] != 3 || dx10[3] > 1)
+				throw std::runtime_error("Only 2D textures are supported: " + filename + "\n");
+			switch(dx10[0]) {
+				case 71: image.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+				case 74: image.format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+				case 77: image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+				case 80: image.format = GL_COMPRESSED_RED_RGTC1; break;
+				case 83: image.format = GL_COMPRESSED_RG_RGTC2; break;
+				default: break;
+			}
+			offset += DX10HeaderSize;
+		}
+	}
+
+	readLevels(image, data, offset, (header[1] & DDSD_MIPMAPCOUNT) ? header[6] : 1, filename);
+	return image;
+}
+
+CompressedImage TextureLoader::readKTX(const std::string& filename)
+{
+	static const size_t HeaderSize = sizeof(KTXIdentifier) + 13 * 4;
+
+	std::vector<char> data = readBinary(filename);
+	if(data.size() < HeaderSize || memcmp(&data[0], KTXIdentifier, sizeof(KTXIdentifier)) != 0)
+		throw std::runtime_error("Not a KTX file: " + filename + "\n");
+
+	// endianness, glType, glTypeSize, glFormat, glInternalFormat,
+	// glBaseInternalFormat, width, height, depth, array elements, faces,
+	// mip levels and the bytes of key/value data
+	uint32_t header[13];
+	memcpy(header, &data[sizeof(KTXIdentifier)], sizeof(header));
+	if(header[0] != 0x04030201)
+		throw std::runtime_error("KTX file has the wrong byte order: " + filename + "\n");
+	if(header[1] != 0 || header[8] > 1 || header[9] > 1 || header[10] != 1)
+		throw std::runtime_error("Only compressed 2D textures are supported: " + filename + "\n");
+
+	CompressedImage image;
+	image.format = header[4];
+	image.width = header[6];
+	image.height = header[7];
+	const FormatInfo* f = findFormat(image.format);
+	if(!f)
+		throw std::runtime_error("Unknown texture format in " + filename + "\n");
+	if(image.width == 0 || image.height == 0)
+		throw std::runtime_error("Empty texture in " + filename + "\n");
+
+	// each level has its size in front; compressed levels are always a
+	// multiple of four bytes, so there is no padding
+	size_t offset = HeaderSize + header[12];
+	unsigned int numLevels = std::min(std::max(header[11], 1u), maxLevels(image.width, image.height));
+	for(unsigned int i = 0; i < numLevels; i++) {
+		uint32_t imageSize = 0;
+		if(offset + 4 > data.size())
+			throw std::runtime_error("Truncated texture file " + filename + "\n");
+		memcpy(&imageSize, &data[offset], 4);
+		offset += 4;
+		if(imageSize != levelSize(*f, std::max(1u, image.width >> i), std::max(1u, image.height >> i)))
+			throw std::runtime_error("Wrong mip level size in " + filename + "\n");
+		if(offset + imageSize > data.size())
+			throw std::runtime_error("Truncated texture file " + filename + "\n");
+		image.levels.emplace_back(data.begin() + offset, data.begin() + offset + imageSize);
+		offset += imageSize;
+	}
+	return image;
+}
+
+void TextureLoader::writeKTX(const std::string& filename, const CompressedImage& image)
+{
+	const FormatInfo* f = findFormat(image.format);
+	if(!f || image.levels.empty())
+		throw std::runtime_error("Unable to write texture " + filename + "\n");
+
+	// written under another name first so that a concurrent load never
+	// sees half a file
+	std::string tmpPath = filename + ".tmp";
+	{
+		std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+		uint32_t header[13] = { 0x04030201, 0, 1, 0, image.format, f->baseFormat,
+			image.width, image.height, 0, 0, 1, uint32_t(image.levels.size()), 0 };
+		ofs.write(reinterpret_cast<const char*>(KTXIdentifier), sizeof(KTXIdentifier));
+		ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+		for(const auto& level : image.levels) {
+			uint32_t imageSize = level.size();
+			ofs.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+			ofs.write(&level[0], level.size());
+		}
+		if(!ofs) {
+			ofs.close();
+			std::remove(tmpPath.c_str());
+			throw std::runtime_error("Unable to write texture " + filename + "\n");
+		}
+	}
+	if(std::rename(tmpPath.c_str(), filename.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		throw std::runtime_error("Unable to write texture " + filename + "\n");
+	}
+}
+
+}
+
@@ -0,0 +1,133 @@
+#ifndef SCENE_TEXTURELOADER_H
+#define SCENE_TEXTURELOADER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/shared_ptr.hpp>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "common/Texture.h"
+
+namespace Scene {
+
+// The mip levels of a compressed texture as stored in DDS and KTX files,
+// largest first.
+struct CompressedImage {
+	GLenum format = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<std::vector<char>> levels;
+};
+
+// A texture object with its mip chain, either decoded from an image or
+// uploaded in a compressed format.
+//
+// Compressed textures that were loaded from a file can have their
+// largest levels left out: the levels below the base level are empty
+// and GL_TEXTURE_BASE_LEVEL keeps them from being sampled. The texture
+// object stays the same, so draws using it needn't know.
+class GPUTexture {
+	public:
+		// takes ownership of the texture, which has the levels of the
+		// image from baseLevel on. source is the file they can be read
+		// from again, or empty.
+		GPUTexture(GLuint texture, const CompressedImage& image, unsigned int baseLevel,
+				const std::string& source);
+		// keeps the decoded image, which owns the texture
+		GPUTexture(const boost::shared_ptr<Common::Texture>& image, size_t memorySize, bool alpha);
+		~GPUTexture();
+		GPUTexture(const GPUTexture&) = delete;
+		GPUTexture& operator=(const GPUTexture&) = delete;
+
+		GLuint getTexture() const;
+		// the internal format, or 0 for decoded images
+		GLenum getFormat() const;
+		// bytes of the resident mip levels
+		size_t getMemorySize() const;
+		bool hasAlpha() const;
+
+		// whether levels can be evicted and read back from the source
+		bool isStreamable() const;
+		const std::string& getSource() const;
+		unsigned int getWidth() const;
+		unsigned int getHeight() const;
+		unsigned int getNumLevels() const;
+		// the largest resident level
+		unsigned int getBaseLevel() const;
+		size_t getLevelSize(unsigned int level) const;
+		// the largest level whose sides are at most size
+		unsigned int getLevelForSize(unsigned int size) const;
+
+		// frees the levels larger than baseLevel
+		void evictLevels(unsigned int baseLevel);
+		// uploads the levels from baseLevel up to the resident ones from
+		// the image read from the source
+		void uploadLevels(const CompressedImage& image, unsigned int baseLevel);
+
+	private:
+		GLuint mTexture;
+		GLenum mFormat;
+		size_t mMemorySize;
+		bool mAlpha;
+		boost::shared_ptr<Common::Texture> mImage;
+		std::string mSource;
+		unsigned int mWidth = 0;
+		unsigned int mHeight = 0;
+		unsigned int mNumLevels = 1;
+		unsigned int mBaseLevel = 0;
+};
+
+// Loads the textures of the scene. DDS (BC1-BC5) and KTX files (the
+// same, or ETC2 where supported) are uploaded with their stored mip
+// chains. Other images are decoded; with a cache directory they are
+// compressed to BC1, or BC3 if they have alpha, by the driver the first
+// time and then loaded from the cache.
+class TextureLoader {
+	public:
+		// the directory must exist. Call before init().
+		void setCacheDirectory(const std::string& directory);
+		void init();
+		// throws if the file can't be loaded. With maxSize, compressed
+		// textures that can be streamed are uploaded without the levels
+		// larger than that.
+		boost::shared_ptr<GPUTexture> load(const std::string& filename, unsigned int maxSize = 0);
+		bool isSupported(GLenum format) const;
+		// identifies what load() makes of the file: its canonical path
+		// and the options that change the result
+		std::string getKey(const std::string& filename) const;
+
+		unsigned int getCacheHits() const;
+		unsigned int getCacheMisses() const;
+
+		// these throw on errors, including unknown formats
+		// readDDS() or readKTX() by the extension
+		static CompressedImage readImage(const std::string& filename);
+		static CompressedImage readDDS(const std::string& filename);
+		static CompressedImage readKTX(const std::string& filename);
+		static void writeKTX(const std::string& filename, const CompressedImage& image);
+
+	private:
+		boost::shared_ptr<GPUTexture> upload(const CompressedImage& image, const std::string& source,
+				unsigned int maxSize) const;
+		boost::shared_ptr<GPUTexture> decode(const std::string& filename) const;
+		// compresses the decoded image and stores it at cachePath
+		boost::shared_ptr<GPUTexture> transcode(const std::string& filename,
+				const std::string& cachePath, unsigned int maxSize) const;
+
+		std::string mCacheDirectory;
+		bool mS3TC = false;
+		bool mRGTC = false;
+		bool mETC2 = false;
+		unsigned int mCacheHits = 0;
+		unsigned int mCacheMisses = 0;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,230 @@
+#include "TextureResidency.h"
+
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <memory>
+
+#include "FrameStats.h"
+
+namespace Scene {
+
+// Entry::frameLevel of a texture not drawn with this frame
+static const unsigned int NotUsed = UINT_MAX;
+
+TextureResidency::TextureResidency(JobSystem* jobs)
+	: mJobs(jobs)
+{
+}
+
+void TextureResidency::setSettings(const TextureStreamingSettings& s)
+{
+	mSettings = s;
+}
+
+const TextureStreamingSettings& TextureResidency::getSettings() const
+{
+	return mSettings;
+}
+
+bool TextureResidency::isEnabled() const
+{
+	return mSettings.budget != 0;
+}
+
+void TextureResidency::add(const boost::shared_ptr<GPUTexture>& texture)
+{
+	if(!texture->isStreamable())
+		return;
+
+	Entry& e = mEntries[texture->getTexture()];
+	e.texture = texture;
+	e.lastUsed = mFrame;
+	e.wantedLevel = residentLevel(*texture);
+	e.frameLevel = NotUsed;
+}
+
+void TextureResidency::remove(GLuint texture)
+{
+	// a read in progress finds the entry gone
+	mEntries.erase(texture);
+}
+
+void TextureResidency::markUsed(GLuint texture, float screenSize)
+{
+	auto it = mEntries.find(texture);
+	if(it == mEntries.end())
+		return;
+
+	// the level with about one texel per pixel, taking the texture to
+	// be mapped once over the instance
+	Entry& e = it->second;
+	const GPUTexture& t = *e.texture;
+	float texels = std::max(t.getWidth(), t.getHeight());
+	float level = screenSize > 0.0f ? std::log2(texels / screenSize) + mSettings.mipBias : 0.0f;
+	unsigned int l = level > 0.0f ? std::min(static_cast<unsigned int>(level), t.getNumLevels() - 1) : 0;
+	e.frameLevel = std::min(e.frameLevel, l);
+}
+
+unsigned int TextureResidency::residentLevel(const GPUTexture& t) const
+{
+	return t.getLevelForSize(mSettings.residentSize);
+}
+
+unsigned int TextureResidency::targetLevel(const Entry& e) const
+{
+	if(mFrame - e.lastUsed > mSettings.unusedFrames)
+		return residentLevel(*e.texture);
+	return std::min(e.wantedLevel, residentLevel(*e.texture));
+}
+
+void TextureResidency::update(FrameStats& stats)
+{
+	mFrame++;
+	size_t resident = 0;
+	for(auto& kv : mEntries) {
+		Entry& e = kv.second;
+		if(e.frameLevel != NotUsed) {
+			e.wantedLevel = e.frameLevel;
+			e.lastUsed = mFrame;
+			e.frameLevel = NotUsed;
+		}
+		resident += e.texture->getMemorySize();
+	}
+
+	// the textures missing levels, most recently used and largest on
+	// screen first
+	std::vector<Entry*> wanted;
+	for(auto& kv : mEntries) {
+		Entry& e = kv.second;
+		if(!e.loading && !e.failed && e.texture->getBaseLevel() > targetLevel(e))
+			wanted.push_back(&e);
+	}
+	std::sort(wanted.begin(), wanted.end(), [] (const Entry* a, const Entry* b) {
+			return a->lastUsed != b->lastUsed ? a->lastUsed > b->lastUsed :
+				a->wantedLevel < b->wantedLevel;
+			});
+
+	auto missingBytes = [] (const GPUTexture& t, unsigned int level) {
+		size_t bytes = 0;
+		for(unsigned int i = level; i < t.getBaseLevel(); i++)
+			bytes += t.getLevelSize(i);
+		return bytes;
+	};
+
+	// at least one read a frame, however large
+	size_t needed = 0;
+	unsigned int numLoads = 0;
+	for(const Entry* e : wanted) {
+		size_t bytes = missingBytes(*e->texture, targetLevel(*e));
+		if(numLoads && needed + bytes > mSettings.maxStreamBytes)
+			break;
+		needed += bytes;
+		numLoads++;
+	}
+
+	evict(resident, needed, stats);
+
+	for(unsigned int i = 0; i < numLoads; i++) {
+		Entry& e = *wanted[i];
+		unsigned int level = targetLevel(e);
+		size_t bytes = missingBytes(*e.texture, level);
+		if(resident + mPendingBytes + bytes > mSettings.budget)
+			continue;
+		startLoad(e, level, bytes);
+	}
+
+	stats.textureBytesResident = resident;
+	stats.textureLevelsStreamed += mLevelsStreamed;
+	stats.bytesUploaded += mBytesStreamed;
+	mLevelsStreamed = 0;
+	mBytesStreamed = 0;
+}
+
+void TextureResidency::evict(size_t& resident, size_t needed, FrameStats& stats)
+{
+	if(resident + mPendingBytes + needed <= mSettings.budget)
+		return;
+
+	std::vector<Entry*> candidates;
+	for(auto& kv : mEntries) {
+		Entry& e = kv.second;
+		if(!e.loading && e.texture->getBaseLevel() < residentLevel(*e.texture))
+			candidates.push_back(&e);
+	}
+	std::sort(candidates.begin(), candidates.end(), [] (const Entry* a, const Entry* b) {
+			return a->lastUsed < b->lastUsed;
+			});
+
+	// one level at a time, largest first
+	auto evictTo = [&] (Entry& e, unsigned int level, size_t extra) {
+		GPUTexture& t = *e.texture;
+		while(t.getBaseLevel() < level && resident + mPendingBytes + extra > mSettings.budget) {
+			resident -= t.getLevelSize(t.getBaseLevel());
+			t.evictLevels(t.getBaseLevel() + 1);
+			mEvictions++;
+			stats.textureLevelsEvicted++;
+		}
+	};
+
+	// levels larger than needed, then the needed ones of the textures
+	// not drawn this frame, oldest first. The textures of this frame
+	// only lose levels if they don't fit in the budget by themselves.
+	for(Entry* e : candidates)
+		evictTo(*e, targetLevel(*e), needed);
+	for(Entry* e : candidates) {
+		if(e->lastUsed != mFrame)
+			evictTo(*e, residentLevel(*e->texture), needed);
+	}
+	for(Entry* e : candidates)
+		evictTo(*e, residentLevel(*e->texture), 0);
+}
+
+void TextureResidency::startLoad(Entry& e, unsigned int level, size_t bytes)
+{
+	e.loading = true;
+	mPendingBytes += bytes;
+
+	auto image = std::make_shared<CompressedImage>();
+	const std::string source = e.texture->getSource();
+	const GLuint name = e.texture->getTexture();
+	auto read = mJobs->schedule([=] { *image = TextureLoader::readImage(source); });
+	mJobs->scheduleOnMainThread([=] {
+			mPendingBytes -= bytes;
+			// the texture may have been removed since, and its name reused
+			auto it = mEntries.find(name);
+			if(it == mEntries.end() || it->second.texture->getSource() != source)
+				return;
+			Entry& entry = it->second;
+			entry.loading = false;
+			try {
+				// passes on a reading error
+				mJobs->wait(read);
+				unsigned int base = entry.texture->getBaseLevel();
+				size_t before = entry.texture->getMemorySize();
+				entry.texture->uploadLevels(*image, level);
+				mLevelsStreamed += base - entry.texture->getBaseLevel();
+				mBytesStreamed += entry.texture->getMemorySize() - before;
+			} catch(const std::exception& ex) {
+				std::cerr << "Unable to stream " << source << ": " << ex.what();
+				entry.failed = true;
+			}
+			}, { read });
+}
+
+size_t TextureResidency::getResidentBytes() const
+{
+	size_t bytes = 0;
+	for(const auto& kv : mEntries)
+		bytes += kv.second.texture->getMemorySize();
+	return bytes;
+}
+
+unsigned int TextureResidency::getEvictions() const
+{
+	return mEvictions;
+}
+
+}
+
@@ -0,0 +1,101 @@
+#ifndef SCENE_TEXTURERESIDENCY_H
+#define SCENE_TEXTURERESIDENCY_H
+
+#include <unordered_map>
+#include <cstddef>
+
+#include <boost/shared_ptr.hpp>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "TextureLoader.h"
+#include "JobSystem.h"
+
+namespace Scene {
+
+struct FrameStats;
+
+struct TextureStreamingSettings {
+	// bytes the streamed textures may use; 0 keeps all levels resident
+	size_t budget = 0;
+	// levels up to this size are never evicted, so that there is always
+	// something to draw with
+	unsigned int residentSize = 64;
+	// a texture not drawn with for this many frames only keeps those
+	unsigned int unusedFrames = 120;
+	// bytes of levels read and uploaded per frame at most
+	size_t maxStreamBytes = 4 << 20;
+	// added to the level picked from the screen size; positive values
+	// trade sharpness for memory
+	float mipBias = 0.0f;
+};
+
+// Keeps the streamable textures within a memory budget. The draws of
+// each frame mark the textures they use with their size on screen,
+// which decides the largest level a texture needs. Missing levels are
+// read on the worker threads and uploaded on the main thread; under
+// memory pressure levels are evicted, first those larger than needed,
+// then those of the least recently used textures.
+class TextureResidency {
+	public:
+		TextureResidency(JobSystem* jobs);
+		TextureResidency(const TextureResidency&) = delete;
+		TextureResidency& operator=(const TextureResidency&) = delete;
+
+		void setSettings(const TextureStreamingSettings& s);
+		const TextureStreamingSettings& getSettings() const;
+		bool isEnabled() const;
+
+		// textures that aren't streamable are ignored
+		void add(const boost::shared_ptr<GPUTexture>& texture);
+		// before the texture is deleted
+		void remove(GLuint texture);
+		// a draw with the texture covering about screenSize pixels
+		void markUsed(GLuint texture, float screenSize);
+		// once a frame after the draws have been marked. Evicts and
+		// starts streaming; the counters go to stats.
+		void update(FrameStats& stats);
+
+		size_t getResidentBytes() const;
+		unsigned int getEvictions() const;
+
+	private:
+		struct Entry {
+			boost::shared_ptr<GPUTexture> texture;
+			unsigned int lastUsed = 0;
+			// the largest level needed when last drawn with, and the
+			// one being gathered this frame
+			unsigned int wantedLevel = 0;
+			unsigned int frameLevel = 0;
+			// a read of the missing levels is in progress
+			bool loading = false;
+			// the source couldn't be read
+			bool failed = false;
+		};
+
+		// the largest level the entry should have resident
+		unsigned int targetLevel(const Entry& e) const;
+		unsigned int residentLevel(const GPUTexture& t) const;
+		// evicts until resident plus needed fits in the budget or only
+		// the needed levels of the textures drawn this frame are left
+		void evict(size_t& resident, size_t needed, FrameStats& stats);
+		// reads the levels from level up to the resident ones
+		void startLoad(Entry& e, unsigned int level, size_t bytes);
+
+		JobSystem* mJobs;
+		TextureStreamingSettings mSettings;
+		std::unordered_map<GLuint, Entry> mEntries;
+		unsigned int mFrame = 0;
+		// bytes of the reads in progress, counted as resident already
+		size_t mPendingBytes = 0;
+		unsigned int mEvictions = 0;
+		// set by the uploads, which run between update() calls
+		unsigned int mLevelsStreamed = 0;
+		size_t mBytesStreamed = 0;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,274 @@
+#include "TransformHierarchy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "TransformKernels.h"
+
+namespace Scene {
+
+const uint32_t TransformHierarchy::InvalidIndex;
+
+static const float IdentityMatrix[16] = {
+	1, 0, 0, 0,
+	0, 1, 0, 0,
+	0, 0, 1, 0,
+	0, 0, 0, 1
+};
+
+TransformHierarchy::TransformHierarchy(InstanceStore* store)
+	: mStore(store)
+{
+}
+
+uint32_t TransformHierarchy::getIndex(NodeHandle n) const
+{
+	if(!isValid(n))
+		throw std::runtime_error("Invalid transform node handle");
+	return mSlotToIndex[n.slot];
+}
+
+bool TransformHierarchy::isValid(NodeHandle n) const
+{
+	return n.slot < mSlotToIndex.size() &&
+		mSlotGeneration[n.slot] == n.generation &&
+		mSlotToIndex[n.slot] != InvalidIndex;
+}
+
+size_t TransformHierarchy::size() const
+{
+	return mParent.size();
+}
+
+void TransformHierarchy::markDirty(uint32_t i)
+{
+	if(!mDirty[i]) {
+		mDirty[i] = 1;
+		mDirtySlots.push_back(mIndexToSlot[i]);
+	}
+}
+
+NodeHandle TransformHierarchy::addNode(NodeHandle parent)
+{
+	uint32_t n = size();
+	uint32_t p = InvalidIndex;
+	uint32_t pos = n;
+	if(parent != NodeHandle()) {
+		p = getIndex(parent);
+		pos = p + mSubtreeSize[p];
+	}
+
+	uint32_t slot;
+	if(mFreeSlots.empty()) {
+		slot = mSlotToIndex.size();
+		mSlotToIndex.push_back(n);
+		mSlotGeneration.push_back(1);
+	} else {
+		slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+		mSlotToIndex[slot] = n;
+	}
+
+	mParent.push_back(p);
+	mSubtreeSize.push_back(1);
+	mLocal.insert(mLocal.end(), IdentityMatrix, IdentityMatrix + 16);
+	mWorld.insert(mWorld.end(), IdentityMatrix, IdentityMatrix + 16);
+	mInstance.push_back(InstanceHandle());
+	mDirty.push_back(0);
+	mIndexToSlot.push_back(slot);
+	markDirty(n);
+
+	// move the new node from the end to the end of its parent's subtree
+	if(pos != n) {
+		std::vector<uint32_t> order(n + 1);
+		for(uint32_t i = 0; i < pos; i++)
+			order[i] = i;
+		order[pos] = n;
+		for(uint32_t i = pos; i < n; i++)
+			order[i + 1] = i;
+		applyOrder(order);
+	} else if(p != InvalidIndex) {
+		for(uint32_t a = p; a != InvalidIndex; a = mParent[a])
+			mSubtreeSize[a]++;
+	}
+
+	NodeHandle h;
+	h.slot = slot;
+	h.generation = mSlotGeneration[slot];
+	return h;
+}
+
+void TransformHierarchy::removeNode(NodeHandle n)
+{
+	uint32_t i = getIndex(n);
+	uint32_t end = i + mSubtreeSize[i];
+
+	// the children take the place of the node in its parent's subtree
+	for(uint32_t c = i + 1; c < end; c += mSubtreeSize[c]) {
+		mParent[c] = mParent[i];
+		markDirty(c);
+	}
+
+	uint32_t slot = n.slot;
+	mSlotToIndex[slot] = InvalidIndex;
+	mSlotGeneration[slot]++;
+	if(mSlotGeneration[slot] == 0)
+		mSlotGeneration[slot] = 1;
+	mFreeSlots.push_back(slot);
+
+	std::vector<uint32_t> order;
+	order.reserve(size() - 1);
+	for(uint32_t j = 0; j < size(); j++) {
+		if(j != i)
+			order.push_back(j);
+	}
+	applyOrder(order);
+}
+
+void TransformHierarchy::setParent(NodeHandle n, NodeHandle parent)
+{
+	uint32_t i = getIndex(n);
+	uint32_t s = mSubtreeSize[i];
+	uint32_t num = size();
+	uint32_t p = InvalidIndex;
+	uint32_t target = num;
+	if(parent != NodeHandle()) {
+		p = getIndex(parent);
+		if(p >= i && p < i + s)
+			throw std::runtime_error("Tried parenting a transform node to its own subtree");
+		target = p + mSubtreeSize[p];
+	}
+	if(mParent[i] == p)
+		return;
+
+	mParent[i] = p;
+	markDirty(i);
+
+	// move the range [i, i + s) to before target
+	std::vector<uint32_t> order;
+	order.reserve(num);
+	auto append = [&](uint32_t b, uint32_t e) {
+		for(uint32_t j = b; j < e; j++)
+			order.push_back(j);
+	};
+	if(target <= i) {
+		append(0, target);
+		append(i, i + s);
+		append(target, i);
+		append(i + s, num);
+	} else {
+		append(0, i);
+		append(i + s, target);
+		append(i, i + s);
+		append(target, num);
+	}
+	applyOrder(order);
+}
+
+NodeHandle TransformHierarchy::getParent(NodeHandle n) const
+{
+	uint32_t p = mParent[getIndex(n)];
+	NodeHandle h;
+	if(p != InvalidIndex) {
+		h.slot = mIndexToSlot[p];
+		h.generation = mSlotGeneration[h.slot];
+	}
+	return h;
+}
+
+void TransformHierarchy::applyOrder(const std::vector<uint32_t>& order)
+{
+	size_t n = order.size();
+	std::vector<uint32_t> newIndex(size(), InvalidIndex);
+	for(size_t j = 0; j < n; j++)
+		newIndex[order[j]] = j;
+
+	std::vector<uint32_t> parent(n);
+	std::vector<float> local(n * 16);
+	std::vector<float> world(n * 16);
+	std::vector<InstanceHandle> instance(n);
+	std::vector<uint8_t> dirty(n);
+	std::vector<uint32_t> indexToSlot(n);
+	for(size_t j = 0; j < n; j++) {
+		uint32_t o = order[j];
+		parent[j] = mParent[o] == InvalidIndex ? InvalidIndex : newIndex[mParent[o]];
+		std::copy(&mLocal[o * 16], &mLocal[o * 16 + 16], &local[j * 16]);
+		std::copy(&mWorld[o * 16], &mWorld[o * 16 + 16], &world[j * 16]);
+		instance[j] = mInstance[o];
+		dirty[j] = mDirty[o];
+		indexToSlot[j] = mIndexToSlot[o];
+		mSlotToIndex[indexToSlot[j]] = j;
+	}
+	mParent.swap(parent);
+	mLocal.swap(local);
+	mWorld.swap(world);
+	mInstance.swap(instance);
+	mDirty.swap(dirty);
+	mIndexToSlot.swap(indexToSlot);
+
+	// children come after their parents, so the sizes can be summed up
+	// from the back
+	mSubtreeSize.assign(n, 1);
+	for(size_t j = n; j-- > 0; ) {
+		if(mParent[j] != InvalidIndex)
+			mSubtreeSize[mParent[j]] += mSubtreeSize[j];
+	}
+}
+
+void TransformHierarchy::setLocalTransform(NodeHandle n, const Common::Vector3& pos,
+		const Common::Matrix44& rotation, const Common::Vector3& scale)
+{
+	uint32_t i = getIndex(n);
+	TransformKernels::computeWorldMatrix(pos, rotation, scale, &mLocal[i * 16]);
+	markDirty(i);
+}
+
+void TransformHierarchy::bindInstance(NodeHandle n, InstanceHandle h)
+{
+	uint32_t i = getIndex(n);
+	mInstance[i] = h;
+	markDirty(i);
+}
+
+void TransformHierarchy::update()
+{
+	if(mDirtySlots.empty())
+		return;
+
+	mDirtyIndices.clear();
+	for(auto slot : mDirtySlots) {
+		auto i = mSlotToIndex[slot];
+		if(i != InvalidIndex)
+			mDirtyIndices.push_back(i);
+	}
+	mDirtySlots.clear();
+	std::sort(mDirtyIndices.begin(), mDirtyIndices.end());
+
+	// a changed node updates its whole subtree; changed nodes inside an
+	// already updated subtree are skipped
+	uint32_t done = 0;
+	for(auto d : mDirtyIndices) {
+		if(d < done)
+			continue;
+
+		uint32_t end = d + mSubtreeSize[d];
+		for(uint32_t i = d; i < end; i++) {
+			const float* parentWorld = mParent[i] == InvalidIndex ?
+				IdentityMatrix : &mWorld[mParent[i] * 16];
+			TransformKernels::multiply(&mLocal[i * 16], parentWorld, &mWorld[i * 16]);
+			mDirty[i] = 0;
+			if(mStore && mStore->isValid(mInstance[i]))
+				mStore->setWorldMatrix(mInstance[i], &mWorld[i * 16]);
+		}
+		done = end;
+	}
+}
+
+const float* TransformHierarchy::getWorldMatrix(NodeHandle n)
+{
+	update();
+	return &mWorld[getIndex(n) * 16];
+}
+
+}
+
@@ -0,0 +1,94 @@
+#ifndef SCENE_TRANSFORMHIERARCHY_H
+#define SCENE_TRANSFORMHIERARCHY_H
+
+#include <vector>
+#include <cstdint>
+
+#include "common/Vector3.h"
+#include "common/Matrix44.h"
+
+#include "InstanceStore.h"
+
+namespace Scene {
+
+struct NodeHandle {
+	uint32_t slot = 0;
+	// zero is never a valid generation
+	uint32_t generation = 0;
+
+	bool operator==(const NodeHandle& h) const { return slot == h.slot && generation == h.generation; }
+	bool operator!=(const NodeHandle& h) const { return !(*this == h); }
+};
+
+// Parent-child relationships between transforms. The world matrix of a
+// node is its local matrix times the world matrix of its parent.
+//
+// The nodes are kept in depth first order so that every subtree is a
+// contiguous range with the parents before their children. update()
+// walks the changed subtrees once each, in order, and writes the world
+// matrices of the nodes bound to instances to the InstanceStore.
+// Changing a local transform is O(1); changing the structure (adding,
+// removing and reparenting nodes) is O(number of nodes).
+class TransformHierarchy {
+	public:
+		TransformHierarchy(InstanceStore* store);
+		TransformHierarchy(const TransformHierarchy&) = delete;
+		TransformHierarchy& operator=(const TransformHierarchy&) = delete;
+
+		// adds a node with an identity local transform. An invalid
+		// parent handle adds a root node.
+		NodeHandle addNode(NodeHandle parent = NodeHandle());
+		// removes the node; its children are moved to its parent
+		void removeNode(NodeHandle n);
+		// moves the node with its subtree under parent, or makes it a
+		// root node if parent is an invalid handle. The local transform
+		// is kept, i.e. the node moves along with its new parent.
+		void setParent(NodeHandle n, NodeHandle parent);
+		NodeHandle getParent(NodeHandle n) const;
+		bool isValid(NodeHandle n) const;
+		size_t size() const;
+
+		void setLocalTransform(NodeHandle n, const Common::Vector3& pos,
+				const Common::Matrix44& rotation, const Common::Vector3& scale);
+		// the world matrix of the node is written to the instance on update
+		void bindInstance(NodeHandle n, InstanceHandle h);
+
+		// recalculates the world matrices of the changed subtrees
+		void update();
+		// returns the up to date world matrix, updating if necessary
+		const float* getWorldMatrix(NodeHandle n);
+
+	private:
+		static const uint32_t InvalidIndex = 0xffffffff;
+
+		uint32_t getIndex(NodeHandle n) const;
+		void markDirty(uint32_t i);
+		// reorders the nodes so that node order[i] becomes node i
+		void applyOrder(const std::vector<uint32_t>& order);
+
+		InstanceStore* mStore;
+
+		// nodes in depth first order
+		std::vector<uint32_t> mParent;
+		// number of nodes in the subtree including the node itself
+		std::vector<uint32_t> mSubtreeSize;
+		std::vector<float> mLocal;
+		std::vector<float> mWorld;
+		std::vector<InstanceHandle> mInstance;
+		std::vector<uint8_t> mDirty;
+		std::vector<uint32_t> mIndexToSlot;
+
+		// slot table
+		std::vector<uint32_t> mSlotToIndex;
+		std::vector<uint32_t> mSlotGeneration;
+		std::vector<uint32_t> mFreeSlots;
+
+		// slots of the nodes whose local transform or parent has changed
+		std::vector<uint32_t> mDirtySlots;
+		std::vector<uint32_t> mDirtyIndices;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,472 @@
+#include "TransformKernels.h"
+
+#include <cmath>
+
+// define SSCENE_NO_SIMD to force the scalar code
+#if defined(SSCENE_NO_SIMD)
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SSCENE_AVX 1
+#define SSCENE_SSE 1
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SSCENE_SSE 1
+#endif
+
+using namespace Common;
+
+namespace Scene {
+
+InstanceTransform InstanceTransform::make(const Common::Vector3& pos, const Common::Matrix44& rotation,
+		const Common::Vector3& scale)
+{
+	InstanceTransform t;
+	t.position[0] = pos.x;
+	t.position[1] = pos.y;
+	t.position[2] = pos.z;
+	for(int r = 0; r < 3; r++)
+		for(int c = 0; c < 3; c++)
+			t.rotation[r * 3 + c] = rotation.m[r * 4 + c];
+	t.scale[0] = scale.x;
+	t.scale[1] = scale.y;
+	t.scale[2] = scale.z;
+	return t;
+}
+
+InstanceTransform InstanceTransform::lerp(const InstanceTransform& a, const InstanceTransform& b, float alpha)
+{
+	InstanceTransform t;
+	for(int i = 0; i < 3; i++) {
+		t.position[i] = a.position[i] + (b.position[i] - a.position[i]) * alpha;
+		t.scale[i] = a.scale[i] + (b.scale[i] - a.scale[i]) * alpha;
+	}
+	for(int i = 0; i < 9; i++)
+		t.rotation[i] = a.rotation[i] + (b.rotation[i] - a.rotation[i]) * alpha;
+
+	// Gram-Schmidt: normalize the first row, make the second one
+	// orthogonal to it and the third one orthogonal to both
+	float* r0 = &t.rotation[0];
+	float* r1 = &t.rotation[3];
+	float* r2 = &t.rotation[6];
+	auto dot = [] (const float* u, const float* v) { return u[0] * v[0] + u[1] * v[1] + u[2] * v[2]; };
+	auto normalize = [&] (float* u) {
+		float l = std::sqrt(dot(u, u));
+		if(l > 0.0f) {
+			u[0] /= l;
+			u[1] /= l;
+			u[2] /= l;
+		}
+	};
+	normalize(r0);
+	float d = dot(r0, r1);
+	for(int i = 0; i < 3; i++)
+		r1[i] -= d * r0[i];
+	normalize(r1);
+	float d0 = dot(r0, r2);
+	float d1 = dot(r1, r2);
+	for(int i = 0; i < 3; i++)
+		r2[i] -= d0 * r0[i] + d1 * r1[i];
+	normalize(r2);
+	return t;
+}
+
+InstanceTransform InstanceTransform::decompose(const float* world)
+{
+	// the rows of the upper 3x3 part are the rotation rows times the scale
+	InstanceTransform t;
+	for(int r = 0; r < 3; r++) {
+		const float* row = &world[r * 4];
+		float s = std::sqrt(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]);
+		t.scale[r] = s;
+		for(int c = 0; c < 3; c++)
+			t.rotation[r * 3 + c] = s > 0.0f ? row[c] / s : (r == c ? 1.0f : 0.0f);
+	}
+	t.position[0] = world[12];
+	t.position[1] = world[13];
+	t.position[2] = world[14];
+	return t;
+}
+
+Common::Matrix44 InstanceTransform::getRotation() const
+{
+	Common::Matrix44 m = Common::Matrix44::Identity;
+	for(int r = 0; r < 3; r++)
+		for(int c = 0; c < 3; c++)
+			m.m[r * 4 + c] = rotation[r * 3 + c];
+	return m;
+}
+
+size_t TransformSoA::size() const
+{
+	return posX.size();
+}
+
+void TransformSoA::resize(size_t n)
+{
+	posX.resize(n);
+	posY.resize(n);
+	posZ.resize(n);
+	scaleX.resize(n);
+	scaleY.resize(n);
+	scaleZ.resize(n);
+	for(auto& r : rot)
+		r.resize(n);
+}
+
+void TransformSoA::reserve(size_t n)
+{
+	posX.reserve(n);
+	posY.reserve(n);
+	posZ.reserve(n);
+	scaleX.reserve(n);
+	scaleY.reserve(n);
+	scaleZ.reserve(n);
+	for(auto& r : rot)
+		r.reserve(n);
+}
+
+void TransformSoA::clear()
+{
+	resize(0);
+}
+
+void TransformSoA::set(size_t i, const Common::Vector3& pos, const Common::Matrix44& rotation,
+		const Common::Vector3& scale)
+{
+	posX[i] = pos.x;
+	posY[i] = pos.y;
+	posZ[i] = pos.z;
+	scaleX[i] = scale.x;
+	scaleY[i] = scale.y;
+	scaleZ[i] = scale.z;
+	for(int r = 0; r < 3; r++)
+		for(int c = 0; c < 3; c++)
+			rot[r * 3 + c][i] = rotation.m[r * 4 + c];
+}
+
+void TransformSoA::set(size_t i, const InstanceTransform& t)
+{
+	posX[i] = t.position[0];
+	posY[i] = t.position[1];
+	posZ[i] = t.position[2];
+	scaleX[i] = t.scale[0];
+	scaleY[i] = t.scale[1];
+	scaleZ[i] = t.scale[2];
+	for(int j = 0; j < 9; j++)
+		rot[j][i] = t.rotation[j];
+}
+
+InstanceTransform TransformSoA::get(size_t i) const
+{
+	InstanceTransform t;
+	t.position[0] = posX[i];
+	t.position[1] = posY[i];
+	t.position[2] = posZ[i];
+	t.scale[0] = scaleX[i];
+	t.scale[1] = scaleY[i];
+	t.scale[2] = scaleZ[i];
+	for(int j = 0; j < 9; j++)
+		t.rotation[j] = rot[j][i];
+	return t;
+}
+
+void TransformSoA::push_back(const Common::Vector3& pos, const Common::Matrix44& rotation,
+		const Common::Vector3& scale)
+{
+	resize(size() + 1);
+	set(size() - 1, pos, rotation, scale);
+}
+
+void TransformSoA::move(size_t dst, size_t src)
+{
+	posX[dst] = posX[src];
+	posY[dst] = posY[src];
+	posZ[dst] = posZ[src];
+	scaleX[dst] = scaleX[src];
+	scaleY[dst] = scaleY[src];
+	scaleZ[dst] = scaleZ[src];
+	for(auto& r : rot)
+		r[dst] = r[src];
+}
+
+void TransformSoA::pop_back()
+{
+	resize(size() - 1);
+}
+
+void TransformKernels::computeWorldMatrix(const Common::Vector3& pos, const Common::Matrix44& rotation,
+		const Common::Vector3& scale, float* world)
+{
+	const float s[3] = { scale.x, scale.y, scale.z };
+	for(int r = 0; r < 3; r++) {
+		for(int c = 0; c < 3; c++)
+			world[r * 4 + c] = s[r] * rotation.m[r * 4 + c];
+		world[r * 4 + 3] = 0.0f;
+	}
+	world[12] = pos.x;
+	world[13] = pos.y;
+	world[14] = pos.z;
+	world[15] = 1.0f;
+}
+
+void TransformKernels::computeInverseWorldMatrix(const Common::Vector3& pos, const Common::Matrix44& rotation,
+		const Common::Vector3& scale, float* inverse)
+{
+	const float is[3] = { 1.0f / scale.x, 1.0f / scale.y, 1.0f / scale.z };
+	const float t[3] = { pos.x, pos.y, pos.z };
+	for(int r = 0; r < 3; r++) {
+		for(int c = 0; c < 3; c++)
+			inverse[r * 4 + c] = rotation.m[c * 4 + r] * is[c];
+		inverse[r * 4 + 3] = 0.0f;
+	}
+	// -t R^T S^-1
+	for(int c = 0; c < 3; c++) {
+		inverse[12 + c] = -(t[0] * rotation.m[c * 4 + 0] +
+				t[1] * rotation.m[c * 4 + 1] +
+				t[2] * rotation.m[c * 4 + 2]) * is[c];
+	}
+	inverse[15] = 1.0f;
+}
+
+void TransformKernels::invertAffine(const float* m, float* inverse)
+{
+	// inverse of the upper 3x3 part via the adjugate
+	float a[9];
+	a[0] = m[5] * m[10] - m[6] * m[9];
+	a[1] = m[2] * m[9]  - m[1] * m[10];
+	a[2] = m[1] * m[6]  - m[2] * m[5];
+	a[3] = m[6] * m[8]  - m[4] * m[10];
+	a[4] = m[0] * m[10] - m[2] * m[8];
+	a[5] = m[2] * m[4]  - m[0] * m[6];
+	a[6] = m[4] * m[9]  - m[5] * m[8];
+	a[7] = m[1] * m[8]  - m[0] * m[9];
+	a[8] = m[0] * m[5]  - m[1] * m[4];
+	float det = m[0] * a[0] + m[1] * a[3] + m[2] * a[6];
+	float id = det != 0.0f ? 1.0f / det : 0.0f;
+
+	for(int r = 0; r < 3; r++) {
+		for(int c = 0; c < 3; c++)
+			inverse[r * 4 + c] = a[r * 3 + c] * id;
+		inverse[r * 4 + 3] = 0.0f;
+	}
+	for(int c = 0; c < 3; c++) {
+		inverse[12 + c] = -(m[12] * inverse[c] +
+				m[13] * inverse[4 + c] +
+				m[14] * inverse[8 + c]);
+	}
+	inverse[15] = 1.0f;
+}
+
+#ifdef SSCENE_SSE
+// writes rows r of four matrices given the row components for each
+// matrix in c0..c3
+static inline void storeRows4(float* out, int r, __m128 c0, __m128 c1, __m128 c2, __m128 c3)
+{
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	_mm_storeu_ps(out + 0 * 16 + r * 4, c0);
+	_mm_storeu_ps(out + 1 * 16 + r * 4, c1);
+	_mm_storeu_ps(out + 2 * 16 + r * 4, c2);
+	_mm_storeu_ps(out + 3 * 16 + r * 4, c3);
+}
+#endif
+
+#ifdef SSCENE_AVX
+// as storeRows4 for eight matrices, the first four in the low lanes
+static inline void storeRows8(float* out, int r, __m256 c0, __m256 c1, __m256 c2, __m256 c3)
+{
+	storeRows4(out, r, _mm256_castps256_ps128(c0), _mm256_castps256_ps128(c1),
+			_mm256_castps256_ps128(c2), _mm256_castps256_ps128(c3));
+	storeRows4(out + 4 * 16, r, _mm256_extractf128_ps(c0, 1), _mm256_extractf128_ps(c1, 1),
+			_mm256_extractf128_ps(c2, 1), _mm256_extractf128_ps(c3, 1));
+}
+#endif
+
+void TransformKernels::computeWorldMatrices(const TransformSoA& t, size_t begin, size_t end, float* world)
+{
+	size_t i = begin;
+#ifdef SSCENE_AVX
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+		for(; i + 8 <= end; i += 8) {
+			const float* scales[3] = { &t.scaleX[i], &t.scaleY[i], &t.scaleZ[i] };
+			for(int r = 0; r < 3; r++) {
+				__m256 s = _mm256_loadu_ps(scales[r]);
+				storeRows8(world, r,
+						_mm256_mul_ps(s, _mm256_loadu_ps(&t.rot[r * 3 + 0][i])),
+						_mm256_mul_ps(s, _mm256_loadu_ps(&t.rot[r * 3 + 1][i])),
+						_mm256_mul_ps(s, _mm256_loadu_ps(&t.rot[r * 3 + 2][i])),
+						zero);
+			}
+			storeRows8(world, 3,
+					_mm256_loadu_ps(&t.posX[i]),
+					_mm256_loadu_ps(&t.posY[i]),
+					_mm256_loadu_ps(&t.posZ[i]),
+					one);
+			world += 8 * 16;
+		}
+	}
+#endif
+#ifdef SSCENE_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for(; i + 4 <= end; i += 4) {
+		const float* scales[3] = { &t.scaleX[i], &t.scaleY[i], &t.scaleZ[i] };
+		for(int r = 0; r < 3; r++) {
+			__m128 s = _mm_loadu_ps(scales[r]);
+			storeRows4(world, r,
+					_mm_mul_ps(s, _mm_loadu_ps(&t.rot[r * 3 + 0][i])),
+					_mm_mul_ps(s, _mm_loadu_ps(&t.rot[r * 3 + 1][i])),
+					_mm_mul_ps(s, _mm_loadu_ps(&t.rot[r * 3 + 2][i])),
+					zero);
+		}
+		storeRows4(world, 3,
+				_mm_loadu_ps(&t.posX[i]),
+				_mm_loadu_ps(&t.posY[i]),
+				_mm_loadu_ps(&t.posZ[i]),
+				one);
+		world += 4 * 16;
+	}
+#endif
+	for(; i < end; i++) {
+		const float s[3] = { t.scaleX[i], t.scaleY[i], t.scaleZ[i] };
+		for(int r = 0; r < 3; r++) {
+			for(int c = 0; c < 3; c++)
+				world[r * 4 + c] = s[r] * t.rot[r * 3 + c][i];
+			world[r * 4 + 3] = 0.0f;
+		}
+		world[12] = t.posX[i];
+		world[13] = t.posY[i];
+		world[14] = t.posZ[i];
+		world[15] = 1.0f;
+		world += 16;
+	}
+}
+
+void TransformKernels::computeInverseWorldMatrices(const TransformSoA& t, size_t begin, size_t end, float* inverse)
+{
+	size_t i = begin;
+#ifdef SSCENE_AVX
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+		for(; i + 8 <= end; i += 8) {
+			__m256 is[3] = {
+				_mm256_div_ps(one, _mm256_loadu_ps(&t.scaleX[i])),
+				_mm256_div_ps(one, _mm256_loadu_ps(&t.scaleY[i])),
+				_mm256_div_ps(one, _mm256_loadu_ps(&t.scaleZ[i]))
+			};
+			for(int r = 0; r < 3; r++) {
+				storeRows8(inverse, r,
+						_mm256_mul_ps(_mm256_loadu_ps(&t.rot[0 * 3 + r][i]), is[0]),
+						_mm256_mul_ps(_mm256_loadu_ps(&t.rot[1 * 3 + r][i]), is[1]),
+						_mm256_mul_ps(_mm256_loadu_ps(&t.rot[2 * 3 + r][i]), is[2]),
+						zero);
+			}
+			__m256 px = _mm256_loadu_ps(&t.posX[i]);
+			__m256 py = _mm256_loadu_ps(&t.posY[i]);
+			__m256 pz = _mm256_loadu_ps(&t.posZ[i]);
+			__m256 tr[3];
+			for(int c = 0; c < 3; c++) {
+				tr[c] = _mm256_add_ps(_mm256_add_ps(
+							_mm256_mul_ps(px, _mm256_loadu_ps(&t.rot[c * 3 + 0][i])),
+							_mm256_mul_ps(py, _mm256_loadu_ps(&t.rot[c * 3 + 1][i]))),
+						_mm256_mul_ps(pz, _mm256_loadu_ps(&t.rot[c * 3 + 2][i])));
+				tr[c] = _mm256_sub_ps(zero, _mm256_mul_ps(tr[c], is[c]));
+			}
+			storeRows8(inverse, 3, tr[0], tr[1], tr[2], one);
+			inverse += 8 * 16;
+		}
+	}
+#endif
+#ifdef SSCENE_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for(; i + 4 <= end; i += 4) {
+		__m128 is[3] = {
+			_mm_div_ps(one, _mm_loadu_ps(&t.scaleX[i])),
+			_mm_div_ps(one, _mm_loadu_ps(&t.scaleY[i])),
+			_mm_div_ps(one, _mm_loadu_ps(&t.scaleZ[i]))
+		};
+		for(int r = 0; r < 3; r++) {
+			storeRows4(inverse, r,
+					_mm_mul_ps(_mm_loadu_ps(&t.rot[0 * 3 + r][i]), is[0]),
+					_mm_mul_ps(_mm_loadu_ps(&t.rot[1 * 3 + r][i]), is[1]),
+					_mm_mul_ps(_mm_loadu_ps(&t.rot[2 * 3 + r][i]), is[2]),
+					zero);
+		}
+		__m128 px = _mm_loadu_ps(&t.posX[i]);
+		__m128 py = _mm_loadu_ps(&t.posY[i]);
+		__m128 pz = _mm_loadu_ps(&t.posZ[i]);
+		__m128 tr[3];
+		for(int c = 0; c < 3; c++) {
+			tr[c] = _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(px, _mm_loadu_ps(&t.rot[c * 3 + 0][i])),
+						_mm_mul_ps(py, _mm_loadu_ps(&t.rot[c * 3 + 1][i]))),
+					_mm_mul_ps(pz, _mm_loadu_ps(&t.rot[c * 3 + 2][i])));
+			tr[c] = _mm_sub_ps(zero, _mm_mul_ps(tr[c], is[c]));
+		}
+		storeRows4(inverse, 3, tr[0], tr[1], tr[2], one);
+		inverse += 4 * 16;
+	}
+#endif
+	for(; i < end; i++) {
+		const float is[3] = { 1.0f / t.scaleX[i], 1.0f / t.scaleY[i], 1.0f / t.scaleZ[i] };
+		for(int r = 0; r < 3; r++) {
+			for(int c = 0; c < 3; c++)
+				inverse[r * 4 + c] = t.rot[c * 3 + r][i] * is[c];
+			inverse[r * 4 + 3] = 0.0f;
+		}
+		for(int c = 0; c < 3; c++) {
+			inverse[12 + c] = -(t.posX[i] * t.rot[c * 3 + 0][i] +
+					t.posY[i] * t.rot[c * 3 + 1][i] +
+					t.posZ[i] * t.rot[c * 3 + 2][i]) * is[c];
+		}
+		inverse[15] = 1.0f;
+		inverse += 16;
+	}
+}
+
+void TransformKernels::multiply(const float* a, const float* b, float* out)
+{
+#ifdef SSCENE_SSE
+	__m128 b0 = _mm_loadu_ps(b + 0);
+	__m128 b1 = _mm_loadu_ps(b + 4);
+	__m128 b2 = _mm_loadu_ps(b + 8);
+	__m128 b3 = _mm_loadu_ps(b + 12);
+	for(int r = 0; r < 4; r++) {
+		__m128 row = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[r * 4 + 0]), b0),
+					_mm_mul_ps(_mm_set1_ps(a[r * 4 + 1]), b1)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[r * 4 + 2]), b2),
+					_mm_mul_ps(_mm_set1_ps(a[r * 4 + 3]), b3)));
+		_mm_storeu_ps(out + r * 4, row);
+	}
+#else
+	float tmp[16];
+	for(int r = 0; r < 4; r++) {
+		for(int c = 0; c < 4; c++) {
+			tmp[r * 4 + c] = a[r * 4 + 0] * b[0 * 4 + c] +
+				a[r * 4 + 1] * b[1 * 4 + c] +
+				a[r * 4 + 2] * b[2 * 4 + c] +
+				a[r * 4 + 3] * b[3 * 4 + c];
+		}
+	}
+	for(int i = 0; i < 16; i++)
+		out[i] = tmp[i];
+#endif
+}
+
+const char* TransformKernels::getInstructionSet()
+{
+#if defined(SSCENE_AVX)
+	return "AVX";
+#elif defined(SSCENE_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+}
+
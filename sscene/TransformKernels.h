@@ -0,0 +1,88 @@
+#ifndef SCENE_TRANSFORMKERNELS_H
+#define SCENE_TRANSFORMKERNELS_H
+
+#include <vector>
+#include <cstddef>
+
+#include "common/Vector3.h"
+#include "common/Matrix44.h"
+
+namespace Scene {
+
+// Plain transform of one instance, for passing arrays of transforms
+// around. The rotation is the upper 3x3 part of a rotation matrix, row
+// major.
+struct InstanceTransform {
+	float position[3];
+	float rotation[9];
+	float scale[3];
+
+	static InstanceTransform make(const Common::Vector3& pos, const Common::Matrix44& rotation,
+			const Common::Vector3& scale);
+	// linear interpolation from a (alpha = 0) to b (alpha = 1). The
+	// rotation rows are interpolated and orthonormalized again, which is
+	// close to a slerp for the small steps between two frames.
+	static InstanceTransform lerp(const InstanceTransform& a, const InstanceTransform& b, float alpha);
+	// splits a world matrix as computed by TransformKernels into position,
+	// rotation and scale. Shear, as from a parent with a non-uniform
+	// scale, is lost.
+	static InstanceTransform decompose(const float* world);
+	Common::Matrix44 getRotation() const;
+};
+
+// Instance transforms as a structure of arrays for the batch kernels.
+// Only the upper 3x3 part of the rotation is stored, row major.
+struct TransformSoA {
+	std::vector<float> posX, posY, posZ;
+	std::vector<float> scaleX, scaleY, scaleZ;
+	std::vector<float> rot[9];
+
+	size_t size() const;
+	void resize(size_t n);
+	void reserve(size_t n);
+	void clear();
+	void set(size_t i, const Common::Vector3& pos, const Common::Matrix44& rotation,
+			const Common::Vector3& scale);
+	void set(size_t i, const InstanceTransform& t);
+	InstanceTransform get(size_t i) const;
+	void push_back(const Common::Vector3& pos, const Common::Matrix44& rotation,
+			const Common::Vector3& scale);
+	// moves the transform at src to dst
+	void move(size_t dst, size_t src);
+	void pop_back();
+};
+
+// Matrix kernels using AVX or SSE when the compiler targets them, scalar
+// code otherwise. Matrices are 16 floats, row major, multiplied with row
+// vectors like Common::Matrix44. Pointers need not be aligned.
+class TransformKernels {
+	public:
+		// world = scale * rotation * translation
+		static void computeWorldMatrix(const Common::Vector3& pos, const Common::Matrix44& rotation,
+				const Common::Vector3& scale, float* world);
+		// inverse of the above: the transposed rotation times the inverse
+		// scale, with the position negated and rotated back as the
+		// translation (-t R^T S^-1). Used for transforming the normals in
+		// the scene shader
+		static void computeInverseWorldMatrix(const Common::Vector3& pos, const Common::Matrix44& rotation,
+				const Common::Vector3& scale, float* inverse);
+		// inverse of a matrix whose last column is (0, 0, 0, 1). A
+		// singular matrix results in a zero upper 3x3 part.
+		static void invertAffine(const float* m, float* inverse);
+
+		// as above for the transforms [begin, end), writing 16 floats
+		// per transform starting at world[0] / inverse[0]
+		static void computeWorldMatrices(const TransformSoA& t, size_t begin, size_t end, float* world);
+		static void computeInverseWorldMatrices(const TransformSoA& t, size_t begin, size_t end, float* inverse);
+
+		// out = a * b
+		static void multiply(const float* a, const float* b, float* out);
+
+		// "AVX", "SSE" or "scalar"
+		static const char* getInstructionSet();
+};
+
+}
+
+#endif
+
@@ -0,0 +1,72 @@
+#ifndef SCENE_TRIPLEBUFFER_H
+#define SCENE_TRIPLEBUFFER_H
+
+#include <atomic>
+
+namespace Scene {
+
+// Hands values from one writer thread to one reader thread without
+// locking. The writer fills the write buffer and publishes it; the
+// reader takes the latest published buffer, skipping any it missed.
+// Neither side ever waits for the other.
+template<typename T>
+class TripleBuffer {
+	public:
+		TripleBuffer()
+			: mShared(1)
+		{
+		}
+
+		TripleBuffer(const TripleBuffer&) = delete;
+		TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+		// writer side
+		T& getWriteBuffer()
+		{
+			return mBuffers[mWrite];
+		}
+
+		void publish()
+		{
+			unsigned int prev = mShared.exchange(mWrite | FreshBit, std::memory_order_acq_rel);
+			mWrite = prev & IndexMask;
+		}
+
+		// reader side
+		bool hasNew() const
+		{
+			return mShared.load(std::memory_order_relaxed) & FreshBit;
+		}
+
+		// switches to the latest published buffer, returns false if
+		// nothing was published since the last call
+		bool acquire()
+		{
+			if(!hasNew())
+				return false;
+			unsigned int prev = mShared.exchange(mRead, std::memory_order_acq_rel);
+			mRead = prev & IndexMask;
+			return true;
+		}
+
+		T& getReadBuffer()
+		{
+			return mBuffers[mRead];
+		}
+
+	private:
+		static const unsigned int IndexMask = 3;
+		static const unsigned int FreshBit = 4;
+
+		T mBuffers[3];
+		unsigned int mWrite = 0;
+		unsigned int mRead = 2;
+		// index of the buffer in between, and whether it is newer than
+		// the read buffer
+		std::atomic<unsigned int> mShared;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,258 @@
+#include "WorldPartition.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+#include "Scene.h"
+
+namespace Scene {
+
+WorldPartition::WorldPartition(Scene& scene, const WorldCellProvider& provider,
+		const WorldPartitionSettings& settings)
+	: mScene(scene),
+	mJobs(scene.getJobSystem()),
+	mProvider(provider),
+	mSettings(settings)
+{
+	if(mSettings.cellSize <= 0.0f || mSettings.unloadRadius <= mSettings.loadRadius) {
+		throw std::runtime_error("World partition needs a cell size and an unload radius larger than the load radius\n");
+	}
+}
+
+WorldPartition::~WorldPartition()
+{
+	// the load steps refer to this. A wait() for a main thread job runs
+	// them, and each step leaves the job of the next one in the cell.
+	clear();
+	while(getNumPendingCells() != 0) {
+		JobHandle job;
+		for(const auto& kv : mCells) {
+			if(kv.second.loading) {
+				job = kv.second.job;
+				break;
+			}
+		}
+		try {
+			mJobs.wait(job);
+		} catch(const std::exception& ex) {
+			std::cerr << "Unable to finish loading a cell: " << ex.what();
+		}
+	}
+}
+
+void WorldPartition::update(const Camera& camera, float dt)
+{
+	// smoothed, so that a single uneven frame doesn't start loads
+	const Common::Vector3& pos = camera.getPosition();
+	if(mHasPosition && dt > 0.0f) {
+		Common::Vector3 v = (pos - mLastPosition) / dt;
+		mVelocity = mVelocity * 0.8f + v * 0.2f;
+	}
+	mLastPosition = pos;
+	mHasPosition = true;
+	Common::Vector3 ahead = pos + mVelocity * mSettings.prefetchTime;
+
+	for(auto it = mCells.begin(); it != mCells.end(); ) {
+		if(std::min(distance(it->first, pos), distance(it->first, ahead)) <= mSettings.unloadRadius) {
+			++it;
+		} else if(it->second.loading) {
+			it->second.cancelled = true;
+			++it;
+		} else {
+			unload(it->second);
+			mCellsUnloaded++;
+			it = mCells.erase(it);
+		}
+	}
+
+	// the missing cells in range of the camera and of where it is
+	// heading, nearest to the camera first
+	std::vector<std::pair<float, CellCoord>> wanted;
+	auto gather = [&] (const Common::Vector3& centre) {
+		float r = mSettings.loadRadius;
+		int x0 = static_cast<int>(std::floor((centre.x - r) / mSettings.cellSize));
+		int x1 = static_cast<int>(std::floor((centre.x + r) / mSettings.cellSize));
+		int z0 = static_cast<int>(std::floor((centre.z - r) / mSettings.cellSize));
+		int z1 = static_cast<int>(std::floor((centre.z + r) / mSettings.cellSize));
+		for(int x = x0; x <= x1; x++) {
+			for(int z = z0; z <= z1; z++) {
+				CellCoord c(x, z);
+				if(distance(c, centre) > r)
+					continue;
+				auto it = mCells.find(c);
+				if(it != mCells.end())
+					it->second.cancelled = false;
+				else
+					wanted.push_back({ distance(c, pos), c });
+			}
+		}
+	};
+	gather(pos);
+	gather(ahead);
+	std::sort(wanted.begin(), wanted.end());
+
+	size_t pending = getNumPendingCells();
+	for(const auto& w : wanted) {
+		if(pending >= mSettings.maxPendingLoads)
+			break;
+		if(mCells.find(w.second) != mCells.end())
+			continue;
+		startLoad(w.second);
+		pending++;
+	}
+}
+
+void WorldPartition::clear()
+{
+	for(auto it = mCells.begin(); it != mCells.end(); ) {
+		if(it->second.loading) {
+			it->second.cancelled = true;
+			++it;
+		} else {
+			unload(it->second);
+			mCellsUnloaded++;
+			it = mCells.erase(it);
+		}
+	}
+}
+
+float WorldPartition::distance(const CellCoord& c, const Common::Vector3& p) const
+{
+	float x0 = c.first * mSettings.cellSize;
+	float z0 = c.second * mSettings.cellSize;
+	float dx = std::max(0.0f, std::max(x0 - p.x, p.x - (x0 + mSettings.cellSize)));
+	float dz = std::max(0.0f, std::max(z0 - p.z, p.z - (z0 + mSettings.cellSize)));
+	return std::sqrt(dx * dx + dz * dz);
+}
+
+std::string WorldPartition::sceneName(const CellCoord& c, const std::string& name) const
+{
+	return "cell " + std::to_string(c.first) + "," + std::to_string(c.second) + "/" + name;
+}
+
+void WorldPartition::startLoad(const CellCoord& c)
+{
+	mCells[c] = Cell();
+
+	auto content = std::make_shared<WorldCell>();
+	auto found = std::make_shared<bool>(false);
+	WorldCellProvider provider = mProvider;
+	auto read = mJobs.schedule([=] { *found = provider(c.first, c.second, *content); });
+	mCells[c].job = mJobs.scheduleOnMainThread([=] {
+			std::vector<JobHandle> models;
+			try {
+				// passes on a reading error
+				mJobs.wait(read);
+				if(!*found)
+					*content = WorldCell();
+			} catch(const std::exception& ex) {
+				std::cerr << "Unable to read cell " << c.first << ", " << c.second << ": " << ex.what();
+				// kept as an empty cell rather than read again
+				*content = WorldCell();
+			}
+			// a cell cancelled now loads no models; finishLoad() drops it
+			// even if it is wanted again by then
+			if(!mCells[c].cancelled) {
+				for(const auto& m : content->models)
+					models.push_back(mScene.addModelAsync(sceneName(c, m.first), m.second));
+			}
+			mCells[c].job = mJobs.scheduleOnMainThread([=] { finishLoad(c, *content, models); }, models);
+			}, { read });
+}
+
+void WorldPartition::finishLoad(const CellCoord& c, const WorldCell& content,
+		const std::vector<JobHandle>& models)
+{
+	Cell& cell = mCells[c];
+	cell.loading = false;
+	for(size_t i = 0; i < models.size(); i++) {
+		try {
+			mJobs.wait(models[i]);
+			cell.models.push_back(sceneName(c, content.models[i].first));
+		} catch(const std::exception& ex) {
+			std::cerr << "Unable to load " << content.models[i].second << ": " << ex.what();
+		}
+	}
+
+	// without all of its models the cell is loaded again when needed
+	if(cell.cancelled || models.size() != content.models.size()) {
+		unload(cell);
+		mCells.erase(c);
+		return;
+	}
+
+	for(const auto& t : content.textures) {
+		try {
+			mScene.addTexture(sceneName(c, t.first), t.second);
+			cell.textures.push_back(sceneName(c, t.first));
+		} catch(const std::exception& ex) {
+			std::cerr << "Unable to load " << t.second << ": " << ex.what();
+		}
+	}
+
+	// instances of models or textures that failed to load are left out
+	for(const auto& inst : content.instances) {
+		if(inst.transforms.empty())
+			continue;
+		try {
+			auto handles = mScene.addMeshInstances(sceneName(c, inst.model), sceneName(c, inst.texture),
+					&inst.transforms[0], inst.transforms.size(),
+					inst.backfaceCulling, inst.blending);
+			cell.instances.insert(cell.instances.end(), handles.begin(), handles.end());
+		} catch(const std::exception& ex) {
+			std::cerr << "Unable to add instances of " << inst.model << " to cell "
+				<< c.first << ", " << c.second << ": " << ex.what();
+		}
+	}
+	mCellsLoaded++;
+}
+
+void WorldPartition::unload(Cell& cell)
+{
+	// the files stay loaded as long as other cells use them
+	if(!cell.instances.empty())
+		mScene.removeMeshInstances(&cell.instances[0], cell.instances.size());
+	for(const auto& m : cell.models)
+		mScene.removeModel(m);
+	for(const auto& t : cell.textures)
+		mScene.removeTexture(t);
+	cell.instances.clear();
+	cell.models.clear();
+	cell.textures.clear();
+}
+
+const Common::Vector3& WorldPartition::getVelocity() const
+{
+	return mVelocity;
+}
+
+size_t WorldPartition::getNumLoadedCells() const
+{
+	return mCells.size() - getNumPendingCells();
+}
+
+size_t WorldPartition::getNumPendingCells() const
+{
+	size_t pending = 0;
+	for(const auto& kv : mCells) {
+		if(kv.second.loading)
+			pending++;
+	}
+	return pending;
+}
+
+unsigned int WorldPartition::getCellsLoaded() const
+{
+	return mCellsLoaded;
+}
+
+unsigned int WorldPartition::getCellsUnloaded() const
+{
+	return mCellsUnloaded;
+}
+
+}
+
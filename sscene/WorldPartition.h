@@ -0,0 +1,127 @@
+#ifndef SCENE_WORLDPARTITION_H
+#define SCENE_WORLDPARTITION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <functional>
+
+#include "common/Vector3.h"
+
+#include "InstanceStore.h"
+#include "JobSystem.h"
+
+namespace Scene {
+
+class Scene;
+class Camera;
+
+// The content of a cell of the world. Names are local to the cell, so
+// that cells can be made independently; a file loaded by several cells
+// is still only loaded once (see Scene::addModel()).
+struct WorldCell {
+	struct Instances {
+		std::string model;
+		std::string texture;
+		std::vector<InstanceTransform> transforms;
+		bool backfaceCulling = true;
+		bool blending = false;
+	};
+
+	// name and filename
+	std::vector<std::pair<std::string, std::string>> models;
+	std::vector<std::pair<std::string, std::string>> textures;
+	std::vector<Instances> instances;
+};
+
+// fills in the cell at (x, z) and returns false if there is nothing
+// there. Runs on the worker threads, e.g. to read the cell from a file;
+// throws on errors.
+typedef std::function<bool(int x, int z, WorldCell& cell)> WorldCellProvider;
+
+struct WorldPartitionSettings {
+	// side of the square cells on the XZ plane
+	float cellSize = 100.0f;
+	// cells nearer than this to the camera are loaded, and those
+	// farther than unloadRadius unloaded, which must be larger
+	float loadRadius = 300.0f;
+	float unloadRadius = 400.0f;
+	// cells are also loaded around where the camera will be this many
+	// seconds ahead at its current velocity
+	float prefetchTime = 2.0f;
+	// cells being loaded at the same time at most
+	unsigned int maxPendingLoads = 4;
+};
+
+// Streams a world too large to keep loaded as a whole into the scene a
+// cell at a time. Each update loads the cells around the camera and
+// ahead of it, nearest first, and unloads those out of range, so that
+// the memory used only depends on the radii and the density of the
+// world. The cells are read on the worker threads, their models loaded
+// with Scene::addModelAsync() and everything added to the scene in
+// Scene::render().
+class WorldPartition {
+	public:
+		WorldPartition(Scene& scene, const WorldCellProvider& provider,
+				const WorldPartitionSettings& settings = WorldPartitionSettings());
+		// unloads all cells and waits for the loads in progress, so it
+		// must be destroyed on the thread calling Scene::render() and
+		// before the scene
+		~WorldPartition();
+		WorldPartition(const WorldPartition&) = delete;
+		WorldPartition& operator=(const WorldPartition&) = delete;
+
+		// once a frame before Scene::render(), with the seconds since the
+		// last call. The velocity is taken from the camera's movement.
+		void update(const Camera& camera, float dt);
+		// unloads all cells; loads in progress are dropped once finished
+		void clear();
+
+		const Common::Vector3& getVelocity() const;
+		size_t getNumLoadedCells() const;
+		size_t getNumPendingCells() const;
+		// cells loaded and unloaded so far
+		unsigned int getCellsLoaded() const;
+		unsigned int getCellsUnloaded() const;
+
+	private:
+		typedef std::pair<int, int> CellCoord;
+
+		struct Cell {
+			bool loading = true;
+			// to be unloaded once the load finishes
+			bool cancelled = false;
+			// the main thread job of the current step of the load
+			JobHandle job;
+			// what was added to the scene, by the names in the scene
+			std::vector<std::string> models;
+			std::vector<std::string> textures;
+			std::vector<InstanceHandle> instances;
+		};
+
+		// from p to the nearest point of the cell on the XZ plane
+		float distance(const CellCoord& c, const Common::Vector3& p) const;
+		std::string sceneName(const CellCoord& c, const std::string& name) const;
+		void startLoad(const CellCoord& c);
+		// once the models have been loaded
+		void finishLoad(const CellCoord& c, const WorldCell& content,
+				const std::vector<JobHandle>& models);
+		void unload(Cell& cell);
+
+		Scene& mScene;
+		JobSystem& mJobs;
+		WorldCellProvider mProvider;
+		WorldPartitionSettings mSettings;
+		std::map<CellCoord, Cell> mCells;
+		Common::Vector3 mLastPosition;
+		Common::Vector3 mVelocity = Common::Vector3(0, 0, 0);
+		bool mHasPosition = false;
+		unsigned int mCellsLoaded = 0;
+		unsigned int mCellsUnloaded = 0;
+};
+
+}
+
+#endif
+
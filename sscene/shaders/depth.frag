@@ -0,0 +1,26 @@
+#version 120
+
+#ifdef ALPHA_TEST
+varying vec2 v_texCoord;
+#ifdef VERTEX_COLOR
+varying float v_Alpha;
+#endif
+
+uniform sampler2D s_texture;
+#endif
+
+void main()
+{
+#ifdef ALPHA_TEST
+    float alpha;
+
+    // the same alpha test as in scene.frag
+    alpha = texture2D(s_texture, v_texCoord).a;
+#ifdef VERTEX_COLOR
+    alpha *= v_Alpha;
+#endif
+    if(alpha < 0.5)
+        discard;
+#endif
+    gl_FragColor = vec4(1.0);
+}
@@ -0,0 +1,51 @@
+#version 120
+// Features are selected with #defines, see ShaderVariants.h. Only
+// ALPHA_TEST, VERTEX_COLOR and INSTANCING are used.
+
+attribute vec3 a_Position;
+#ifdef ALPHA_TEST
+attribute vec2 a_texCoord;
+#ifdef VERTEX_COLOR
+attribute vec4 a_Color;
+#endif
+#endif
+
+#ifdef INSTANCING
+attribute mat4 a_World;
+#else
+uniform mat4 u_world;
+#endif
+uniform mat4 u_viewProjection;
+
+// the shading pass tests GL_EQUAL against the depths of the pre-pass,
+// so both programs must write exactly the same depth
+invariant gl_Position;
+
+#ifdef ALPHA_TEST
+varying vec2 v_texCoord;
+#ifdef VERTEX_COLOR
+varying float v_Alpha;
+#endif
+#endif
+
+void main()
+{
+    mat4 world;
+    vec4 worldPosition;
+
+#ifdef INSTANCING
+    world = a_World;
+#else
+    world = u_world;
+#endif
+
+    // the same expressions as in scene.vert
+    worldPosition = world * vec4(a_Position, 1.0);
+    gl_Position = u_viewProjection * worldPosition;
+#ifdef ALPHA_TEST
+    v_texCoord = a_texCoord;
+#ifdef VERTEX_COLOR
+    v_Alpha = a_Color.a;
+#endif
+#endif
+}
@@ -1,54 +1,97 @@
+#version 120
+// Features are selected with #defines, see ShaderVariants.h.
+
 varying vec2 v_texCoord;
-varying vec3 v_Normal;
-varying float v_PointLightDistance;
+varying vec4 v_Light;
+#ifdef VERTEX_COLOR
+varying vec4 v_Color;
+#endif
 
 uniform sampler2D s_texture;
-uniform vec3 u_ambientLight;
-uniform vec3 u_directionalLightDirection;
+
+#ifdef DIRECTIONAL_LIGHT
+varying float v_DirectionalFactor;
 uniform vec3 u_directionalLightColor;
-uniform vec3 u_pointLightColor;
-uniform vec3 u_pointLightAttenuation;
-uniform bool u_ambientLightEnabled;
-uniform bool u_directionalLightEnabled;
-uniform bool u_pointLightEnabled;
+#endif
+
+#ifdef SHADOWS
+varying vec3 v_WorldPosition;
+varying float v_ViewDepth;
+
+uniform sampler2DShadow s_shadowMap;
+uniform mat4 u_shadowMatrix[4];
+uniform vec4 u_cascadeSplits;
+uniform int u_numCascades;
+uniform int u_pcfRadius;
+uniform vec2 u_shadowTexelSize;
+
+float shadowFactor()
+{
+    int cascade = -1;
+    vec4 coord;
+    float cascadeWidth;
+    float margin;
+    float sum;
+    int width;
+
+    for(int i = 0; i < 4; i++) {
+        if(i < u_numCascades && v_ViewDepth <= u_cascadeSplits[i]) {
+            cascade = i;
+            break;
+        }
+    }
+    if(cascade < 0)
+        return 1.0;
+
+    coord = u_shadowMatrix[cascade] * vec4(v_WorldPosition, 1.0);
+
+    // keep the kernel inside the cascade's part of the texture
+    cascadeWidth = 1.0 / float(u_numCascades);
+    margin = float(u_pcfRadius + 1) * u_shadowTexelSize.x;
+    coord.x = clamp(coord.x, float(cascade) * cascadeWidth + margin,
+            float(cascade + 1) * cascadeWidth - margin);
+
+    sum = 0.0;
+    for(int y = -u_pcfRadius; y <= u_pcfRadius; y++) {
+        for(int x = -u_pcfRadius; x <= u_pcfRadius; x++) {
+            sum += shadow2D(s_shadowMap, vec3(coord.xy + vec2(float(x), float(y)) * u_shadowTexelSize,
+                        coord.z)).r;
+        }
+    }
+    width = 2 * u_pcfRadius + 1;
+    return sum / float(width * width);
+}
+#endif
 
 void main()
 {
     vec4 light;
+#ifdef DIRECTIONAL_LIGHT
     float directionalFactor;
-    vec4 directionalLight;
-    vec4 pointLight;
-    float pointLightFactor;
+#endif
     vec4 texColor;
 
     texColor = texture2D(s_texture, v_texCoord);
+#ifdef VERTEX_COLOR
+    texColor *= v_Color;
+#endif
+#ifdef ALPHA_TEST
     if(texColor.a < 0.5)
         discard;
+#endif
 
-    light = vec4(0.0);
-
-    if(u_ambientLightEnabled)
-        light = vec4(u_ambientLight, 1.0);
-
-    if(u_directionalLightEnabled) {
-        directionalFactor = dot(normalize(v_Normal), -u_directionalLightDirection);
-        if(directionalFactor > 0.0)
-            directionalLight = vec4(u_directionalLightColor, 1.0) * directionalFactor;
-        else
-            directionalLight = vec4(0.0);
-
-        light += directionalLight;
-    }
-
-    if(u_pointLightEnabled) {
-        pointLightFactor = 1.0 / (u_pointLightAttenuation.x + u_pointLightAttenuation.y * v_PointLightDistance +
-                    u_pointLightAttenuation.z * v_PointLightDistance * v_PointLightDistance);
-        pointLightFactor = clamp(pointLightFactor, 0, 1);
-        pointLight = vec4(pointLightFactor * u_pointLightColor, 1.0);
-        light += pointLight;
+    // everything but the shadowed directional light is done per vertex
+    light = v_Light;
+#ifdef DIRECTIONAL_LIGHT
+    if(v_DirectionalFactor > 0.0) {
+        directionalFactor = v_DirectionalFactor;
+#ifdef SHADOWS
+        directionalFactor *= shadowFactor();
+#endif
+        light += vec4(u_directionalLightColor, 1.0) * directionalFactor;
     }
+#endif
 
-    light = clamp(light, 0, 1);
+    light = clamp(light, 0.0, 1.0);
     gl_FragColor = texColor * light;
 }
-
@@ -1,20 +1,107 @@
+#version 120
+// Features are selected with #defines, see ShaderVariants.h.
+
 attribute vec3 a_Position;
 attribute vec2 a_texCoord;
 attribute vec3 a_Normal;
+#ifdef VERTEX_COLOR
+attribute vec4 a_Color;
+#endif
+
+#ifdef INSTANCING
+attribute mat4 a_World;
+// inverse transpose of the upper 3x3 of a_World
+attribute mat3 a_NormalMatrix;
+#else
+uniform mat4 u_world;
+// inverse transpose of the upper 3x3 of u_world
+uniform mat3 u_normalMatrix;
+#endif
+uniform mat4 u_viewProjection;
+
+// the shading pass tests GL_EQUAL against the depths of the pre-pass,
+// so both programs must write exactly the same depth
+invariant gl_Position;
 
-uniform mat4 u_MVP;
-uniform mat4 u_inverseMVP;
+#ifdef AMBIENT_LIGHT
+uniform vec3 u_ambientLight;
+#endif
+#ifdef DIRECTIONAL_LIGHT
+uniform vec3 u_directionalLightDirection;
+#endif
+#ifdef POINT_LIGHT
 uniform vec3 u_pointLightPosition;
+uniform vec3 u_pointLightColor;
+uniform vec3 u_pointLightAttenuation;
+#endif
 
 varying vec2 v_texCoord;
-varying vec3 v_Normal;
-varying float v_PointLightDistance;
+// ambient and point light
+varying vec4 v_Light;
+#ifdef VERTEX_COLOR
+varying vec4 v_Color;
+#endif
+#ifdef DIRECTIONAL_LIGHT
+// N.L of the directional light, which the fragment shader shadows
+varying float v_DirectionalFactor;
+#endif
+#ifdef SHADOWS
+varying vec3 v_WorldPosition;
+varying float v_ViewDepth;
+#endif
 
 void main()
 {
-    gl_Position = u_MVP * vec4(a_Position, 1.0);
+    mat4 world;
+    vec4 worldPosition;
+#ifdef DIRECTIONAL_LIGHT
+    mat3 normalMatrix;
+    vec3 normal;
+#endif
+#ifdef POINT_LIGHT
+    float pointLightDistance;
+    float pointLightFactor;
+#endif
+
+#ifdef INSTANCING
+    world = a_World;
+#else
+    world = u_world;
+#endif
+
+    // the same expressions as in depth.vert
+    worldPosition = world * vec4(a_Position, 1.0);
+    gl_Position = u_viewProjection * worldPosition;
+
     v_texCoord = a_texCoord;
-    v_Normal = vec3(vec4(a_Normal, 1.0) * u_inverseMVP);
-    v_PointLightDistance = distance(a_Position, u_pointLightPosition);
-}
+#ifdef VERTEX_COLOR
+    v_Color = a_Color;
+#endif
+#ifdef SHADOWS
+    v_WorldPosition = worldPosition.xyz;
+    v_ViewDepth = gl_Position.w;
+#endif
+
+    v_Light = vec4(0.0);
+#ifdef AMBIENT_LIGHT
+    v_Light = vec4(u_ambientLight, 1.0);
+#endif
 
+#ifdef POINT_LIGHT
+    pointLightDistance = distance(worldPosition.xyz, u_pointLightPosition);
+    pointLightFactor = 1.0 / (u_pointLightAttenuation.x + u_pointLightAttenuation.y * pointLightDistance +
+                u_pointLightAttenuation.z * pointLightDistance * pointLightDistance);
+    pointLightFactor = clamp(pointLightFactor, 0.0, 1.0);
+    v_Light += vec4(pointLightFactor * u_pointLightColor, 1.0);
+#endif
+
+#ifdef DIRECTIONAL_LIGHT
+#ifdef INSTANCING
+    normalMatrix = a_NormalMatrix;
+#else
+    normalMatrix = u_normalMatrix;
+#endif
+    normal = normalize(normalMatrix * a_Normal);
+    v_DirectionalFactor = max(dot(normal, -u_directionalLightDirection), 0.0);
+#endif
+}
@@ -0,0 +1,20 @@
+// Features are selected with #defines, see ShaderVariants.h. Only
+// INSTANCING is used.
+
+attribute vec3 a_Position;
+
+#ifdef INSTANCING
+attribute mat4 a_World;
+#else
+uniform mat4 u_world;
+#endif
+uniform mat4 u_viewProjection;
+
+void main()
+{
+#ifdef INSTANCING
+    gl_Position = u_viewProjection * (a_World * vec4(a_Position, 1.0));
+#else
+    gl_Position = u_viewProjection * (u_world * vec4(a_Position, 1.0));
+#endif
+}
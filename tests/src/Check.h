@@ -0,0 +1,44 @@
+#ifndef SCENE_TESTS_CHECK_H
+#define SCENE_TESTS_CHECK_H
+
+#include <stdio.h>
+
+/* Checks for the unit tests, which run without a window or a GL
+ * context. A failed check is reported and counted, and the test
+ * continues; main() returns checkResult(). */
+
+static unsigned int checkFailures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			checkFailures++; \
+		} \
+	} while(0)
+
+#define CHECK_THROWS(expr) \
+	do { \
+		bool thrown = false; \
+		try { \
+			expr; \
+		} catch(...) { \
+			thrown = true; \
+		} \
+		if(!thrown) { \
+			fprintf(stderr, "%s:%d: no exception from: %s\n", __FILE__, __LINE__, #expr); \
+			checkFailures++; \
+		} \
+	} while(0)
+
+static inline int checkResult(const char* name)
+{
+	if(checkFailures) {
+		fprintf(stderr, "%s: %u checks failed\n", name, checkFailures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+#endif
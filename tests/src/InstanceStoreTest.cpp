@@ -0,0 +1,131 @@
+#include <string>
+#include <vector>
+
+#include "sscene/InstanceStore.h"
+
+#include "Check.h"
+
+using namespace Common;
+using namespace Scene;
+
+static InstanceHandle addAt(InstanceStore& store, float x)
+{
+	return store.add(nullptr, 0, 0, Vector3(x, 0, 0), Matrix44::Identity, Vector3(1, 1, 1));
+}
+
+// every live handle maps to a dense index that maps back to it
+static bool isConsistent(const InstanceStore& store, const std::vector<InstanceHandle>& live)
+{
+	if(store.size() != live.size())
+		return false;
+	for(const auto& h : live) {
+		if(!store.isValid(h))
+			return false;
+		if(store.getHandle(store.getDenseIndex(h)) != h)
+			return false;
+	}
+	return true;
+}
+
+static void testGenerationReuse()
+{
+	InstanceStore store;
+	auto a = addAt(store, 1);
+	auto b = addAt(store, 2);
+	CHECK(a.generation != 0 && b.generation != 0);
+	CHECK(a != b);
+
+	store.remove(a);
+	CHECK(!store.isValid(a));
+	CHECK(store.isValid(b));
+	CHECK_THROWS(store.getDenseIndex(a));
+	CHECK_THROWS(store.remove(a));
+
+	// the freed slot is reused with a new generation, the stale
+	// handle must not alias the new instance
+	auto c = addAt(store, 3);
+	CHECK(c.slot == a.slot);
+	CHECK(c.generation != a.generation);
+	CHECK(!store.isValid(a));
+	CHECK(store.isValid(c));
+	CHECK(store.getSlotCount() == 2);
+	CHECK(isConsistent(store, { b, c }));
+
+	// a default handle is never valid
+	CHECK(!store.isValid(InstanceHandle()));
+}
+
+static void testRemoveMovesLast()
+{
+	InstanceStore store;
+	std::vector<InstanceHandle> handles;
+	std::string names[4] = { "a", "b", "c", "d" };
+	for(int i = 0; i < 4; i++) {
+		handles.push_back(addAt(store, i));
+		store.setName(handles.back(), &names[i]);
+	}
+
+	// removing the first instance moves the last one into its place,
+	// its handle, name and transform included
+	store.remove(handles[0]);
+	handles.erase(handles.begin());
+	CHECK(isConsistent(store, handles));
+	CHECK(store.getDenseIndex(handles[2]) == 0);
+	CHECK(store.getName(handles[2]) == &names[3]);
+
+	store.updateWorldMatrices();
+	for(size_t i = 0; i < handles.size(); i++) {
+		const float* world = store.getWorldMatrix(store.getDenseIndex(handles[i]));
+		CHECK(world[12] == i + 1);
+	}
+
+	// removing the last instance moves nothing
+	store.remove(handles[1]);
+	handles.erase(handles.begin() + 1);
+	CHECK(isConsistent(store, handles));
+	CHECK(store.getName(handles[0]) == &names[1]);
+}
+
+static void testBatch()
+{
+	InstanceStore store;
+	auto first = addAt(store, 0);
+
+	std::vector<InstanceTransform> transforms;
+	for(int i = 1; i < 6; i++)
+		transforms.push_back(InstanceTransform::make(Vector3(i, 0, 0), Matrix44::Identity, Vector3(1, 1, 1)));
+	std::vector<InstanceHandle> handles(transforms.size());
+	store.add(nullptr, 0, 0, transforms.data(), transforms.size(), handles.data());
+	CHECK(store.size() == 6);
+	for(size_t i = 0; i < handles.size(); i++)
+		CHECK(store.getDenseIndex(handles[i]) == i + 1);
+
+	// the same handle twice in a batch removes the instance once
+	InstanceHandle removed[] = { handles[1], handles[4], handles[1], first };
+	store.remove(removed, 4);
+	CHECK(!store.isValid(handles[1]));
+	CHECK(!store.isValid(handles[4]));
+	CHECK(!store.isValid(first));
+	CHECK(isConsistent(store, { handles[0], handles[2], handles[3] }));
+
+	store.updateWorldMatrices();
+	for(int i : { 0, 2, 3 }) {
+		const float* world = store.getWorldMatrix(store.getDenseIndex(handles[i]));
+		CHECK(world[12] == i + 1);
+	}
+
+	// a batch with an invalid handle is rejected before anything is
+	// removed
+	InstanceHandle invalid[] = { handles[0], handles[1] };
+	CHECK_THROWS(store.remove(invalid, 2));
+	CHECK(store.isValid(handles[0]));
+	CHECK(store.size() == 3);
+}
+
+int main(int argc, char** argv)
+{
+	testGenerationReuse();
+	testRemoveMovesLast();
+	testBatch();
+	return checkResult("InstanceStoreTest");
+}
@@ -0,0 +1,140 @@
+#include <stdexcept>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "sscene/JobSystem.h"
+
+#include "Check.h"
+
+using namespace Scene;
+
+static void testDependencies(JobSystem& jobs)
+{
+	CHECK(JobHandle().isFinished());
+	jobs.wait(JobHandle());
+
+	std::atomic<int> step(0);
+	std::atomic<bool> ordered(true);
+	auto a = jobs.schedule([&] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			step = 1;
+			});
+	auto b = jobs.schedule([&] {
+			if(step != 1)
+				ordered = false;
+			step = 2;
+			}, { a });
+	auto c = jobs.schedule([&] {
+			if(step != 2)
+				ordered = false;
+			step = 3;
+			}, { a, b });
+	jobs.wait(c);
+	CHECK(c.isFinished());
+	CHECK(a.isFinished() && b.isFinished());
+	CHECK(ordered);
+	CHECK(step == 3);
+}
+
+static void testMainThreadJobs(JobSystem& jobs)
+{
+	auto mainThread = std::this_thread::get_id();
+
+	// waiting for a main thread job runs it, and its dependencies,
+	// on the waiting main thread
+	std::atomic<bool> dependencyDone(false);
+	std::thread::id ranOn;
+	bool sawDependency = false;
+	auto dep = jobs.schedule([&] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			dependencyDone = true;
+			});
+	auto job = jobs.scheduleOnMainThread([&] {
+			ranOn = std::this_thread::get_id();
+			sawDependency = dependencyDone;
+			}, { dep });
+	jobs.wait(job);
+	CHECK(job.isFinished());
+	CHECK(ranOn == mainThread);
+	CHECK(sawDependency);
+
+	// a worker job never runs main thread jobs
+	std::atomic<int> ran(0);
+	auto queued = jobs.scheduleOnMainThread([&] { ran++; });
+	auto worker = jobs.schedule([&] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			});
+	jobs.wait(worker);
+	CHECK(ran == 0);
+	jobs.runMainThreadJobs();
+	CHECK(ran == 1);
+	CHECK(queued.isFinished());
+}
+
+static void testExceptions(JobSystem& jobs)
+{
+	auto job = jobs.schedule([] { throw std::runtime_error("job"); });
+	CHECK_THROWS(jobs.wait(job));
+	CHECK(job.isFinished());
+
+	auto mainJob = jobs.scheduleOnMainThread([] { throw std::runtime_error("main thread job"); });
+	CHECK_THROWS(jobs.wait(mainJob));
+
+	// the system keeps working afterwards
+	std::atomic<bool> ran(false);
+	jobs.wait(jobs.schedule([&] { ran = true; }));
+	CHECK(ran);
+
+	CHECK_THROWS(jobs.parallelFor(0, 100, 1, [] (size_t b, size_t e) {
+				if(b <= 50 && 50 < e)
+					throw std::runtime_error("parallelFor");
+				}));
+}
+
+static void testParallelFor(JobSystem& jobs)
+{
+	const size_t n = 1000;
+	std::vector<std::atomic<int>> visits(n);
+	for(auto& v : visits)
+		v = 0;
+
+	std::atomic<bool> inRange(true);
+	jobs.parallelFor(3, n, 7, [&] (size_t b, size_t e) {
+			if(e - b > 7 || e > n)
+				inRange = false;
+			for(size_t i = b; i < e; i++)
+				visits[i]++;
+			});
+	CHECK(inRange);
+	bool once = true;
+	for(size_t i = 0; i < n; i++) {
+		if(visits[i] != (i < 3 ? 0 : 1))
+			once = false;
+	}
+	CHECK(once);
+
+	// nested parallelFor from within jobs
+	std::atomic<size_t> sum(0);
+	jobs.parallelFor(0, 8, 1, [&] (size_t b, size_t e) {
+			jobs.parallelFor(0, 100, 10, [&] (size_t b2, size_t e2) {
+				sum += e2 - b2;
+				});
+			});
+	CHECK(sum == 800);
+}
+
+int main(int argc, char** argv)
+{
+	// without workers as well, where everything runs on the main thread
+	for(unsigned int workers : { 0, 3 }) {
+		JobSystem jobs(workers);
+		CHECK(jobs.getNumWorkers() == workers);
+		testDependencies(jobs);
+		testMainThreadJobs(jobs);
+		testExceptions(jobs);
+		testParallelFor(jobs);
+	}
+	return checkResult("JobSystemTest");
+}
@@ -0,0 +1,116 @@
+#include "sscene/MeshBuffer.h"
+
+#include "Check.h"
+
+using namespace Scene;
+
+static void testAllocate()
+{
+	RangeAllocator alloc(30);
+	CHECK(alloc.getCapacity() == 30);
+	CHECK(alloc.getFree() == 30);
+
+	size_t a, b, c, d;
+	CHECK(alloc.allocate(10, a));
+	CHECK(alloc.allocate(10, b));
+	CHECK(alloc.allocate(10, c));
+	CHECK(a == 0 && b == 10 && c == 20);
+	CHECK(alloc.getFree() == 0);
+	CHECK(!alloc.allocate(1, d));
+
+	// zero sized allocations always succeed
+	CHECK(alloc.allocate(0, d));
+	alloc.free(d, 0);
+	CHECK(alloc.getFree() == 0);
+}
+
+static void testMerge()
+{
+	size_t offsets[5];
+	RangeAllocator alloc(50);
+	for(auto& o : offsets)
+		alloc.allocate(10, o);
+
+	// only merged ranges fit 20
+	alloc.free(offsets[1], 10);
+	alloc.free(offsets[3], 10);
+	size_t o;
+	CHECK(alloc.getFree() == 20);
+	CHECK(!alloc.allocate(20, o));
+
+	// with the range before it
+	alloc.free(offsets[4], 10);
+	CHECK(alloc.allocate(20, o));
+	CHECK(o == 30);
+	alloc.free(o, 20);
+
+	// with the range after it
+	alloc.free(offsets[0], 10);
+	CHECK(alloc.allocate(20, o));
+	CHECK(o == 0);
+	alloc.free(o, 20);
+
+	// with the ranges on both sides
+	alloc.free(offsets[2], 10);
+	CHECK(alloc.getFree() == 50);
+	CHECK(alloc.allocate(50, o));
+	CHECK(o == 0);
+	CHECK(alloc.getFree() == 0);
+}
+
+static void testBestFit()
+{
+	RangeAllocator alloc(100);
+	size_t a, b, c, d;
+	alloc.allocate(10, a);
+	alloc.allocate(30, b);
+	alloc.allocate(10, c);
+	alloc.allocate(15, d);
+	alloc.free(a, 10);
+	alloc.free(c, 10);
+	// free: [0, 10), [40, 50) and [65, 100)
+
+	// the smallest range that fits is used, the rest of it stays free
+	size_t o;
+	CHECK(alloc.allocate(8, o));
+	CHECK(o == 0);
+	CHECK(alloc.allocate(2, o));
+	CHECK(o == 8);
+	CHECK(alloc.allocate(20, o));
+	CHECK(o == 65);
+	CHECK(alloc.allocate(10, o));
+	CHECK(o == 40);
+	CHECK(alloc.getFree() == 15);
+}
+
+static void testReset()
+{
+	RangeAllocator alloc;
+	size_t o;
+	CHECK(!alloc.allocate(1, o));
+
+	alloc.reset(64, 24);
+	CHECK(alloc.getCapacity() == 64);
+	CHECK(alloc.getFree() == 40);
+	CHECK(alloc.allocate(40, o));
+	CHECK(o == 24);
+
+	// a range freed in front of the used space merges too
+	alloc.free(0, 24);
+	alloc.free(24, 40);
+	CHECK(alloc.allocate(64, o));
+	CHECK(o == 0);
+
+	alloc.reset(16, 16);
+	CHECK(alloc.getFree() == 0);
+	CHECK(!alloc.allocate(1, o));
+}
+
+int main(int argc, char** argv)
+{
+	testAllocate();
+	testMerge();
+	testBestFit();
+	testReset();
+	return checkResult("RangeAllocatorTest");
+}
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+
+#include <SDL/SDL.h>
+
+#include "sscene/Scene.h"
+#include "sscene/WorldPartition.h"
+
+#include "common/Math.h"
+
+/* Renders a synthetic, reproducible scene for a fixed number of frames
+ * and writes per-frame timings and counters as JSON to the output file
+ * (stdout is left to the library's own logging).
+ * Run from the tests directory (like SceneCube) as the textures are
+ * loaded from share/. On machines without a display, run under a virtual
+ * X server, e.g. xvfb-run. */
+
+using namespace Common;
+
+struct BenchConfig {
+	unsigned int instances = 1000;
+	unsigned int models = 4;
+	unsigned int overlays = 4;
+	unsigned int lines = 100;
+	unsigned int terrainSize = 64;
+	unsigned int frames = 500;
+	unsigned int warmupFrames = 20;
+	unsigned int seed = 1;
+	unsigned int screenWidth = 800;
+	unsigned int screenHeight = 600;
+	bool movingInstances = false;
+	unsigned int workerThreads = Scene::JobSystem::DefaultWorkers;
+	// 0 disables shadows
+	unsigned int shadowCascades = 0;
+	bool depthPrepass = false;
+	bool occlusionCulling = false;
+	// empty compiles the programs every run
+	std::string programCache;
+	// empty uses the decoded images uncompressed
+	std::string textureCache;
+	// megabytes; 0 keeps all texture levels resident
+	unsigned int textureBudget = 0;
+	// instances per cell of a streamed world the camera flies through;
+	// 0 disables it
+	unsigned int worldInstances = 0;
+	std::string outputFile = "scenebench.json";
+};
+
+struct FrameResult {
+	double cpuMs;
+	double gpuMs;
+	Scene::FrameStats stats;
+};
+
+class BenchHeightmap : public Scene::Heightmap {
+	public:
+		BenchHeightmap(unsigned int size) : mSize(size) { }
+		virtual float getHeightAt(float x, float y) const
+		{
+			return 3.0f * sin(x * 0.20f) + 5.0f * cos(y * 0.10f) - 8.0f;
+		}
+		virtual unsigned int getWidth() const
+		{
+			return mSize;
+		}
+		virtual float getXZScale() const
+		{
+			return 2.0f;
+		}
+		virtual bool isThreadSafe() const
+		{
+			return true;
+		}
+
+	private:
+		unsigned int mSize;
+};
+
+static void usage(FILE* out, const char* prog)
+{
+	fprintf(out, "Usage: %s [-n instances] [-m models] [-k overlays] [-l line segments]\n"
+			"\t[-s terrain size] [-f frames] [-w warmup frames] [-r seed] [-j worker threads]\n"
+			"\t[-c shadow cascades] [-p program cache directory]\n"
+			"\t[-t texture cache directory] [-b texture budget in MB] [-g instances per world cell]\n"
+			"\t[-o output file] [-x] [-d] [-q] [-h]\n"
+			"\t-g: fly through a streamed world of cubes\n"
+			"\t-x: move all instances every frame\n"
+			"\t-d: depth pre-pass\n"
+			"\t-q: occlusion culling\n", prog);
+}
+
+static bool parseArgs(int argc, char** argv, BenchConfig& c)
+{
+	int opt;
+	while((opt = getopt(argc, argv, "n:m:k:l:s:f:w:r:j:c:p:t:b:g:o:xdqh")) != -1) {
+		switch(opt) {
+			case 'n': c.instances = atoi(optarg); break;
+			case 'm': c.models = std::max(1, atoi(optarg)); break;
+			case 'k': c.overlays = atoi(optarg); break;
+			case 'l': c.lines = atoi(optarg); break;
+			case 's': c.terrainSize = atoi(optarg); break;
+			case 'f': c.frames = std::max(1, atoi(optarg)); break;
+			case 'w': c.warmupFrames = atoi(optarg); break;
+			case 'r': c.seed = atoi(optarg); break;
+			case 'j': c.workerThreads = atoi(optarg); break;
+			case 'c': c.shadowCascades = atoi(optarg); break;
+			case 'p': c.programCache = optarg; break;
+			case 't': c.textureCache = optarg; break;
+			case 'b': c.textureBudget = atoi(optarg); break;
+			case 'g': c.worldInstances = atoi(optarg); break;
+			case 'o': c.outputFile = optarg; break;
+			case 'x': c.movingInstances = true; break;
+			case 'd': c.depthPrepass = true; break;
+			case 'q': c.occlusionCulling = true; break;
+			case 'h': usage(stdout, argv[0]); exit(0);
+			default: return false;
+		}
+	}
+	return true;
+}
+
+static void buildScene(Scene::Scene& scene, const BenchConfig& c, std::mt19937& rng,
+		std::vector<boost::shared_ptr<Scene::MeshInstance>>& instances)
+{
+	std::uniform_real_distribution<float> posDist(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> angleDist(0.0f, 2.0f * PI);
+	std::uniform_real_distribution<float> scaleDist(0.5f, 2.0f);
+	std::uniform_int_distribution<unsigned int> colDist(0, 255);
+
+	scene.addTexture("Snow", "share/snow.jpg");
+
+	// models differ by their number of triangles
+	for(unsigned int i = 0; i < c.models; i++) {
+		std::stringstream ss;
+		ss << "Model" << i;
+		scene.addPlane(ss.str(), 1.0f, 1.0f, 1 + i * 3);
+	}
+
+	if(c.terrainSize) {
+		BenchHeightmap hm(c.terrainSize);
+		scene.addModelFromHeightmap("Terrain", hm);
+		scene.addMeshInstance("Terrain", "Terrain", "Snow");
+	}
+
+	for(unsigned int i = 0; i < c.instances; i++) {
+		std::stringstream name;
+		std::stringstream model;
+		name << "Instance" << i;
+		model << "Model" << (i % c.models);
+		auto mi = scene.addMeshInstance(name.str(), model.str(), "Snow");
+		mi->setPosition(Vector3(posDist(rng), posDist(rng) * 0.2f, posDist(rng)));
+		mi->setRotationFromEuler(Vector3(angleDist(rng), angleDist(rng), angleDist(rng)));
+		float s = scaleDist(rng);
+		mi->setScale(s, s, s);
+		instances.push_back(mi);
+	}
+
+	for(unsigned int i = 0; i < c.lines; i++) {
+		Vector3 start(posDist(rng), posDist(rng), posDist(rng));
+		Vector3 end(posDist(rng), posDist(rng), posDist(rng));
+		scene.addLine("Lines", start, end, Color(colDist(rng), colDist(rng), colDist(rng)));
+	}
+
+	for(unsigned int i = 0; i < c.overlays; i++) {
+		std::stringstream ss;
+		ss << "Overlay" << i;
+		scene.addOverlay(ss.str(), "share/overlay.png");
+		scene.setOverlayEnabled(ss.str(), true);
+		scene.setOverlayPosition(ss.str(), (i * 37) % c.screenWidth, (i * 53) % c.screenHeight, 64, 64);
+		scene.setOverlayDepth(ss.str(), i / static_cast<float>(c.overlays));
+	}
+
+	scene.getAmbientLight().setState(true);
+	scene.getDirectionalLight().setState(true);
+	scene.getDirectionalLight().setDirection(Vector3(1, -1, 1));
+	scene.getPointLight().setState(true);
+	scene.getPointLight().setAttenuation(Vector3(0, 0, 3));
+}
+
+// a cell of cubes that only depends on the coordinates and the seed,
+// as the cells are made on the worker threads in any order
+static bool makeWorldCell(const BenchConfig& c, float cellSize, int x, int z, Scene::WorldCell& cell)
+{
+	std::mt19937 rng(c.seed ^ (uint32_t(x) * 73856093u) ^ (uint32_t(z) * 19349663u));
+	std::uniform_real_distribution<float> posDist(0.0f, cellSize);
+
+	cell.models.push_back({ "Cube", "share/textured-cube.obj" });
+	cell.textures.push_back({ "Snow", "share/snow.jpg" });
+	Scene::WorldCell::Instances cubes;
+	cubes.model = "Cube";
+	cubes.texture = "Snow";
+	for(unsigned int i = 0; i < c.worldInstances; i++) {
+		Vector3 pos(x * cellSize + posDist(rng), 0.0f, z * cellSize + posDist(rng));
+		cubes.transforms.push_back(Scene::InstanceTransform::make(pos, Matrix44::Identity,
+					Vector3(1.0f, 1.0f, 1.0f)));
+	}
+	cell.instances.push_back(cubes);
+	return true;
+}
+
+static double mean(const std::vector<double>& v)
+{
+	double sum = 0.0;
+	for(auto d : v)
+		sum += d;
+	return v.empty() ? 0.0 : sum / v.size();
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+	if(v.empty())
+		return 0.0;
+	std::sort(v.begin(), v.end());
+	size_t idx = std::min(v.size() - 1, static_cast<size_t>(p * v.size()));
+	return v[idx];
+}
+
+static void printSummary(FILE* f, const char* name, const std::vector<double>& v, bool last)
+{
+	fprintf(f, "\t\t\"%s\": { \"mean\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"max\": %.4f }%s\n",
+			name, mean(v), percentile(v, 0.5), percentile(v, 0.95),
+			percentile(v, 1.0), last ? "" : ",");
+}
+
+// the GL strings are driver defined and may contain quotes or
+// backslashes
+static std::string jsonEscape(const GLubyte* str)
+{
+	std::string ret;
+	if(!str)
+		return ret;
+	for(const char* p = reinterpret_cast<const char*>(str); *p; p++) {
+		if(*p == '"' || *p == '\\') {
+			ret += '\\';
+			ret += *p;
+		} else if(static_cast<unsigned char>(*p) < 0x20) {
+			ret += ' ';
+		} else {
+			ret += *p;
+		}
+	}
+	return ret;
+}
+
+static void printResults(FILE* f, const BenchConfig& c, unsigned int workers, bool gpuTimers,
+		double initMs, double firstFrameMs, size_t textureBytes, unsigned int cellsLoaded,
+		unsigned int cellsUnloaded, const std::vector<FrameResult>& results)
+{
+	std::vector<double> cpu, gpu, draws, states, tris, texbinds, bufbinds, uniforms, bytes;
+	std::vector<double> shadowGpu, shadowDraws, shadowTris, occluded, shadedPerPixel;
+	std::vector<double> textureResident, levelsStreamed, levelsEvicted, uploadStalls;
+	std::vector<double> indirectDraws;
+	for(const auto& r : results) {
+		cpu.push_back(r.cpuMs);
+		gpu.push_back(r.gpuMs);
+		draws.push_back(r.stats.drawCalls);
+		states.push_back(r.stats.stateChanges);
+		tris.push_back(r.stats.triangles);
+		texbinds.push_back(r.stats.textureBinds);
+		bufbinds.push_back(r.stats.bufferBinds);
+		uniforms.push_back(r.stats.uniformUploads);
+		bytes.push_back(r.stats.bytesUploaded);
+		shadowGpu.push_back(r.stats.passGpuMs[static_cast<int>(Scene::RenderPass::Shadows)]);
+		shadowDraws.push_back(r.stats.shadowDrawCalls);
+		shadowTris.push_back(r.stats.shadowTriangles);
+		occluded.push_back(r.stats.instancesOccluded);
+		shadedPerPixel.push_back(r.stats.shadedPerPixel);
+		textureResident.push_back(r.stats.textureBytesResident);
+		levelsStreamed.push_back(r.stats.textureLevelsStreamed);
+		levelsEvicted.push_back(r.stats.textureLevelsEvicted);
+		uploadStalls.push_back(r.stats.uploadStalls);
+		indirectDraws.push_back(r.stats.indirectDraws);
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"config\": { \"instances\": %u, \"models\": %u, \"overlays\": %u, \"lines\": %u, "
+			"\"terrain_size\": %u, \"frames\": %u, \"warmup_frames\": %u, \"seed\": %u, "
+			"\"moving_instances\": %s, \"width\": %u, \"height\": %u, \"worker_threads\": %u, "
+			"\"shadow_cascades\": %u, \"depth_prepass\": %s, \"occlusion_culling\": %s, "
+			"\"program_cache\": %s, \"texture_cache\": %s, \"texture_budget_mb\": %u, "
+			"\"world_instances_per_cell\": %u },\n",
+			c.instances, c.models, c.overlays, c.lines, c.terrainSize, c.frames,
+			c.warmupFrames, c.seed, c.movingInstances ? "true" : "false",
+			c.screenWidth, c.screenHeight, workers, c.shadowCascades,
+			c.depthPrepass ? "true" : "false", c.occlusionCulling ? "true" : "false",
+			c.programCache.empty() ? "false" : "true",
+			c.textureCache.empty() ? "false" : "true", c.textureBudget, c.worldInstances);
+	// Scene::init() and the first frame, which compiles the shader
+	// variants it draws
+	fprintf(f, "\t\"startup\": { \"init_ms\": %.4f, \"first_frame_ms\": %.4f, \"texture_bytes\": %zu },\n",
+			initMs, firstFrameMs, textureBytes);
+	fprintf(f, "\t\"world\": { \"cells_loaded\": %u, \"cells_unloaded\": %u },\n",
+			cellsLoaded, cellsUnloaded);
+	fprintf(f, "\t\"gl\": { \"vendor\": \"%s\", \"renderer\": \"%s\", \"version\": \"%s\", \"gpu_timers\": %s },\n",
+			jsonEscape(glGetString(GL_VENDOR)).c_str(), jsonEscape(glGetString(GL_RENDERER)).c_str(),
+			jsonEscape(glGetString(GL_VERSION)).c_str(),
+			gpuTimers ? "true" : "false");
+	fprintf(f, "\t\"build\": { \"transform_kernels\": \"%s\" },\n",
+			Scene::TransformKernels::getInstructionSet());
+	fprintf(f, "\t\"summary\": {\n");
+	printSummary(f, "cpu_ms", cpu, false);
+	printSummary(f, "gpu_ms", gpu, false);
+	printSummary(f, "draw_calls", draws, false);
+	printSummary(f, "state_changes", states, false);
+	printSummary(f, "triangles", tris, false);
+	printSummary(f, "texture_binds", texbinds, false);
+	printSummary(f, "buffer_binds", bufbinds, false);
+	printSummary(f, "uniform_uploads", uniforms, false);
+	printSummary(f, "bytes_uploaded", bytes, false);
+	// the pass timer lags two frames behind
+	printSummary(f, "shadow_gpu_ms", shadowGpu, false);
+	printSummary(f, "shadow_draw_calls", shadowDraws, false);
+	printSummary(f, "shadow_triangles", shadowTris, false);
+	printSummary(f, "instances_occluded", occluded, false);
+	printSummary(f, "texture_bytes_resident", textureResident, false);
+	printSummary(f, "texture_levels_streamed", levelsStreamed, false);
+	printSummary(f, "texture_levels_evicted", levelsEvicted, false);
+	printSummary(f, "upload_stalls", uploadStalls, false);
+	printSummary(f, "indirect_draws", indirectDraws, false);
+	// lags two frames behind as well
+	printSummary(f, "shaded_per_pixel", shadedPerPixel, true);
+	fprintf(f, "\t},\n");
+	fprintf(f, "\t\"frames\": [\n");
+	for(unsigned int i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		fprintf(f, "\t\t{ \"cpu_ms\": %.4f, \"gpu_ms\": %.4f, \"draw_calls\": %u, \"state_changes\": %u, "
+				"\"triangles\": %u, \"texture_binds\": %u, \"buffer_binds\": %u, "
+				"\"uniform_uploads\": %u, \"bytes_uploaded\": %u }%s\n",
+				r.cpuMs, r.gpuMs, r.stats.drawCalls, r.stats.stateChanges,
+				r.stats.triangles, r.stats.textureBinds, r.stats.bufferBinds,
+				r.stats.uniformUploads, r.stats.bytesUploaded,
+				i + 1 == results.size() ? "" : ",");
+	}
+	fprintf(f, "\t]\n");
+	fprintf(f, "}\n");
+}
+
+int main(int argc, char** argv)
+{
+	BenchConfig config;
+	if(!parseArgs(argc, argv, config)) {
+		usage(stderr, argv[0]);
+		return 1;
+	}
+
+	if(SDL_Init(SDL_INIT_VIDEO) < 0) {
+		fprintf(stderr, "Unable to init SDL: %s\n", SDL_GetError());
+		return 1;
+	}
+	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+	if(!SDL_SetVideoMode(config.screenWidth, config.screenHeight, 0, SDL_OPENGL)) {
+		fprintf(stderr, "Unable to set video mode: %s\n", SDL_GetError());
+		SDL_Quit();
+		return 1;
+	}
+
+	try {
+		Scene::Scene scene(config.screenWidth, config.screenHeight, config.workerThreads);
+		auto initStart = std::chrono::steady_clock::now();
+		scene.setProgramCacheDirectory(config.programCache);
+		scene.setTextureCacheDirectory(config.textureCache);
+		Scene::TextureStreamingSettings streaming;
+		streaming.budget = size_t(config.textureBudget) << 20;
+		scene.setTextureStreamingSettings(streaming);
+		scene.init();
+		double initMs = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - initStart).count();
+		double firstFrameMs = 0.0;
+		if(config.shadowCascades) {
+			Scene::ShadowSettings shadows;
+			shadows.enabled = true;
+			shadows.numCascades = config.shadowCascades;
+			scene.setShadowSettings(shadows);
+		}
+		scene.setDepthPrepassEnabled(config.depthPrepass);
+		scene.setOcclusionCullingEnabled(config.occlusionCulling);
+
+		std::mt19937 rng(config.seed);
+		std::vector<boost::shared_ptr<Scene::MeshInstance>> instances;
+		buildScene(scene, config, rng, instances);
+
+		auto& cam = scene.getDefaultCamera();
+		cam.setPosition(Vector3(0.0f, 20.0f, -80.0f));
+
+		// cells small enough that the flight crosses many of them
+		const float cellSize = 50.0f;
+		std::unique_ptr<Scene::WorldPartition> world;
+		if(config.worldInstances) {
+			Scene::WorldPartitionSettings ws;
+			ws.cellSize = cellSize;
+			ws.loadRadius = 150.0f;
+			ws.unloadRadius = 200.0f;
+			world.reset(new Scene::WorldPartition(scene, [&config, cellSize] (int x, int z, Scene::WorldCell& cell) {
+						return makeWorldCell(config, cellSize, x, z, cell); }, ws));
+		}
+
+		bool gpuTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+		// timestamps rather than GL_TIME_ELAPSED as the scene times its
+		// passes with elapsed time queries which can't be nested
+		std::vector<GLuint> queries(config.frames * 2);
+		if(gpuTimers)
+			glGenQueries(queries.size(), &queries[0]);
+
+		std::vector<FrameResult> results(config.frames);
+		unsigned int total = config.warmupFrames + config.frames;
+		for(unsigned int i = 0; i < total; i++) {
+			bool measured = i >= config.warmupFrames;
+			unsigned int fi = i - config.warmupFrames;
+
+			// deterministic camera path so that every run sees the same frames
+			cam.rotate(0.01f, 0.0f);
+			if(world) {
+				cam.setPosition(Vector3(0.0f, 20.0f, -80.0f + 2.0f * i));
+				world->update(cam, 1.0f / 60.0f);
+			}
+			if(config.movingInstances) {
+				for(auto& mi : instances) {
+					mi->move(Vector3(0.0f, 0.01f * sin(i * 0.1f), 0.0f));
+				}
+			}
+
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			if(measured && gpuTimers)
+				glQueryCounter(queries[fi * 2], GL_TIMESTAMP);
+
+			auto start = std::chrono::steady_clock::now();
+			scene.render();
+			auto end = std::chrono::steady_clock::now();
+
+			if(measured && gpuTimers)
+				glQueryCounter(queries[fi * 2 + 1], GL_TIMESTAMP);
+
+			if(i == 0)
+				firstFrameMs = std::chrono::duration<double, std::milli>(end - start).count();
+			if(measured) {
+				results[fi].cpuMs = std::chrono::duration<double, std::milli>(end - start).count();
+				results[fi].gpuMs = 0.0;
+				results[fi].stats = scene.getFrameStats();
+			}
+
+			SDL_GL_SwapBuffers();
+		}
+
+		glFinish();
+
+		unsigned int cellsLoaded = 0;
+		unsigned int cellsUnloaded = 0;
+		if(world) {
+			world->clear();
+			cellsLoaded = world->getCellsLoaded();
+			cellsUnloaded = world->getCellsUnloaded();
+			// finishes the loads still in progress
+			world.reset();
+		}
+
+		if(gpuTimers) {
+			for(unsigned int i = 0; i < config.frames; i++) {
+				GLuint64 start = 0;
+				GLuint64 end = 0;
+				glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &start);
+				glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+				results[i].gpuMs = (end - start) / 1000000.0;
+			}
+			glDeleteQueries(queries.size(), &queries[0]);
+		}
+
+		FILE* f = fopen(config.outputFile.c_str(), "w");
+		if(!f) {
+			fprintf(stderr, "Unable to open %s for writing\n", config.outputFile.c_str());
+			SDL_Quit();
+			return 1;
+		}
+		printResults(f, config, scene.getJobSystem().getNumWorkers(), gpuTimers, initMs, firstFrameMs,
+				scene.getTextureMemory(), cellsLoaded, cellsUnloaded, results);
+		fclose(f);
+	} catch(std::exception& e) {
+		std::cerr << "std::exception: " << e.what() << "\n";
+		SDL_Quit();
+		return 1;
+	}
+
+	SDL_Quit();
+	return 0;
+}
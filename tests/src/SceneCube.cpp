@@ -16,7 +16,8 @@ using namespace Common;
 
 class SceneCube : public Common::Driver {
 	public:
-		SceneCube();
+		// with a shader directory, the shaders are reloaded when saved
+		SceneCube(const char* shaderDirectory);
 		virtual bool handleKeyDown(float frameTime, SDLKey key) override;
 		virtual bool handleKeyUp(float frameTime, SDLKey key) override;
 		virtual bool handleMouseMotion(float frameTime, const SDL_MouseMotionEvent& ev) override;
@@ -34,6 +35,7 @@ class SceneCube : public Common::Driver {
 		bool mDirectionalLightEnabled;
 		bool mPointLightEnabled;
 		bool mWireframe;
+		bool mStatsOverlay;
 		std::map<SDLKey, std::function<void (float)>> mControls;
 		Common::Vector3 mOldLinePos;
 };
@@ -60,7 +62,7 @@ float Heightmap::getXZScale() const
 	return 2.0f;
 }
 
-SceneCube::SceneCube()
+SceneCube::SceneCube(const char* shaderDirectory)
 	: Common::Driver(screenWidth, screenHeight, "Cube"),
 	mScene(Scene::Scene(800, 600)),
 	mCamera(mScene.getDefaultCamera()),
@@ -69,9 +71,12 @@ SceneCube::SceneCube()
 	mAmbientLightEnabled(true),
 	mDirectionalLightEnabled(true),
 	mPointLightEnabled(true),
-	mWireframe(false)
+	mWireframe(false),
+	mStatsOverlay(false)
 {
 	mScene.init();
+	if(shaderDirectory)
+		mScene.setShaderReloadDirectory(shaderDirectory);
 
 	mControls[SDLK_UP] = [&] (float p) { mCamera.setForwardMovement(p); };
 	mControls[SDLK_PAGEUP] = [&] (float p) { mCamera.setUpwardsMovement(p); };
@@ -189,6 +194,9 @@ bool SceneCube::handleKeyDown(float frameTime, SDLKey key)
 		} else if(key == SDLK_F8) {
 			mWireframe = !mWireframe;
 			mScene.setWireframe(mWireframe);
+		} else if(key == SDLK_F9) {
+			mStatsOverlay = !mStatsOverlay;
+			mScene.setFrameStatsOverlayEnabled(mStatsOverlay);
 		}
 	}
 
@@ -260,7 +268,7 @@ void SceneCube::drawFrame()
 int main(int argc, char** argv)
 {
 	try {
-		SceneCube app;
+		SceneCube app(argc > 1 ? argv[1] : nullptr);
 		app.run();
 	} catch(std::exception& e) {
 		std::cerr << "std::exception: " << e.what() << "\n";
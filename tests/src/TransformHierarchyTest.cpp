@@ -0,0 +1,158 @@
+#include "sscene/TransformHierarchy.h"
+
+#include "Check.h"
+
+using namespace Common;
+using namespace Scene;
+
+static void moveTo(TransformHierarchy& h, NodeHandle n, float x, float scale = 1)
+{
+	h.setLocalTransform(n, Vector3(x, 0, 0), Matrix44::Identity, Vector3(scale, scale, scale));
+}
+
+static float worldX(TransformHierarchy& h, NodeHandle n)
+{
+	return h.getWorldMatrix(n)[12];
+}
+
+static void testWorldMatrices()
+{
+	TransformHierarchy h(nullptr);
+	auto a = h.addNode();
+	auto b = h.addNode();
+	// added after b but stored before it, in a's subtree
+	auto c = h.addNode(a);
+	auto d = h.addNode(c);
+	moveTo(h, a, 1);
+	moveTo(h, b, 10);
+	moveTo(h, c, 100);
+	moveTo(h, d, 1000);
+	CHECK(h.size() == 4);
+	CHECK(worldX(h, b) == 10);
+	CHECK(worldX(h, c) == 101);
+	CHECK(worldX(h, d) == 1101);
+
+	// changing a parent updates the whole subtree
+	moveTo(h, a, 2);
+	CHECK(worldX(h, d) == 1102);
+	CHECK(worldX(h, b) == 10);
+
+	// the local transform is applied in the parent's space
+	moveTo(h, a, 1, 2);
+	CHECK(worldX(h, c) == 201);
+	CHECK(worldX(h, d) == 2201);
+}
+
+static void testSetParent()
+{
+	TransformHierarchy h(nullptr);
+	auto a = h.addNode();
+	auto b = h.addNode();
+	auto c = h.addNode(a);
+	auto d = h.addNode(c);
+	moveTo(h, a, 1);
+	moveTo(h, b, 10);
+	moveTo(h, c, 100);
+	moveTo(h, d, 1000);
+	h.update();
+
+	// the subtree moves along with the node
+	h.setParent(c, b);
+	CHECK(h.getParent(c) == b);
+	CHECK(h.getParent(d) == c);
+	CHECK(worldX(h, c) == 110);
+	CHECK(worldX(h, d) == 1110);
+	CHECK(worldX(h, a) == 1);
+
+	// to a root node and back under a node stored before it
+	h.setParent(c, NodeHandle());
+	CHECK(h.getParent(c) == NodeHandle());
+	CHECK(worldX(h, d) == 1100);
+	h.setParent(b, d);
+	CHECK(h.getParent(b) == d);
+	CHECK(worldX(h, b) == 1110);
+
+	// cycles are rejected and leave the hierarchy as it was
+	CHECK_THROWS(h.setParent(c, b));
+	CHECK_THROWS(h.setParent(c, c));
+	CHECK(h.getParent(c) == NodeHandle());
+	CHECK(h.getParent(b) == d);
+	CHECK(worldX(h, b) == 1110);
+}
+
+static void testRemoveNode()
+{
+	TransformHierarchy h(nullptr);
+	auto a = h.addNode();
+	auto b = h.addNode(a);
+	auto c = h.addNode(b);
+	auto d = h.addNode(b);
+	auto e = h.addNode(c);
+	moveTo(h, a, 1);
+	moveTo(h, b, 10);
+	moveTo(h, c, 100);
+	moveTo(h, d, 1000);
+	moveTo(h, e, 10000);
+	CHECK(worldX(h, e) == 10111);
+
+	// the children of a removed node are moved to its parent
+	h.removeNode(b);
+	CHECK(!h.isValid(b));
+	CHECK(h.size() == 4);
+	CHECK(h.getParent(c) == a);
+	CHECK(h.getParent(d) == a);
+	CHECK(h.getParent(e) == c);
+	CHECK(worldX(h, c) == 101);
+	CHECK(worldX(h, d) == 1001);
+	CHECK(worldX(h, e) == 10101);
+
+	// and those of a removed root node become root nodes
+	h.removeNode(a);
+	CHECK(h.getParent(c) == NodeHandle());
+	CHECK(h.getParent(d) == NodeHandle());
+	CHECK(worldX(h, e) == 10100);
+
+	// a freed slot is reused with a new generation
+	auto f = h.addNode(c);
+	CHECK(f.slot == a.slot);
+	CHECK(f != a);
+	CHECK(!h.isValid(a));
+	CHECK(h.getParent(f) == c);
+	CHECK_THROWS(h.removeNode(a));
+}
+
+static void testBoundInstances()
+{
+	InstanceStore store;
+	TransformHierarchy h(&store);
+	auto inst = store.add(nullptr, 0, 0, Vector3(), Matrix44::Identity, Vector3(1, 1, 1));
+	auto a = h.addNode();
+	auto b = h.addNode(a);
+	h.bindInstance(b, inst);
+	moveTo(h, a, 1);
+	moveTo(h, b, 10);
+	h.update();
+	store.updateWorldMatrices();
+	CHECK(store.getWorldMatrix(store.getDenseIndex(inst))[12] == 11);
+
+	// the instance follows when an ancestor moves
+	moveTo(h, a, 2);
+	h.update();
+	store.updateWorldMatrices();
+	CHECK(store.getWorldMatrix(store.getDenseIndex(inst))[12] == 12);
+
+	// a removed instance is skipped
+	store.remove(inst);
+	moveTo(h, a, 3);
+	h.update();
+	CHECK(store.size() == 0);
+}
+
+int main(int argc, char** argv)
+{
+	testWorldMatrices();
+	testSetParent();
+	testRemoveNode();
+	testBoundInstances();
+	return checkResult("TransformHierarchyTest");
+}
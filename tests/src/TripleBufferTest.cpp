@@ -0,0 +1,91 @@
+#include <thread>
+#include <atomic>
+
+#include "sscene/TripleBuffer.h"
+
+#include "Check.h"
+
+using namespace Scene;
+
+struct Frame {
+	unsigned int number = 0;
+	// equal to number unless the buffer was torn
+	unsigned int copy = 0;
+};
+
+static void write(TripleBuffer<Frame>& buf, unsigned int number)
+{
+	auto& f = buf.getWriteBuffer();
+	f.number = number;
+	f.copy = number;
+	buf.publish();
+}
+
+static void testHandover()
+{
+	TripleBuffer<Frame> buf;
+	CHECK(!buf.hasNew());
+	CHECK(!buf.acquire());
+
+	write(buf, 1);
+	CHECK(buf.hasNew());
+	CHECK(buf.acquire());
+	CHECK(buf.getReadBuffer().number == 1);
+	// nothing new, the read buffer stays
+	CHECK(!buf.hasNew());
+	CHECK(!buf.acquire());
+	CHECK(buf.getReadBuffer().number == 1);
+
+	// the reader skips to the latest frame
+	write(buf, 2);
+	write(buf, 3);
+	write(buf, 4);
+	CHECK(buf.acquire());
+	CHECK(buf.getReadBuffer().number == 4);
+	CHECK(!buf.acquire());
+
+	// the writer never writes to the buffer being read
+	for(unsigned int i = 5; i < 10; i++) {
+		CHECK(&buf.getWriteBuffer() != &buf.getReadBuffer());
+		write(buf, i);
+	}
+	CHECK(buf.getReadBuffer().number == 4);
+	CHECK(buf.acquire());
+	CHECK(buf.getReadBuffer().number == 9);
+}
+
+static void testThreaded()
+{
+	const unsigned int frames = 200000;
+	TripleBuffer<Frame> buf;
+	std::thread writer([&] {
+			for(unsigned int i = 1; i <= frames; i++)
+				write(buf, i);
+			});
+
+	// frames arrive in order, whole
+	unsigned int last = 0;
+	bool ordered = true;
+	bool whole = true;
+	while(last < frames) {
+		if(!buf.acquire())
+			continue;
+		const auto& f = buf.getReadBuffer();
+		if(f.number <= last)
+			ordered = false;
+		if(f.number != f.copy)
+			whole = false;
+		last = f.number;
+	}
+	writer.join();
+	CHECK(ordered);
+	CHECK(whole);
+	CHECK(!buf.acquire());
+}
+
+int main(int argc, char** argv)
+{
+	testHandover();
+	testThreaded();
+	return checkResult("TripleBufferTest");
+}